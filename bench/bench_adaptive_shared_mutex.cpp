@@ -0,0 +1,70 @@
+#include <baudvine/adaptive_shared_mutex.h>
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <shared_mutex>
+
+namespace {
+// std::mutex isn't a SharedLockable, so Mytex can't use it directly.
+class PlainMutex
+{
+public:
+  void lock() { mMutex.lock(); }
+  bool try_lock() { return mMutex.try_lock(); }
+  void unlock() { mMutex.unlock(); }
+  void lock_shared() { mMutex.lock(); }
+  bool try_lock_shared() { return mMutex.try_lock(); }
+  void unlock_shared() { mMutex.unlock(); }
+
+private:
+  std::mutex mMutex;
+};
+
+template<typename Lockable>
+void
+WriteHeavy(benchmark::State& state)
+{
+  static baudvine::Mytex<int, Lockable> mytex(0);
+  int i = 0;
+  for (auto _ : state) {
+    if (++i % 4 == 0) {
+      auto guard = mytex.LockShared();
+      benchmark::DoNotOptimize(*guard);
+    } else {
+      ++*mytex.Lock();
+    }
+  }
+}
+
+template<typename Lockable>
+void
+ReadHeavy(benchmark::State& state)
+{
+  static baudvine::Mytex<int, Lockable> mytex(0);
+  int i = 0;
+  for (auto _ : state) {
+    if (++i % 64 == 0) {
+      ++*mytex.Lock();
+    } else {
+      auto guard = mytex.LockShared();
+      // Long enough for readers to benefit from sharing.
+      for (int spin = 0; spin < 100; ++spin) {
+        benchmark::DoNotOptimize(*guard);
+      }
+    }
+  }
+}
+} // namespace
+
+BENCHMARK(WriteHeavy<PlainMutex>)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(WriteHeavy<std::shared_mutex>)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(WriteHeavy<baudvine::AdaptiveSharedMutex>)
+  ->ThreadRange(1, 4)
+  ->UseRealTime();
+BENCHMARK(ReadHeavy<PlainMutex>)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(ReadHeavy<std::shared_mutex>)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(ReadHeavy<baudvine::AdaptiveSharedMutex>)
+  ->ThreadRange(1, 4)
+  ->UseRealTime();
@@ -0,0 +1,22 @@
+#include <baudvine/asymmetric_shared_mutex.h>
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <shared_mutex>
+
+namespace {
+template<typename Lockable>
+void
+ReadPath(benchmark::State& state)
+{
+  static baudvine::Mytex<int, Lockable> mytex(0);
+  for (auto _ : state) {
+    auto guard = mytex.LockShared();
+    benchmark::DoNotOptimize(*guard);
+  }
+}
+} // namespace
+
+BENCHMARK(ReadPath<std::shared_mutex>)->ThreadRange(1, 4);
+BENCHMARK(ReadPath<baudvine::AsymmetricSharedMutex>)->ThreadRange(1, 4);
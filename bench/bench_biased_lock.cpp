@@ -0,0 +1,44 @@
+#include <baudvine/biased_lock.h>
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+
+namespace {
+template<typename Lockable>
+void
+OwnerPath(benchmark::State& state)
+{
+  // A single thread taking the lock over and over, which is the best case for
+  // BiasedLock and the worst case for anything that needs an atomic RMW.
+  baudvine::Mytex<int, Lockable> mytex(0);
+  for (auto _ : state) {
+    auto guard = mytex.Lock();
+    *guard += 1;
+    benchmark::DoNotOptimize(*guard);
+  }
+}
+
+template<typename Lockable>
+void
+OwnerPathWithMonitor(benchmark::State& state)
+{
+  // Every thread except the first only looks in once per 1000 iterations.
+  static baudvine::Mytex<int, Lockable> mytex(0);
+  const bool owner = state.thread_index() == 0;
+  int iteration = 0;
+  for (auto _ : state) {
+    if (owner || ++iteration % 1000 == 0) {
+      auto guard = mytex.Lock();
+      *guard += 1;
+      benchmark::DoNotOptimize(*guard);
+    }
+  }
+}
+} // namespace
+
+BENCHMARK(OwnerPath<std::mutex>);
+BENCHMARK(OwnerPath<baudvine::BiasedLock>);
+BENCHMARK(OwnerPathWithMonitor<std::mutex>)->Threads(2);
+BENCHMARK(OwnerPathWithMonitor<baudvine::BiasedLock>)->Threads(2);
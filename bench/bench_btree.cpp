@@ -0,0 +1,121 @@
+#include <baudvine/btree.h>
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <map>
+
+namespace {
+constexpr int kKeys = 100000;
+constexpr int kScanLength = 100;
+
+baudvine::Mytex<std::map<int, int>>&
+LockedMap()
+{
+  static baudvine::Mytex<std::map<int, int>> map = [] {
+    std::map<int, int> init;
+    for (int key = 0; key < kKeys; ++key) {
+      init.emplace(key, key);
+    }
+    return init;
+  }();
+  return map;
+}
+
+baudvine::MytexBTree<int, int>&
+Tree()
+{
+  static baudvine::MytexBTree<int, int> tree;
+  static const bool filled = [] {
+    for (int key = 0; key < kKeys; ++key) {
+      tree.Insert(key, key);
+    }
+    return true;
+  }();
+  (void)filled;
+  return tree;
+}
+
+void
+ScanLockedMap(benchmark::State& state)
+{
+  auto& map = LockedMap();
+  int from = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    std::int64_t sum = 0;
+    {
+      auto guard = map.LockShared();
+      for (auto it = guard->lower_bound(from);
+           it != guard->end() && it->first < from + kScanLength;
+           ++it) {
+        sum += it->second;
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+    from = (from + 7919) % kKeys;
+  }
+}
+
+void
+ScanBTree(benchmark::State& state)
+{
+  auto& tree = Tree();
+  int from = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    std::int64_t sum = 0;
+    tree.Scan(from, from + kScanLength, [&sum](int, int value) {
+      sum += value;
+    });
+    benchmark::DoNotOptimize(sum);
+    from = (from + 7919) % kKeys;
+  }
+}
+
+void
+ScanWithWriterLockedMap(benchmark::State& state)
+{
+  // Thread 0 keeps overwriting values while the others scan.
+  auto& map = LockedMap();
+  int key = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    if (state.thread_index() == 0) {
+      (*map.Lock())[key] = key;
+    } else {
+      std::int64_t sum = 0;
+      auto guard = map.LockShared();
+      for (auto it = guard->lower_bound(key);
+           it != guard->end() && it->first < key + kScanLength;
+           ++it) {
+        sum += it->second;
+      }
+      benchmark::DoNotOptimize(sum);
+    }
+    key = (key + 7919) % kKeys;
+  }
+}
+
+void
+ScanWithWriterBTree(benchmark::State& state)
+{
+  auto& tree = Tree();
+  int key = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    if (state.thread_index() == 0) {
+      tree.Insert(key, key);
+    } else {
+      std::int64_t sum = 0;
+      tree.Scan(key, key + kScanLength, [&sum](int, int value) {
+        sum += value;
+      });
+      benchmark::DoNotOptimize(sum);
+    }
+    key = (key + 7919) % kKeys;
+  }
+}
+} // namespace
+
+BENCHMARK(ScanLockedMap)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(ScanBTree)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(ScanWithWriterLockedMap)->Threads(4)->UseRealTime();
+BENCHMARK(ScanWithWriterBTree)->Threads(4)->UseRealTime();
@@ -0,0 +1,93 @@
+#include <baudvine/fiber_mutex.h>
+
+#if defined(__linux__)
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr int kLocksPerWorker = 10;
+constexpr std::size_t kFiberStackSize = 16 * 1024;
+
+// Every worker takes the lock a few times and gives up its carrier while
+// holding it, as if waiting for I/O, so the others pile up behind it. The
+// argument is the number of workers.
+void
+FiberMutex(benchmark::State& state)
+{
+  using Scheduler = baudvine::UcontextScheduler;
+  for (auto _ : state) {
+    baudvine::Mytex<std::uint64_t, baudvine::FiberMutex> mytex(0);
+    for (std::int64_t i = 0; i < state.range(0); ++i) {
+      Scheduler::Spawn(
+        [&mytex] {
+          for (int j = 0; j < kLocksPerWorker; ++j) {
+            auto guard = mytex.Lock();
+            Scheduler::Yield();
+            ++*guard;
+          }
+        },
+        kFiberStackSize);
+    }
+    Scheduler::Run();
+    benchmark::DoNotOptimize(*mytex.TryLock());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          kLocksPerWorker);
+}
+
+void
+ThreadMutex(benchmark::State& state)
+{
+  for (auto _ : state) {
+    baudvine::Mytex<std::uint64_t, std::mutex> mytex(0);
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<std::size_t>(state.range(0)));
+    bool started = true;
+    for (std::int64_t i = 0; i < state.range(0); ++i) {
+      try {
+        threads.emplace_back([&mytex] {
+          for (int j = 0; j < kLocksPerWorker; ++j) {
+            auto guard = mytex.Lock();
+            std::this_thread::yield();
+            ++*guard;
+          }
+        });
+      } catch (const std::system_error&) {
+        // Out of threads (ulimit -u, kernel.threads-max or memory for
+        // stacks): exactly what fibers avoid, but it leaves no result.
+        started = false;
+        break;
+      }
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    if (!started) {
+      state.SkipWithError("Couldn't start that many threads");
+      break;
+    }
+    benchmark::DoNotOptimize(*mytex.Lock());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          kLocksPerWorker);
+}
+} // namespace
+
+BENCHMARK(FiberMutex)
+  ->RangeMultiplier(10)
+  ->Range(100, 10000)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+BENCHMARK(ThreadMutex)
+  ->RangeMultiplier(10)
+  ->Range(100, 10000)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+#endif
@@ -0,0 +1,87 @@
+#include <baudvine/hash_map.h>
+#include <baudvine/mytex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <unordered_map>
+
+namespace {
+constexpr int kKeys = 100000;
+
+baudvine::Mytex<std::unordered_map<int, int>>&
+LockedMap()
+{
+  static baudvine::Mytex<std::unordered_map<int, int>> map = [] {
+    std::unordered_map<int, int> init;
+    for (int key = 0; key < kKeys; ++key) {
+      init.emplace(key, key);
+    }
+    return init;
+  }();
+  return map;
+}
+
+baudvine::MytexHashMap<int, int>&
+HashMap()
+{
+  static baudvine::MytexHashMap<int, int> map;
+  static const bool filled = [] {
+    for (int key = 0; key < kKeys; ++key) {
+      map.Insert(key, key);
+    }
+    return true;
+  }();
+  (void)filled;
+  return map;
+}
+
+void
+MixedLockedMap(benchmark::State& state)
+{
+  // One write for every fifteen reads.
+  auto& map = LockedMap();
+  int key = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    if (key % 16 == 0) {
+      (*map.Lock())[key] += 1;
+    } else {
+      auto guard = map.LockShared();
+      benchmark::DoNotOptimize(guard->find(key)->second);
+    }
+    key = (key + 7919) % kKeys;
+  }
+}
+
+void
+MixedHashMap(benchmark::State& state)
+{
+  auto& map = HashMap();
+  int key = state.thread_index() * 7919 % kKeys;
+  for (auto _ : state) {
+    if (key % 16 == 0) {
+      *map.Lock(key) += 1;
+    } else {
+      benchmark::DoNotOptimize(*map.LockShared(key));
+    }
+    key = (key + 7919) % kKeys;
+  }
+}
+
+template<typename Map>
+void
+Fill(benchmark::State& state)
+{
+  // Growing from empty, which includes every resize.
+  for (auto _ : state) {
+    Map map;
+    for (int key = 0; key < kKeys; ++key) {
+      map.Insert(key, key);
+    }
+    benchmark::DoNotOptimize(map.Size());
+  }
+}
+} // namespace
+
+BENCHMARK(MixedLockedMap)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(MixedHashMap)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(Fill<baudvine::MytexHashMap<int, int>>);
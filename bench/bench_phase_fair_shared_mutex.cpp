@@ -0,0 +1,79 @@
+#include <baudvine/mytex.h>
+#include <baudvine/phase_fair_shared_mutex.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+template<typename Lockable>
+void
+WriterLatencyUnderReaders(benchmark::State& state)
+{
+  using Clock = std::chrono::steady_clock;
+
+  // A crowd of readers that hold the lock for a little while each, so they
+  // keep overlapping. They give up after a while regardless, so a starved
+  // writer shows up as a huge latency instead of a hang.
+  baudvine::Mytex<int, Lockable> mytex(0);
+  std::atomic_bool stop = false;
+  std::atomic<int64_t> started = 0;
+  const auto deadline = Clock::now() + std::chrono::seconds(10);
+  std::vector<std::thread> readers;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    readers.emplace_back([&] {
+      ++started;
+      while (!stop && Clock::now() < deadline) {
+        auto guard = mytex.LockShared();
+        const auto until = Clock::now() + std::chrono::microseconds(50);
+        while (Clock::now() < until) {
+          benchmark::DoNotOptimize(*guard);
+        }
+      }
+    });
+  }
+
+  while (started < state.range(0)) {
+    std::this_thread::yield();
+  }
+
+  Clock::duration worst{};
+  Clock::duration total{};
+  for (auto _ : state) {
+    {
+      const auto start = Clock::now();
+      auto guard = mytex.Lock();
+      const auto waited = Clock::now() - start;
+      *guard += 1;
+      worst = std::max(worst, waited);
+      total += waited;
+    }
+    // Give the readers a chance to pile up again.
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  using Micros = std::chrono::duration<double, std::micro>;
+  state.counters["worst_us"] = Micros(worst).count();
+  state.counters["mean_us"] =
+    Micros(total).count() / static_cast<double>(state.iterations());
+}
+} // namespace
+
+BENCHMARK(WriterLatencyUnderReaders<std::shared_mutex>)
+  ->Arg(8)
+  ->Iterations(200)
+  ->UseRealTime();
+BENCHMARK(WriterLatencyUnderReaders<baudvine::PhaseFairSharedMutex>)
+  ->Arg(8)
+  ->Iterations(200)
+  ->UseRealTime();
@@ -0,0 +1,97 @@
+#include <baudvine/reclamation.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Node
+{
+  std::array<std::uint64_t, 4> payload{};
+};
+
+struct Epoch
+{
+  using Domain = baudvine::EpochDomain;
+
+  static std::uint64_t Read(Domain& domain, const std::atomic<Node*>& current)
+  {
+    const auto guard = domain.Pin();
+    return current.load(std::memory_order_acquire)->payload[0];
+  }
+};
+
+struct Hazard
+{
+  using Domain = baudvine::HazardPointerDomain;
+
+  static std::uint64_t Read(Domain& domain, const std::atomic<Node*>& current)
+  {
+    auto hazard = domain.Acquire();
+    return hazard.Protect(current)->payload[0];
+  }
+};
+
+// Readers keep dereferencing the current node while the benchmark thread
+// replaces it and retires the old one. Reports how many retired nodes were
+// waiting to be freed, as a measure of memory overhead. With a nonzero
+// argument, a background thread reclaims every that many milliseconds;
+// otherwise retiring threads do it once maxGarbage is exceeded.
+template<typename Scheme>
+void
+RetireWhileReading(benchmark::State& state)
+{
+  typename Scheme::Domain domain;
+  if (state.range(0) != 0) {
+    domain.StartBackground(std::chrono::milliseconds(state.range(0)));
+  }
+  std::atomic<Node*> current{ new Node };
+  std::atomic<bool> stop{ false };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; ++i) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        benchmark::DoNotOptimize(Scheme::Read(domain, current));
+      }
+    });
+  }
+
+  std::size_t worst = 0;
+  for (auto _ : state) {
+    domain.Retire(current.exchange(new Node, std::memory_order_acq_rel));
+    worst = std::max(worst, domain.Garbage());
+  }
+
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  domain.Retire(current.exchange(nullptr));
+
+  state.counters["garbage_max"] = static_cast<double>(worst);
+  state.counters["garbage_bytes_max"] =
+    static_cast<double>(worst * sizeof(Node));
+}
+
+template<typename Scheme>
+void
+ReadOnly(benchmark::State& state)
+{
+  static typename Scheme::Domain domain;
+  static std::atomic<Node*> current{ new Node };
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Scheme::Read(domain, current));
+  }
+}
+} // namespace
+
+BENCHMARK(RetireWhileReading<Epoch>)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(RetireWhileReading<Hazard>)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(ReadOnly<Epoch>)->Threads(1)->Threads(4);
+BENCHMARK(ReadOnly<Hazard>)->Threads(1)->Threads(4);
@@ -0,0 +1,373 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "hash_map.h"
+#include "mytex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+/** @brief When AdaptiveShardedMytex splits and merges. */
+struct AdaptiveShardingOptions
+{
+  /** The most shards to split into. */
+  std::size_t maxShards = 64;
+  /** Contention is checked every this many locks of a shard. */
+  std::uint32_t window = 256;
+  /** A window is hot when more than this fraction of its locks waited. */
+  double splitAbove = 0.05;
+  /** A window is cold when less than this fraction of its locks waited. */
+  double mergeBelow = 0.002;
+  /** How many more hot (or cold) windows than the opposite before resizing. */
+  int sustain = 8;
+  /** How many entries to move along with every operation during a resize. */
+  std::size_t migrateBatch = 16;
+};
+
+namespace detail {
+/** @brief A lock that also keeps the object holding the mutex alive. */
+template<typename Lock>
+class PinnedLock
+{
+public:
+  PinnedLock(std::shared_ptr<const void> pin, Lock lock)
+    : mPin(std::move(pin))
+    , mLock(std::move(lock))
+  {
+  }
+
+  [[nodiscard]] bool owns_lock() const noexcept { return mLock.owns_lock(); }
+
+private:
+  // Declared first so the lock is released before the pin.
+  std::shared_ptr<const void> mPin;
+  Lock mLock;
+};
+
+template<typename Container, typename = void>
+struct IsMapLike : std::false_type
+{};
+
+template<typename Container>
+struct IsMapLike<Container, std::void_t<typename Container::mapped_type>>
+  : std::true_type
+{};
+} // namespace detail
+
+/**
+ * @brief A node-based associative container (std::map, std::unordered_set,
+ * ...) that shards itself when it gets contended.
+ *
+ * It starts out as a single guarded container. Every shard counts how often a
+ * lock had to wait, and once enough windows of AdaptiveShardingOptions::window
+ * locks were contended, the number of shards doubles. When contention stays
+ * low for long enough, it halves again.
+ *
+ * Resizing doesn't stop the world. The new shards are published right away and
+ * the old ones are emptied bit by bit: every operation moves a batch of entries
+ * across, and moves the key it's about to touch first, so each key is only
+ * ever in one place.
+ *
+ * Lock() and LockShared() return guards for the shard that holds the key,
+ * which may hold other keys too. Don't lock another key while holding one.
+ */
+template<typename Container,
+         typename Hash = std::hash<typename Container::key_type>>
+class AdaptiveShardedMytex
+{
+  struct Shard;
+  struct Layout;
+
+public:
+  using Key = typename Container::key_type;
+  using ExclusiveLock = detail::PinnedLock<std::unique_lock<std::shared_mutex>>;
+  using SharedLock = detail::PinnedLock<std::shared_lock<std::shared_mutex>>;
+  using Guard = MytexGuard<Container, ExclusiveLock>;
+  using SharedGuard = MytexGuard<const Container, SharedLock>;
+
+  explicit AdaptiveShardedMytex(AdaptiveShardingOptions options = {},
+                                Hash hash = Hash())
+    : mOptions(options)
+    , mHash(std::move(hash))
+    , mLayout(std::make_shared<Layout>(1))
+  {
+  }
+
+  /**
+   * @brief Lock the shard that @p key belongs in, in exclusive mode.
+   *
+   * @returns A MytexGuard referencing the shard's container. Whatever is
+   *          inserted for @p key must go in there.
+   */
+  Guard Lock(const Key& key)
+  {
+    const auto hash = HashOf(key);
+    for (;;) {
+      auto layout = CurrentLayout();
+      Migrate(*layout);
+
+      auto& shard = layout->ShardOf(hash);
+      std::unique_lock<std::shared_mutex> oldLock;
+      Shard* old = nullptr;
+      if (layout->previous) {
+        // Old before new, always, so two threads can't deadlock here.
+        old = layout->previous->ShardOf(hash).get();
+        oldLock = LockCounted<std::unique_lock>(*old);
+      }
+      auto lock = LockCounted<std::unique_lock>(*shard);
+      if (shard->retired || layout != CurrentLayout()) {
+        continue;
+      }
+      if (old != nullptr && !old->retired) {
+        while (auto node = old->container.extract(key)) {
+          shard->container.insert(std::move(node));
+        }
+      }
+      return { &shard->container, ExclusiveLock(shard, std::move(lock)) };
+    }
+  }
+
+  /**
+   * @brief Lock the shard that @p key is in, in shared mode.
+   *
+   * @returns A MytexGuard with a const reference to the shard's container.
+   */
+  SharedGuard LockShared(const Key& key) const
+  {
+    const auto hash = HashOf(key);
+    for (;;) {
+      auto layout = CurrentLayout();
+      if (layout->previous) {
+        // The key may not have been moved yet.
+        const auto& old = layout->previous->ShardOf(hash);
+        auto oldLock = LockCounted<std::shared_lock>(*old);
+        if (!old->retired && old->container.count(key) != 0) {
+          if (layout != CurrentLayout()) {
+            continue;
+          }
+          return { &old->container, SharedLock(old, std::move(oldLock)) };
+        }
+      }
+
+      const auto& shard = layout->ShardOf(hash);
+      auto lock = LockCounted<std::shared_lock>(*shard);
+      if (shard->retired || layout != CurrentLayout()) {
+        continue;
+      }
+      return { &shard->container, SharedLock(shard, std::move(lock)) };
+    }
+  }
+
+  /**
+   * @returns The number of entries. Shards are counted one at a time, so this
+   *          is only exact if nothing is being modified concurrently.
+   */
+  [[nodiscard]] std::size_t Size() const
+  {
+    const auto layout = CurrentLayout();
+    std::size_t size = 0;
+    const auto count = [&size](const Layout& counted) {
+      for (const auto& shard : counted.shards) {
+        std::shared_lock lock(shard->mutex);
+        size += shard->container.size();
+      }
+    };
+    count(*layout);
+    if (layout->previous) {
+      count(*layout->previous);
+    }
+    return size;
+  }
+
+  /** @returns The current number of shards. */
+  [[nodiscard]] std::size_t ShardCount() const
+  {
+    return CurrentLayout()->shards.size();
+  }
+
+private:
+  struct alignas(64) Shard
+  {
+    std::shared_mutex mutex;
+    Container container;
+    // Set once a shard has been emptied by a resize. Nothing goes in after.
+    bool retired = false;
+
+    std::atomic<std::uint32_t> locks{ 0 };
+    std::atomic<std::uint32_t> waits{ 0 };
+  };
+
+  struct Layout
+  {
+    explicit Layout(std::size_t count)
+    {
+      for (std::size_t i = 0; i < count; ++i) {
+        shards.push_back(std::make_shared<Shard>());
+      }
+    }
+
+    const std::shared_ptr<Shard>& ShardOf(std::uint64_t hash) const
+    {
+      return shards[hash % shards.size()];
+    }
+
+    std::vector<std::shared_ptr<Shard>> shards;
+    // The layout being migrated away from, if any.
+    std::shared_ptr<const Layout> previous;
+    // Old shards before this one are retired.
+    std::atomic<std::size_t> migrated{ 0 };
+  };
+
+  std::uint64_t HashOf(const Key& key) const
+  {
+    return detail::MixHash(static_cast<std::uint64_t>(mHash(key)));
+  }
+
+  static const Key& KeyOf(const typename Container::value_type& value)
+  {
+    if constexpr (detail::IsMapLike<Container>::value) {
+      return value.first;
+    } else {
+      return value;
+    }
+  }
+
+  std::shared_ptr<Layout> CurrentLayout() const
+  {
+    return *mLayout.LockShared();
+  }
+
+  /** @brief Lock @p shard, noting whether that meant waiting. */
+  template<template<typename> typename Lock>
+  Lock<std::shared_mutex> LockCounted(Shard& shard) const
+  {
+    Lock<std::shared_mutex> lock(shard.mutex, std::try_to_lock);
+    const bool waited = !lock.owns_lock();
+    if (waited) {
+      lock.lock();
+      shard.waits.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (shard.locks.fetch_add(1, std::memory_order_relaxed) + 1 >=
+        mOptions.window) {
+      EndWindow(shard);
+    }
+    return lock;
+  }
+
+  void EndWindow(Shard& shard) const
+  {
+    const auto locks = shard.locks.exchange(0, std::memory_order_relaxed);
+    const auto waits = shard.waits.exchange(0, std::memory_order_relaxed);
+    if (locks == 0) {
+      return; // Someone else got here first.
+    }
+
+    const double ratio = static_cast<double>(waits) / locks;
+    int pressure = 0;
+    if (ratio > mOptions.splitAbove) {
+      pressure = mPressure.fetch_add(1, std::memory_order_relaxed) + 1;
+    } else if (ratio < mOptions.mergeBelow) {
+      pressure = mPressure.fetch_sub(1, std::memory_order_relaxed) - 1;
+    }
+
+    if (pressure >= mOptions.sustain) {
+      Resize(true);
+    } else if (pressure <= -mOptions.sustain) {
+      Resize(false);
+    }
+  }
+
+  /**
+   * @brief Start a split (or merge) unless a resize is already under way.
+   *
+   * Only swaps the layout, so it's fine to call with a shard locked.
+   */
+  void Resize(bool split) const
+  {
+    auto current = mLayout.Lock();
+    mPressure.store(0, std::memory_order_relaxed);
+    const auto count = (*current)->shards.size();
+    const auto target = split ? std::min(count * 2, mOptions.maxShards)
+                              : std::max<std::size_t>(count / 2, 1);
+    if ((*current)->previous || target == count) {
+      return;
+    }
+    auto next = std::make_shared<Layout>(target);
+    next->previous = *current;
+    *current = std::move(next);
+  }
+
+  /** @brief Move a batch of entries out of the previous layout. */
+  void Migrate(Layout& layout) const
+  {
+    if (!layout.previous) {
+      return;
+    }
+    const auto& old = layout.previous->shards;
+    auto index = layout.migrated.load(std::memory_order_acquire);
+    if (index == old.size()) {
+      FinishMigration(layout);
+      return;
+    }
+
+    // Don't wait: someone else is making progress if it's locked.
+    auto& shard = *old[index];
+    std::unique_lock lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return;
+    }
+    auto& container = shard.container;
+    for (std::size_t i = 0; i < mOptions.migrateBatch && !container.empty();
+         ++i) {
+      auto& target = *layout.ShardOf(HashOf(KeyOf(*container.begin())));
+      std::lock_guard targetLock(target.mutex);
+      target.container.insert(container.extract(container.begin()));
+    }
+    if (container.empty()) {
+      shard.retired = true;
+      layout.migrated.compare_exchange_strong(
+        index, index + 1, std::memory_order_release);
+    }
+  }
+
+  /** @brief Drop the previous layout once all of it has been migrated. */
+  void FinishMigration(const Layout& layout) const
+  {
+    auto current = mLayout.Lock();
+    if (current->get() != &layout) {
+      return;
+    }
+    auto next = std::make_shared<Layout>(0);
+    next->shards = layout.shards;
+    *current = std::move(next);
+  }
+
+  AdaptiveShardingOptions mOptions;
+  Hash mHash;
+  mutable Mytex<std::shared_ptr<Layout>> mLayout;
+  mutable std::atomic<int> mPressure{ 0 };
+};
+} // namespace baudvine
@@ -0,0 +1,441 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "spin_wait.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+
+namespace baudvine {
+/** @brief When AdaptiveSharedMutex switches protocols. */
+struct AdaptiveLockPolicy
+{
+  /** The lock is reconsidered every this many acquisitions. */
+  std::uint32_t window = 4096;
+  /** One in this many acquisitions has its hold time measured. */
+  std::uint32_t sampleEvery = 64;
+  /** Switch to the reader-writer protocol when at least this fraction of
+   * acquisitions is shared... */
+  double sharedAbove = 0.9;
+  /** ...and at least this fraction of acquisitions were readers that had to
+   * wait. */
+  double waitedAbove = 0.01;
+  /** Switch back to the plain mutex when less than this fraction is shared. */
+  double sharedBelow = 0.5;
+  /** Critical sections shorter than this on average gain nothing from
+   * letting readers in together, so they get the plain mutex. */
+  std::chrono::nanoseconds minHold{ 200 };
+};
+
+/**
+ * @brief A SharedLockable that picks between a std::mutex and a
+ * std::shared_mutex depending on how it's used.
+ *
+ * Under the plain protocol a std::mutex admits one thread at a time. Writers
+ * keep it for as long as they hold the lock, which is as cheap as exclusive
+ * locking gets. Readers only pass through it to register in a reader count,
+ * so they still share the lock with each other, and a writer waits for the
+ * count to drain before it goes in. That makes readers pay for the mutex and
+ * queue behind each other on the way in, which a std::shared_mutex avoids.
+ *
+ * This lock counts shared and exclusive acquisitions and how often readers had
+ * to wait, and samples how long the lock is held. Every
+ * AdaptiveLockPolicy::window acquisitions it decides which protocol suits the
+ * load, and the next thread that has the lock to itself makes the switch. When
+ * only readers have been using the reader-writer lock, that's the next reader
+ * to find it free. Nobody ever switches while anyone else holds the lock, and
+ * unlock_shared() never blocks.
+ */
+class AdaptiveSharedMutex
+{
+public:
+  enum class Protocol : std::uint8_t
+  {
+    Mutex,
+    SharedMutex,
+  };
+
+  explicit AdaptiveSharedMutex(AdaptiveLockPolicy policy = {})
+    : mPolicy(policy)
+  {
+  }
+  AdaptiveSharedMutex(const AdaptiveSharedMutex&) = delete;
+  AdaptiveSharedMutex& operator=(const AdaptiveSharedMutex&) = delete;
+  AdaptiveSharedMutex(AdaptiveSharedMutex&&) = delete;
+  AdaptiveSharedMutex& operator=(AdaptiveSharedMutex&&) = delete;
+  ~AdaptiveSharedMutex() = default;
+
+  void lock()
+  {
+    for (;;) {
+      const auto protocol = mProtocol.load(std::memory_order_relaxed);
+      if (protocol == Protocol::Mutex) {
+        mMutex.lock();
+      } else {
+        mSharedMutex.lock();
+      }
+      if (Switched(protocol, false)) {
+        continue;
+      }
+      if (protocol == Protocol::Mutex && ReadersInside()) {
+        // Readers are let in while we wait, so a reader that waits for
+        // another one to get in can't be stuck behind us.
+        mMutex.unlock();
+        WaitForReaders();
+        continue;
+      }
+      Acquired(false, false);
+      if (mWanted != protocol) {
+        Switch(protocol);
+      }
+      return;
+    }
+  }
+
+  bool try_lock()
+  {
+    const auto protocol = mProtocol.load(std::memory_order_relaxed);
+    const bool locked = protocol == Protocol::Mutex ? mMutex.try_lock()
+                                                    : mSharedMutex.try_lock();
+    if (!locked || Switched(protocol, false)) {
+      return false;
+    }
+    if (protocol == Protocol::Mutex && ReadersInside()) {
+      mMutex.unlock();
+      return false;
+    }
+    Acquired(false, false);
+    return true;
+  }
+
+  void unlock()
+  {
+    EndSample();
+    if (mProtocol.load(std::memory_order_relaxed) == Protocol::Mutex) {
+      mMutex.unlock();
+    } else {
+      mSharedMutex.unlock();
+    }
+  }
+
+  void lock_shared()
+  {
+    for (;;) {
+      const auto protocol = mProtocol.load(std::memory_order_relaxed);
+      if (protocol == Protocol::Mutex) {
+        // Only readers' waits are counted: they're what the reader-writer
+        // protocol could save.
+        const bool waited = !mMutex.try_lock();
+        if (waited) {
+          mMutex.lock();
+        }
+        if (Switched(protocol, false)) {
+          continue;
+        }
+        Acquired(true, waited);
+        if (mWanted != protocol && !ReadersInside()) {
+          // We have it to ourselves, so switch and come back in as a reader.
+          Switch(protocol);
+          unlock();
+          continue;
+        }
+        EnterAsReader();
+        return;
+      }
+
+      if (mReconsider.load(std::memory_order_relaxed) &&
+          mSharedMutex.try_lock()) {
+        if (!Switched(protocol, false)) {
+          Reconsider();
+        }
+        continue;
+      }
+      mSharedMutex.lock_shared();
+      if (Switched(protocol, true)) {
+        continue;
+      }
+      AcquiredConcurrently();
+      return;
+    }
+  }
+
+  bool try_lock_shared()
+  {
+    const auto protocol = mProtocol.load(std::memory_order_relaxed);
+    const bool locked = protocol == Protocol::Mutex
+                          ? mMutex.try_lock()
+                          : mSharedMutex.try_lock_shared();
+    if (!locked || Switched(protocol, protocol == Protocol::SharedMutex)) {
+      return false;
+    }
+    if (protocol == Protocol::Mutex) {
+      Acquired(true, false);
+      EnterAsReader();
+    } else {
+      AcquiredConcurrently();
+    }
+    return true;
+  }
+
+  void unlock_shared()
+  {
+    // Nothing switches while we hold the lock, so this is what we locked.
+    EndReaderSample();
+    if (mProtocol.load(std::memory_order_relaxed) == Protocol::Mutex) {
+      mReaders.fetch_sub(1, std::memory_order_release);
+    } else {
+      mSharedMutex.unlock_shared();
+    }
+  }
+
+  /** @returns The protocol currently in use. */
+  [[nodiscard]] Protocol CurrentProtocol() const noexcept
+  {
+    return mProtocol.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Sample
+  {
+    const AdaptiveSharedMutex* lock = nullptr;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  static Sample& LocalSample() noexcept
+  {
+    thread_local Sample sample;
+    return sample;
+  }
+
+  /**
+   * @brief Check that the protocol didn't change while we were waiting, and
+   * back out if it did.
+   *
+   * The protocol only changes while its current lock is held exclusively, and
+   * with no readers inside under the plain protocol. The new value is
+   * published by unlocking that exclusive hold, so reading it with the lock
+   * held gives the final word.
+   */
+  bool Switched(Protocol protocol, bool shared)
+  {
+    if (mProtocol.load(std::memory_order_relaxed) == protocol) {
+      return false;
+    }
+    if (protocol == Protocol::Mutex) {
+      mMutex.unlock();
+    } else if (shared) {
+      mSharedMutex.unlock_shared();
+    } else {
+      mSharedMutex.unlock();
+    }
+    return true;
+  }
+
+  /**
+   * @brief Move our exclusive hold over to the other protocol.
+   *
+   * Nobody else is inside. Anyone who picked up the other lock in the meantime
+   * will see the new protocol and let go again.
+   */
+  void Switch(Protocol from)
+  {
+    if (from == Protocol::Mutex) {
+      mSharedMutex.lock();
+      mProtocol.store(Protocol::SharedMutex, std::memory_order_relaxed);
+      mMutex.unlock();
+    } else {
+      // Only threads about to back out can be holding the mutex. Not blocking
+      // on it keeps the two locks from ever being taken in opposite orders.
+      detail::SpinWait wait;
+      while (!mMutex.try_lock()) {
+        wait();
+      }
+      mProtocol.store(Protocol::Mutex, std::memory_order_relaxed);
+      mSharedMutex.unlock();
+    }
+  }
+
+  /** @returns Whether readers hold the lock under the plain protocol. */
+  bool ReadersInside() const noexcept
+  {
+    return mReaders.load(std::memory_order_acquire) != 0;
+  }
+
+  void WaitForReaders() const noexcept
+  {
+    detail::SpinWait wait;
+    while (ReadersInside()) {
+      wait();
+    }
+  }
+
+  /** @brief Join the readers and let the next thread through the mutex. */
+  void EnterAsReader()
+  {
+    mReaders.fetch_add(1, std::memory_order_relaxed);
+    mMutex.unlock();
+  }
+
+  /**
+   * @brief Bookkeeping for an acquisition that holds mMutex or mSharedMutex
+   * exclusively, so plain counters do.
+   */
+  void Acquired(bool shared, bool waited)
+  {
+    ++mLocks;
+    mSharedLocks += shared ? 1 : 0;
+    mWaits += waited ? 1 : 0;
+    if (--mUntilSample == 0) {
+      mUntilSample = mPolicy.sampleEvery;
+      if (shared) {
+        LocalSample() = { this, std::chrono::steady_clock::now() };
+      } else {
+        mSampleStart = std::chrono::steady_clock::now();
+        mSampling = true;
+      }
+    }
+    if (mLocks + mConcurrentLocks.load(std::memory_order_relaxed) >=
+        mPolicy.window) {
+      Decide();
+    }
+  }
+
+  /** @brief Bookkeeping for readers sharing the reader-writer lock. */
+  void AcquiredConcurrently()
+  {
+    const auto locks =
+      mConcurrentLocks.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (locks % mPolicy.sampleEvery == 0) {
+      LocalSample() = { this, std::chrono::steady_clock::now() };
+    }
+    // Nobody holds the lock exclusively while we share it, so mLocks is
+    // stable. Exactly one reader sees the sum hit the window.
+    if (mLocks + locks == mPolicy.window) {
+      mReconsider.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Run Decide() and maybe switch, for when readers keep sharing the
+   * reader-writer lock and nothing else would. Call holding it exclusively;
+   * this releases it.
+   */
+  void Reconsider()
+  {
+    if (mReconsider.exchange(false, std::memory_order_relaxed)) {
+      Decide();
+      if (mWanted != Protocol::SharedMutex) {
+        Switch(Protocol::SharedMutex);
+      }
+    }
+    unlock();
+  }
+
+  void EndSample()
+  {
+    if (mSampling) {
+      mSampling = false;
+      mHoldNanoseconds += Since(mSampleStart);
+      ++mHoldSamples;
+    }
+  }
+
+  void EndReaderSample()
+  {
+    auto& sample = LocalSample();
+    if (sample.lock != this) {
+      return;
+    }
+    sample.lock = nullptr;
+    mConcurrentHoldNanoseconds.fetch_add(Since(sample.start),
+                                         std::memory_order_relaxed);
+    mConcurrentHoldSamples.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static std::uint64_t Since(std::chrono::steady_clock::time_point start)
+  {
+    return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start)
+        .count());
+  }
+
+  /** @brief Pick the protocol for the next window. Call with mMutex or
+   * mSharedMutex held exclusively. */
+  void Decide()
+  {
+    mReconsider.store(false, std::memory_order_relaxed);
+    const auto concurrent =
+      mConcurrentLocks.exchange(0, std::memory_order_relaxed);
+    const auto total = static_cast<double>(mLocks + concurrent);
+    const double shared =
+      static_cast<double>(mSharedLocks + concurrent) / total;
+    const double waited = static_cast<double>(mWaits) / total;
+    const auto holdNs =
+      mHoldNanoseconds +
+      mConcurrentHoldNanoseconds.exchange(0, std::memory_order_relaxed);
+    const auto samples =
+      mHoldSamples +
+      mConcurrentHoldSamples.exchange(0, std::memory_order_relaxed);
+    mLocks = mSharedLocks = mWaits = mHoldSamples = 0;
+    mHoldNanoseconds = 0;
+
+    // Without samples, assume the hold time is fine.
+    const bool longEnough =
+      samples == 0 ||
+      std::chrono::nanoseconds(holdNs / samples) >= mPolicy.minHold;
+    if (mProtocol.load(std::memory_order_relaxed) == Protocol::Mutex) {
+      mWanted = shared >= mPolicy.sharedAbove &&
+                    waited >= mPolicy.waitedAbove && longEnough
+                  ? Protocol::SharedMutex
+                  : Protocol::Mutex;
+    } else {
+      mWanted = shared < mPolicy.sharedBelow || !longEnough
+                  ? Protocol::Mutex
+                  : Protocol::SharedMutex;
+    }
+  }
+
+  AdaptiveLockPolicy mPolicy;
+  std::mutex mMutex;
+  std::shared_mutex mSharedMutex;
+  std::atomic<Protocol> mProtocol{ Protocol::Mutex };
+
+  // Only touched while mMutex or mSharedMutex is held exclusively.
+  Protocol mWanted = Protocol::Mutex;
+  std::uint64_t mLocks = 0;
+  std::uint64_t mSharedLocks = 0;
+  std::uint64_t mWaits = 0;
+  std::uint32_t mUntilSample = 1;
+  bool mSampling = false;
+  std::chrono::steady_clock::time_point mSampleStart;
+  std::uint64_t mHoldNanoseconds = 0;
+  std::uint64_t mHoldSamples = 0;
+
+  // Readers inside under the plain protocol.
+  std::atomic<std::uint32_t> mReaders{ 0 };
+  // Readers sharing the reader-writer lock count here.
+  std::atomic<std::uint64_t> mConcurrentLocks{ 0 };
+  std::atomic<std::uint64_t> mConcurrentHoldNanoseconds{ 0 };
+  std::atomic<std::uint64_t> mConcurrentHoldSamples{ 0 };
+  // Set when readers alone have completed a window under the reader-writer
+  // protocol.
+  std::atomic<bool> mReconsider{ false };
+};
+} // namespace baudvine
@@ -0,0 +1,135 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "membarrier.h"
+#include "per_thread.h"
+#include "spin_wait.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace baudvine {
+/**
+ * @brief A SharedLockable that moves all of the synchronization cost to the
+ * writer.
+ *
+ * Every thread gets its own reader counter in the lock. lock_shared() bumps
+ * that counter with a plain store, issues a compiler barrier and checks that
+ * no writer is active; there are no atomic read-modify-write operations and no
+ * fences on the read side. lock() in turn announces the writer, runs a
+ * process-wide membarrier(2) so every reader either sees the announcement or
+ * has its counter seen by the writer, and then waits for the counters to
+ * drain.
+ *
+ * That makes @c Mytex<T, AsymmetricSharedMutex>::LockShared() very cheap and
+ * Lock() very expensive (microseconds, more with many threads), which is the
+ * right trade for configuration and routing tables that are read constantly
+ * and updated rarely. Each lock allocates a cache line per reader thread, in
+ * chunks of 64, on first use.
+ *
+ * Where membarrier(2) isn't available readers use a full fence instead.
+ */
+class AsymmetricSharedMutex
+{
+public:
+  AsymmetricSharedMutex() = default;
+  AsymmetricSharedMutex(const AsymmetricSharedMutex&) = delete;
+  AsymmetricSharedMutex& operator=(const AsymmetricSharedMutex&) = delete;
+  AsymmetricSharedMutex(AsymmetricSharedMutex&&) = delete;
+  AsymmetricSharedMutex& operator=(AsymmetricSharedMutex&&) = delete;
+  ~AsymmetricSharedMutex() = default;
+
+  void lock()
+  {
+    mWriterMutex.lock();
+    mWriter.store(true, std::memory_order_relaxed);
+    detail::HeavyBarrier();
+    detail::SpinWait spin;
+    while (ReadersActive()) {
+      spin();
+    }
+  }
+
+  bool try_lock()
+  {
+    if (!mWriterMutex.try_lock()) {
+      return false;
+    }
+    mWriter.store(true, std::memory_order_relaxed);
+    detail::HeavyBarrier();
+    if (ReadersActive()) {
+      unlock();
+      return false;
+    }
+    return true;
+  }
+
+  void unlock()
+  {
+    mWriter.store(false, std::memory_order_release);
+    mWriterMutex.unlock();
+  }
+
+  void lock_shared()
+  {
+    auto& readers = mReaders.Local();
+    while (!TryEnter(readers)) {
+      // Block until the writer is done rather than spinning on mWriter.
+      std::lock_guard wait(mWriterMutex);
+    }
+  }
+
+  bool try_lock_shared() { return TryEnter(mReaders.Local()); }
+
+  void unlock_shared()
+  {
+    auto& readers = mReaders.Local();
+    readers.store(readers.load(std::memory_order_relaxed) - 1,
+                  std::memory_order_release);
+  }
+
+private:
+  using ReaderCount = std::atomic<std::uint32_t>;
+
+  bool TryEnter(ReaderCount& readers)
+  {
+    const auto count = readers.load(std::memory_order_relaxed);
+    readers.store(count + 1, std::memory_order_relaxed);
+    // Pairs with the HeavyBarrier() in lock(): either the writer sees our
+    // count, or we see mWriter.
+    detail::LightBarrier();
+    if (!mWriter.load(std::memory_order_acquire)) {
+      return true;
+    }
+    readers.store(count, std::memory_order_release);
+    return false;
+  }
+
+  bool ReadersActive()
+  {
+    bool active = false;
+    mReaders.ForEach([&active](const ReaderCount& readers) {
+      active = active || readers.load(std::memory_order_acquire) != 0;
+    });
+    return active;
+  }
+
+  std::atomic<bool> mWriter{ false };
+  std::mutex mWriterMutex;
+  detail::PerThread<ReaderCount> mReaders;
+};
+} // namespace baudvine
@@ -0,0 +1,349 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "executor.h"
+#include "mytex.h"
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief A move-only callable taking one argument, stored in place if it fits
+ * in @p Capacity bytes and on the heap otherwise.
+ *
+ * Unlike std::function this is never copied or moved as a whole, so it can
+ * live inside a node that's reused for different callables. Take() moves just
+ * the callable from one InlineCallback into another.
+ */
+template<typename Arg, std::size_t Capacity>
+class InlineCallback
+{
+public:
+  InlineCallback() = default;
+  InlineCallback(const InlineCallback&) = delete;
+  InlineCallback& operator=(const InlineCallback&) = delete;
+  ~InlineCallback() { Reset(); }
+
+  /** @brief Store @p fn. Call when empty. */
+  template<typename Fn>
+  void Emplace(Fn&& fn)
+  {
+    using Stored = std::decay_t<Fn>;
+    if constexpr (sizeof(Stored) <= Capacity &&
+                  alignof(Stored) <= alignof(std::max_align_t)) {
+      new (mStorage) Stored(std::forward<Fn>(fn));
+      mCall = [](void* storage, Arg arg) {
+        (*std::launder(static_cast<Stored*>(storage)))(std::move(arg));
+      };
+      mMove = [](void* from, void* to) {
+        auto* source = std::launder(static_cast<Stored*>(from));
+        new (to) Stored(std::move(*source));
+        source->~Stored();
+      };
+      mDestroy = [](void* storage) {
+        std::launder(static_cast<Stored*>(storage))->~Stored();
+      };
+    } else {
+      new (mStorage) Stored*(new Stored(std::forward<Fn>(fn)));
+      mCall = [](void* storage, Arg arg) {
+        (**std::launder(static_cast<Stored**>(storage)))(std::move(arg));
+      };
+      mMove = [](void* from, void* to) {
+        new (to) Stored*(*std::launder(static_cast<Stored**>(from)));
+      };
+      mDestroy = [](void* storage) {
+        delete *std::launder(static_cast<Stored**>(storage));
+      };
+    }
+  }
+
+  /** @brief Move @p other's callable here, emptying it. Call when empty. */
+  void Take(InlineCallback& other) noexcept
+  {
+    if (other.mDestroy != nullptr) {
+      other.mMove(other.mStorage, mStorage);
+      mCall = std::exchange(other.mCall, nullptr);
+      mMove = std::exchange(other.mMove, nullptr);
+      mDestroy = std::exchange(other.mDestroy, nullptr);
+    }
+  }
+
+  void operator()(Arg arg) { mCall(mStorage, std::move(arg)); }
+
+  /** @brief Destroy the stored callable, if any. */
+  void Reset() noexcept
+  {
+    if (mDestroy != nullptr) {
+      std::exchange(mDestroy, nullptr)(mStorage);
+      mCall = nullptr;
+      mMove = nullptr;
+    }
+  }
+
+private:
+  alignas(std::max_align_t) unsigned char mStorage[Capacity];
+  void (*mCall)(void*, Arg) = nullptr;
+  void (*mMove)(void*, void*) = nullptr;
+  void (*mDestroy)(void*) = nullptr;
+};
+} // namespace detail
+
+/**
+ * @brief A guarded object that's only locked asynchronously, for event-loop
+ * code that mustn't block.
+ *
+ * LockThen() queues a callback, which is later run on the given executor with
+ * an exclusive guard. Callbacks get the lock in the order they were queued,
+ * and the next one is dispatched when the previous guard is released, which
+ * makes this a strand or serial executor for one object. The guard may be
+ * moved out of the callback to release it later, from any thread.
+ *
+ * Queue nodes are recycled, and callbacks that fit in kInlineCallbackSize
+ * bytes are stored in them directly, so a steady stream of LockThen() calls
+ * doesn't allocate. The executor is copied into the node as a std::function,
+ * which doesn't allocate for small executors either. Callbacks must be
+ * nothrow move constructible.
+ *
+ * Executors may run tasks inline. When a guard is released on the thread that
+ * ran its callback, the next callback is run by a loop in that thread's
+ * callback instead of deeper in the stack, so a long queue can't overflow it.
+ *
+ * Guards must be released before the AsyncMytex is destroyed. Callbacks that
+ * are still queued at that point are dropped without running.
+ */
+template<typename T>
+class AsyncMytex
+{
+  class StrandLock;
+
+public:
+  using value_type = T;
+  using Guard = MytexGuard<T, StrandLock>;
+
+  /** @brief Callbacks up to this size are stored without allocating. */
+  static constexpr std::size_t kInlineCallbackSize = 48;
+
+  /**
+   * @brief Construct the guarded object.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit AsyncMytex(Args&&... initialize)
+    : mObject(std::forward<Args>(initialize)...)
+  {
+  }
+  AsyncMytex(const AsyncMytex&) = delete;
+  AsyncMytex& operator=(const AsyncMytex&) = delete;
+  ~AsyncMytex()
+  {
+    for (Node* list : { mHead, mFree }) {
+      while (list != nullptr) {
+        delete std::exchange(list, list->next);
+      }
+    }
+  }
+
+  /**
+   * @brief Run @p callback with a Guard on @p executor, once everyone who
+   * called LockThen() before has released theirs.
+   *
+   * @param callback Takes a Guard by value.
+   * @param executor Runs the callback. Must not be empty.
+   */
+  template<typename Callback>
+  void LockThen(Callback&& callback, Executor executor)
+  {
+    static_assert(
+      std::is_nothrow_move_constructible_v<std::decay_t<Callback>>,
+      "Callbacks are moved out of their queue node before they run");
+    Node* node = nullptr;
+    {
+      std::lock_guard lock(mQueueMutex);
+      node = std::exchange(mFree, mFree != nullptr ? mFree->next : nullptr);
+    }
+    if (node == nullptr) {
+      node = new Node;
+    }
+    node->next = nullptr;
+    node->callback.Emplace(std::forward<Callback>(callback));
+    node->executor = std::move(executor);
+
+    {
+      std::lock_guard lock(mQueueMutex);
+      if (mHeld) {
+        (mTail != nullptr ? mTail->next : mHead) = node;
+        mTail = node;
+        return;
+      }
+      mHeld = true;
+    }
+    Dispatch(node);
+  }
+
+private:
+  struct Node
+  {
+    Node* next = nullptr;
+    detail::InlineCallback<Guard, kInlineCallbackSize> callback;
+    Executor executor;
+  };
+
+  /** @brief Owns the strand, and hands it to the next callback on release. */
+  class StrandLock
+  {
+  public:
+    explicit StrandLock(AsyncMytex* owner)
+      : mOwner(owner)
+    {
+    }
+    StrandLock(StrandLock&& other) noexcept
+      : mOwner(std::exchange(other.mOwner, nullptr))
+    {
+    }
+    StrandLock& operator=(StrandLock&&) = delete;
+    ~StrandLock()
+    {
+      if (mOwner != nullptr) {
+        mOwner->Release();
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mOwner != nullptr; }
+
+  private:
+    AsyncMytex* mOwner;
+  };
+
+  /** @brief Put @p node's callback on its executor. Call holding the strand. */
+  void Dispatch(Node* node)
+  {
+    auto executor = std::move(node->executor);
+    executor([this, node] { Run(node); });
+  }
+
+  /** @brief Run() state for the callbacks of one AsyncMytex on one thread. */
+  struct Trampoline
+  {
+    AsyncMytex* owner;
+    // Set by Release(): the strand's next node, for Run() to dispatch.
+    Node* next = nullptr;
+    // Set while Run() dispatches, so an inline executor's Run() defers to it.
+    bool dispatching = false;
+    // Set by that inline Run(): the node to run next.
+    Node* ready = nullptr;
+  };
+
+  static Trampoline*& CurrentTrampoline()
+  {
+    static thread_local Trampoline* current = nullptr;
+    return current;
+  }
+
+  void Run(Node* node)
+  {
+    Trampoline* current = CurrentTrampoline();
+    if (current != nullptr && current->owner == this && current->dispatching) {
+      current->ready = node;
+      return;
+    }
+
+    class Scope
+    {
+    public:
+      explicit Scope(AsyncMytex* owner)
+        : mTrampoline{ owner }
+        , mOuter(std::exchange(CurrentTrampoline(), &mTrampoline))
+      {
+      }
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+      ~Scope()
+      {
+        CurrentTrampoline() = mOuter;
+        if (mTrampoline.next != nullptr) {
+          // A callback threw after releasing its guard.
+          mTrampoline.owner->Dispatch(mTrampoline.next);
+        }
+      }
+
+      Trampoline mTrampoline;
+
+    private:
+      Trampoline* mOuter;
+    } scope(this);
+    auto& trampoline = scope.mTrampoline;
+
+    while (node != nullptr) {
+      // Recycle the node before the callback runs: once it releases the guard,
+      // this AsyncMytex may be gone.
+      detail::InlineCallback<Guard, kInlineCallbackSize> callback;
+      callback.Take(node->callback);
+      {
+        std::lock_guard lock(mQueueMutex);
+        node->next = std::exchange(mFree, node);
+      }
+      callback(Guard(&mObject, StrandLock(this)));
+
+      node = nullptr;
+      if (trampoline.next != nullptr) {
+        // Released here, so the strand is still ours and so is this.
+        trampoline.dispatching = true;
+        Dispatch(std::exchange(trampoline.next, nullptr));
+        trampoline.dispatching = false;
+        node = std::exchange(trampoline.ready, nullptr);
+      }
+    }
+  }
+
+  void Release()
+  {
+    Node* next = nullptr;
+    {
+      std::lock_guard lock(mQueueMutex);
+      next = mHead;
+      if (next == nullptr) {
+        mHeld = false;
+        return;
+      }
+      mHead = next->next;
+      if (mHead == nullptr) {
+        mTail = nullptr;
+      }
+    }
+    Trampoline* current = CurrentTrampoline();
+    if (current != nullptr && current->owner == this && !current->dispatching) {
+      // Let the Run() below us dispatch it, rather than recursing.
+      current->next = next;
+      return;
+    }
+    Dispatch(next);
+  }
+
+  T mObject;
+  std::mutex mQueueMutex;
+  // Protected by mQueueMutex
+  bool mHeld = false;
+  Node* mHead = nullptr;
+  Node* mTail = nullptr;
+  Node* mFree = nullptr;
+};
+} // namespace baudvine
@@ -0,0 +1,263 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "membarrier.h"
+#include "per_thread.h"
+#include "spin_wait.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief The locks a thread currently holds through a bias fast path.
+ *
+ * Only the owning thread writes to its record; revoking threads read it to
+ * find out whether the bias holder is inside its critical section.
+ */
+struct BiasRecord
+{
+  static constexpr std::size_t kSlots = 4;
+
+  std::atomic<const void*>* Find(const void* lock) noexcept
+  {
+    for (auto& slot : held) {
+      if (slot.load(std::memory_order_relaxed) == lock) {
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+  [[nodiscard]] bool Holds(const void* lock) const noexcept
+  {
+    for (const auto& slot : held) {
+      if (slot.load(std::memory_order_acquire) == lock) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::array<std::atomic<const void*>, kSlots> held{};
+};
+
+inline BiasRecord&
+LocalBiasRecord()
+{
+  // Records outlive the threads that use them, so caching a plain pointer
+  // keeps the TLS access on the fast path free of initialization checks.
+  thread_local BiasRecord* cached = nullptr;
+  if (cached == nullptr) {
+    static PerThread<BiasRecord> records;
+    cached = &records.Local();
+  }
+  return *cached;
+}
+} // namespace detail
+
+/**
+ * @brief A Lockable that's nearly free for the one thread that uses it most.
+ *
+ * The lock is biased towards a single thread, which acquires and releases it
+ * with plain stores and a compiler barrier. Any other thread that wants the
+ * lock first revokes the bias with a membarrier(2)-based handshake, which is
+ * expensive, and then everyone (including the former bias holder) goes through
+ * an ordinary std::mutex.
+ *
+ * Once a single thread has taken the lock @c rebiasAfter times in a row
+ * without anyone else getting in between, the lock is biased towards that
+ * thread again.
+ *
+ * Use it as @c Mytex<T, BiasedLock> for objects that are mostly used by one
+ * thread and occasionally inspected by another. Where membarrier(2) isn't
+ * available the fast path uses a full fence, which is still cheaper than a
+ * read-modify-write but not by as much.
+ */
+class BiasedLock
+{
+public:
+  static constexpr std::uint32_t kDefaultRebiasAfter = 64;
+
+  BiasedLock()
+    : BiasedLock(kDefaultRebiasAfter)
+  {
+  }
+
+  /**
+   * @param rebiasAfter The number of consecutive acquisitions by one thread
+   *                    after which the lock is biased towards that thread.
+   */
+  explicit BiasedLock(std::uint32_t rebiasAfter)
+    : mRebiasAfter(rebiasAfter)
+  {
+  }
+
+  BiasedLock(const BiasedLock&) = delete;
+  BiasedLock& operator=(const BiasedLock&) = delete;
+  BiasedLock(BiasedLock&&) = delete;
+  BiasedLock& operator=(BiasedLock&&) = delete;
+  ~BiasedLock() = default;
+
+  void lock()
+  {
+    auto& self = detail::LocalBiasRecord();
+    if (TryBiased(self)) {
+      return;
+    }
+
+    mFallback.lock();
+    RevokeFrom(self, /*wait=*/true);
+    UpdateBias(self);
+  }
+
+  bool try_lock()
+  {
+    auto& self = detail::LocalBiasRecord();
+    if (TryBiased(self)) {
+      return true;
+    }
+
+    if (!mFallback.try_lock()) {
+      return false;
+    }
+    if (!RevokeFrom(self, /*wait=*/false)) {
+      mFallback.unlock();
+      return false;
+    }
+    UpdateBias(self);
+    return true;
+  }
+
+  void unlock()
+  {
+    if (auto* slot = detail::LocalBiasRecord().Find(this)) {
+      slot->store(nullptr, std::memory_order_release);
+      return;
+    }
+    mFallback.unlock();
+  }
+
+  /** @brief Whether the calling thread currently gets the fast path. */
+  [[nodiscard]] bool IsBiasedToCurrentThread() const
+  {
+    return mOwner.load(std::memory_order_relaxed) ==
+             &detail::LocalBiasRecord() &&
+           !mRevoked.load(std::memory_order_relaxed);
+  }
+
+private:
+  bool TryBiased(detail::BiasRecord& self) noexcept
+  {
+    if (mOwner.load(std::memory_order_relaxed) != &self) {
+      return false;
+    }
+    auto* slot = self.Find(nullptr);
+    if (slot == nullptr) {
+      return false;
+    }
+
+    // This store and the loads below pair with the HeavyBarrier() in
+    // RevokeFrom() and UpdateBias(): either they see our slot, or we see
+    // their write.
+    slot->store(this, std::memory_order_relaxed);
+    detail::LightBarrier();
+    if (!mRevoked.load(std::memory_order_relaxed) &&
+        mOwner.load(std::memory_order_relaxed) == &self) {
+      return true;
+    }
+    slot->store(nullptr, std::memory_order_release);
+    return false;
+  }
+
+  /**
+   * @brief Take the lock away from the bias holder, if there is one.
+   *
+   * Must hold mFallback.
+   *
+   * @returns false if the bias holder is in its critical section and @p wait
+   *          is false.
+   */
+  bool RevokeFrom(detail::BiasRecord& self, bool wait)
+  {
+    auto* owner = mOwner.load(std::memory_order_relaxed);
+    if (owner == nullptr || owner == &self ||
+        mRevoked.load(std::memory_order_relaxed)) {
+      return true;
+    }
+
+    mRevoked.store(true, std::memory_order_relaxed);
+    detail::HeavyBarrier();
+    return WaitForRelease(*owner, wait);
+  }
+
+  /**
+   * @brief Bias the lock towards the caller once it's had the lock to itself
+   * for a while.
+   *
+   * Must hold mFallback.
+   */
+  void UpdateBias(detail::BiasRecord& self)
+  {
+    if (mLastHolder == &self) {
+      ++mStreak;
+    } else {
+      mLastHolder = &self;
+      mStreak = 1;
+    }
+
+    if (mStreak < mRebiasAfter || !mRevoked.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    auto* previous = mOwner.load(std::memory_order_relaxed);
+    if (previous != &self) {
+      // A previous holder may still be running its fast path with a stale
+      // view of mOwner; make sure it sees the new one or has backed off.
+      mOwner.store(&self, std::memory_order_relaxed);
+      detail::HeavyBarrier();
+      if (previous != nullptr) {
+        WaitForRelease(*previous, true);
+      }
+    }
+    mRevoked.store(false, std::memory_order_release);
+  }
+
+  bool WaitForRelease(const detail::BiasRecord& owner, bool wait)
+  {
+    detail::SpinWait spin;
+    while (owner.Holds(this)) {
+      if (!wait) {
+        return false;
+      }
+      spin();
+    }
+    return true;
+  }
+
+  std::atomic<detail::BiasRecord*> mOwner{ nullptr };
+  std::atomic<bool> mRevoked{ true };
+  std::mutex mFallback;
+  const std::uint32_t mRebiasAfter;
+
+  // Protected by mFallback
+  const detail::BiasRecord* mLastHolder = nullptr;
+  std::uint32_t mStreak = 0;
+};
+} // namespace baudvine
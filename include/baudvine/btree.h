@@ -0,0 +1,537 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "spin_wait.h"
+#include "version_lock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+/**
+ * @brief A concurrent ordered map: a B+tree with optimistic lock coupling.
+ *
+ * Every node is a Mytex with a VersionLock. Lookups and scans descend with
+ * Mytex::LockOptimistic(), so readers never write to shared memory. They
+ * validate every node after reading it and start over if a writer got in the
+ * way. Writers descend the same way and only lock the nodes they change, with
+ * Mytex::TryUpgrade(). Full inner nodes are split on the way down, so a split
+ * never has to travel back up the tree.
+ *
+ * Readers may see keys and values while they're being written, which is why
+ * both must be trivially copyable. Node contents are stored in
+ * OptimisticCells, so those reads are relaxed atomic loads rather than data
+ * races. Compare is called on torn values too (the results are discarded), so
+ * it must not have side effects.
+ *
+ * Nodes are never merged or freed before the tree is destroyed: Erase() only
+ * removes an entry from its leaf.
+ *
+ * @tparam Fanout The number of entries in a leaf and of children of an inner
+ *                node.
+ */
+template<typename K,
+         typename V,
+         typename Compare = std::less<K>,
+         std::size_t Fanout = 64>
+class MytexBTree
+{
+  static_assert(std::is_trivially_copyable_v<K> &&
+                  std::is_trivially_copyable_v<V>,
+                "Optimistic readers copy keys and values as they're written");
+  static_assert(Fanout >= 4, "Nodes need room to split");
+
+  struct Node;
+  struct Leaf;
+  struct Inner;
+
+public:
+  MytexBTree()
+    : MytexBTree(Compare())
+  {
+  }
+
+  explicit MytexBTree(Compare compare)
+    : mCompare(std::move(compare))
+    , mRoot(new Leaf)
+  {
+  }
+
+  MytexBTree(const MytexBTree&) = delete;
+  MytexBTree& operator=(const MytexBTree&) = delete;
+  MytexBTree(MytexBTree&&) = delete;
+  MytexBTree& operator=(MytexBTree&&) = delete;
+  ~MytexBTree() { Destroy(mRoot.load(std::memory_order_relaxed)); }
+
+  /** @returns A copy of the value for @p key, if there is one. */
+  std::optional<V> Find(const K& key) const
+  {
+    for (detail::SpinWait spin;; spin()) {
+      const auto path = Descend(key);
+      if (!path) {
+        continue;
+      }
+      const auto& leaf = path->read;
+      const auto pos = LowerBound(*leaf, key);
+      std::optional<V> value;
+      if (pos < Count(*leaf) && Equal(leaf->keys[pos].Load(), key)) {
+        value = leaf->values[pos].Load();
+      }
+      if (leaf.Validate()) {
+        return value;
+      }
+    }
+  }
+
+  /**
+   * @brief Insert @p key, or overwrite its value if it's already there.
+   *
+   * @returns Whether @p key is new.
+   */
+  bool Insert(const K& key, const V& value)
+  {
+    const auto splitInner = [this](auto&&... args) {
+      SplitInner(args...);
+      return true;
+    };
+
+    for (detail::SpinWait spin;; spin()) {
+      auto path = Descend(key, splitInner);
+      if (!path) {
+        continue;
+      }
+      auto leaf = path->leaf->entries.TryUpgrade(path->read);
+      if (!leaf) {
+        continue;
+      }
+
+      const auto pos = LowerBound(*leaf, key);
+      if (pos < leaf->count && Equal(leaf->keys[pos].Load(), key)) {
+        leaf->values[pos] = value;
+        return false;
+      }
+      if (leaf->count < kLeafSlots) {
+        InsertEntry(*leaf, pos, key, value);
+        return true;
+      }
+
+      // The parent has room for another separator, because full inner nodes
+      // are split on the way down.
+      typename InnerMytex::OptionalGuard parent;
+      if (path->parent != nullptr) {
+        parent = path->parent->entries.TryUpgrade(*path->parentRead);
+        if (!parent) {
+          continue;
+        }
+      }
+      SplitLeaf(
+        path->leaf, *leaf, pos, key, value, parent ? &*parent : nullptr);
+      return true;
+    }
+  }
+
+  /** @returns Whether @p key was there. */
+  bool Erase(const K& key)
+  {
+    for (detail::SpinWait spin;; spin()) {
+      const auto path = Descend(key);
+      if (!path) {
+        continue;
+      }
+      const auto pos = LowerBound(*path->read, key);
+      if (pos >= Count(*path->read) ||
+          !Equal(path->read->keys[pos].Load(), key)) {
+        if (path->read.Validate()) {
+          return false;
+        }
+        continue;
+      }
+
+      // Nothing has changed since pos was found if the upgrade succeeds.
+      auto leaf = path->leaf->entries.TryUpgrade(path->read);
+      if (!leaf) {
+        continue;
+      }
+      std::copy(
+        leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+      std::copy(
+        leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+      leaf->count = leaf->count - 1;
+      return true;
+    }
+  }
+
+  /**
+   * @brief Call @p fn(key, value) for every key in [@p from, @p to), in order.
+   *
+   * Leaves are visited one at a time and @p fn only sees validated copies, so
+   * it may take its time and even modify the tree. The scan as a whole is not
+   * a snapshot: every key that's there for the duration of the scan is
+   * visited exactly once, and keys inserted or erased during the scan may or
+   * may not be.
+   */
+  template<typename Fn>
+  void Scan(const K& from, const K& to, Fn&& fn) const
+  {
+    // Keys only ever move to the right (into a new sibling), so once the
+    // first leaf is found the sibling links lead to every later key.
+    const Leaf* leaf = nullptr;
+    for (detail::SpinWait spin; leaf == nullptr; spin()) {
+      if (const auto path = Descend(from)) {
+        leaf = path->leaf;
+      }
+    }
+
+    std::vector<std::pair<K, V>> batch;
+    batch.reserve(kLeafSlots);
+    std::optional<K> last;
+    while (leaf != nullptr) {
+      const Leaf* next = nullptr;
+      bool done = false;
+      for (detail::SpinWait spin;; spin()) {
+        batch.clear();
+        done = false;
+        const auto read = leaf->entries.LockOptimistic();
+        const auto count = Count(*read);
+        for (std::size_t i = 0; i < count; ++i) {
+          const K key = read->keys[i].Load();
+          if (last ? !mCompare(*last, key) : mCompare(key, from)) {
+            continue;
+          }
+          if (!mCompare(key, to)) {
+            done = true;
+            break;
+          }
+          batch.emplace_back(key, read->values[i].Load());
+        }
+        next = read->next.Load();
+        if (read.Validate()) {
+          break;
+        }
+      }
+
+      for (const auto& [key, value] : batch) {
+        fn(key, value);
+      }
+      if (!batch.empty()) {
+        last = batch.back().first;
+      }
+      if (done) {
+        return;
+      }
+      leaf = next;
+    }
+  }
+
+private:
+  static constexpr std::size_t kLeafSlots = Fanout;
+  static constexpr std::size_t kInnerKeys = Fanout - 1;
+
+  // Everything optimistic readers look at is an OptimisticCell.
+  struct LeafEntries
+  {
+    OptimisticCell<std::size_t> count;
+    OptimisticCell<K> keys[kLeafSlots];
+    OptimisticCell<V> values[kLeafSlots];
+    OptimisticCell<Leaf*> next;
+  };
+
+  struct InnerEntries
+  {
+    // The number of keys; there is one more child than that.
+    OptimisticCell<std::size_t> count;
+    OptimisticCell<K> keys[kInnerKeys];
+    OptimisticCell<Node*> children[Fanout];
+  };
+
+  using LeafMytex = Mytex<LeafEntries, VersionLock>;
+  using InnerMytex = Mytex<InnerEntries, VersionLock>;
+  using LeafRead = typename LeafMytex::OptimisticGuard;
+  using InnerRead = typename InnerMytex::OptimisticGuard;
+
+  struct Node
+  {
+    explicit Node(bool leaf)
+      : leaf(leaf)
+    {
+    }
+
+    const bool leaf;
+  };
+
+  struct Leaf : Node
+  {
+    Leaf()
+      : Node(true)
+    {
+    }
+
+    LeafMytex entries;
+  };
+
+  struct Inner : Node
+  {
+    Inner()
+      : Node(false)
+    {
+    }
+
+    InnerMytex entries;
+  };
+
+  /** @brief A leaf, its parent and optimistic reads of both. */
+  struct LeafPath
+  {
+    Inner* parent;
+    std::optional<InnerRead> parentRead;
+    Leaf* leaf;
+    LeafRead read;
+  };
+
+  /** @returns The path to the leaf for @p key, or nothing on a conflict. */
+  std::optional<LeafPath> Descend(const K& key) const
+  {
+    return Descend(key, [](auto&&...) { return false; });
+  }
+
+  /**
+   * @param onFullInner Called with (parent, parent read, node, node read) for
+   *                    every full inner node. Returning true restarts.
+   * @returns The path to the leaf for @p key, or nothing on a conflict.
+   */
+  template<typename OnFullInner>
+  std::optional<LeafPath> Descend(const K& key, OnFullInner&& onFullInner) const
+  {
+    Node* node = mRoot.load(std::memory_order_acquire);
+    Inner* parent = nullptr;
+    std::optional<InnerRead> parentRead;
+    while (!node->leaf) {
+      auto* inner = static_cast<Inner*>(node);
+      const auto read = inner->entries.LockOptimistic();
+      if (!Reachable(node, parentRead)) {
+        return {};
+      }
+      if (read->count >= kInnerKeys &&
+          onFullInner(parent, parentRead, inner, read)) {
+        return {};
+      }
+      Node* child = read->children[ChildIndex(*read, key)].Load();
+      // Never follow a pointer that hasn't been validated.
+      if (!read.Validate()) {
+        return {};
+      }
+      parent = inner;
+      parentRead = read;
+      node = child;
+    }
+
+    auto* leaf = static_cast<Leaf*>(node);
+    const auto read = leaf->entries.LockOptimistic();
+    if (!Reachable(node, parentRead)) {
+      return {};
+    }
+    return LeafPath{ parent, parentRead, leaf, read };
+  }
+
+  /**
+   * @returns Whether @p node was still where the descent found it after its
+   *          version was read.
+   */
+  bool Reachable(const Node* node,
+                 const std::optional<InnerRead>& parentRead) const
+  {
+    return parentRead ? parentRead->Validate()
+                      : node == mRoot.load(std::memory_order_acquire);
+  }
+
+  void SplitInner(Inner* parent,
+                  const std::optional<InnerRead>& parentRead,
+                  Inner* inner,
+                  const InnerRead& read)
+  {
+    typename InnerMytex::OptionalGuard parentEntries;
+    if (parent != nullptr) {
+      parentEntries = parent->entries.TryUpgrade(*parentRead);
+      if (!parentEntries) {
+        return;
+      }
+    }
+    auto entries = inner->entries.TryUpgrade(read);
+    if (!entries) {
+      return;
+    }
+
+    // The middle key moves up, everything after it moves right.
+    auto* right = new Inner;
+    const auto mid = entries->count / 2;
+    const K separator = entries->keys[mid];
+    {
+      auto rightEntries = right->entries.Lock();
+      rightEntries->count = entries->count - mid - 1;
+      std::copy(entries->keys + mid + 1,
+                entries->keys + entries->count,
+                rightEntries->keys);
+      std::copy(entries->children + mid + 1,
+                entries->children + entries->count + 1,
+                rightEntries->children);
+      entries->count = mid;
+    }
+    Publish(parentEntries ? &*parentEntries : nullptr, inner, separator, right);
+  }
+
+  /** @brief Split a full leaf and insert @p key into the right half. */
+  void SplitLeaf(Leaf* leaf,
+                 LeafEntries& entries,
+                 std::size_t pos,
+                 const K& key,
+                 const V& value,
+                 InnerEntries* parent)
+  {
+    auto* right = new Leaf;
+    const auto half = entries.count / 2;
+    K separator;
+    {
+      auto rightEntries = right->entries.Lock();
+      rightEntries->count = entries.count - half;
+      std::copy(entries.keys + half,
+                entries.keys + entries.count,
+                rightEntries->keys);
+      std::copy(entries.values + half,
+                entries.values + entries.count,
+                rightEntries->values);
+      entries.count = half;
+      if (pos <= half) {
+        InsertEntry(entries, pos, key, value);
+      } else {
+        InsertEntry(*rightEntries, pos - half, key, value);
+      }
+      rightEntries->next = entries.next;
+      entries.next = right;
+      separator = rightEntries->keys[0];
+    }
+    Publish(parent, leaf, separator, right);
+  }
+
+  /**
+   * @brief Link a new right sibling into @p parent, or into a new root if
+   * @p left is the root.
+   */
+  void Publish(InnerEntries* parent,
+               Node* left,
+               const K& separator,
+               Node* right)
+  {
+    if (parent != nullptr) {
+      const auto pos = ChildIndex(*parent, separator);
+      std::copy_backward(parent->keys + pos,
+                         parent->keys + parent->count,
+                         parent->keys + parent->count + 1);
+      std::copy_backward(parent->children + pos + 1,
+                         parent->children + parent->count + 1,
+                         parent->children + parent->count + 2);
+      parent->keys[pos] = separator;
+      parent->children[pos + 1] = right;
+      parent->count = parent->count + 1;
+      return;
+    }
+
+    // The old root is locked, so nobody else can be replacing it.
+    auto* root = new Inner;
+    {
+      auto entries = root->entries.Lock();
+      entries->count = 1;
+      entries->keys[0] = separator;
+      entries->children[0] = left;
+      entries->children[1] = right;
+    }
+    mRoot.store(root, std::memory_order_release);
+  }
+
+  static void InsertEntry(LeafEntries& entries,
+                          std::size_t pos,
+                          const K& key,
+                          const V& value)
+  {
+    std::copy_backward(entries.keys + pos,
+                       entries.keys + entries.count,
+                       entries.keys + entries.count + 1);
+    std::copy_backward(entries.values + pos,
+                       entries.values + entries.count,
+                       entries.values + entries.count + 1);
+    entries.keys[pos] = key;
+    entries.values[pos] = value;
+    entries.count = entries.count + 1;
+  }
+
+  /** @returns The entry count, clamped in case it was read mid-write. */
+  static std::size_t Count(const LeafEntries& entries) noexcept
+  {
+    return std::min(entries.count.Load(), kLeafSlots);
+  }
+
+  static std::size_t Count(const InnerEntries& entries) noexcept
+  {
+    return std::min(entries.count.Load(), kInnerKeys);
+  }
+
+  /** @returns The position of the first key not less than @p key. */
+  std::size_t LowerBound(const LeafEntries& entries, const K& key) const
+  {
+    return std::lower_bound(
+             entries.keys, entries.keys + Count(entries), key, mCompare) -
+           entries.keys;
+  }
+
+  /** @returns The index of the child that covers @p key. */
+  std::size_t ChildIndex(const InnerEntries& entries, const K& key) const
+  {
+    return std::upper_bound(
+             entries.keys, entries.keys + Count(entries), key, mCompare) -
+           entries.keys;
+  }
+
+  bool Equal(const K& lhs, const K& rhs) const
+  {
+    return !mCompare(lhs, rhs) && !mCompare(rhs, lhs);
+  }
+
+  static void Destroy(Node* node)
+  {
+    if (node->leaf) {
+      delete static_cast<Leaf*>(node);
+      return;
+    }
+    auto* inner = static_cast<Inner*>(node);
+    {
+      auto entries = inner->entries.Lock();
+      for (std::size_t i = 0; i <= entries->count; ++i) {
+        Destroy(entries->children[i]);
+      }
+    }
+    delete inner;
+  }
+
+  Compare mCompare;
+  std::atomic<Node*> mRoot;
+};
+} // namespace baudvine
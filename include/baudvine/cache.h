@@ -0,0 +1,304 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "hash_map.h"
+#include "mytex.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief A lossy buffer of slot numbers, filled by readers that only hold a
+ * shared lock and emptied by the next exclusive lock holder.
+ *
+ * Recording is a single fetch_add and a store. When the buffer is full, new
+ * records are dropped: they only feed the eviction policy, which doesn't need
+ * to see every access.
+ */
+class ReadBuffer
+{
+public:
+  static constexpr std::size_t kSize = 64;
+
+  /**
+   * @brief Record an access. Call with a shared lock held.
+   *
+   * @returns Whether there's room for more.
+   */
+  bool Record(std::uint32_t slot) noexcept
+  {
+    const auto head = mHead.load(std::memory_order_relaxed);
+    const auto tail = mTail.fetch_add(1, std::memory_order_relaxed);
+    if (tail - head >= kSize) {
+      return false;
+    }
+    mSlots[tail % kSize].store(slot, std::memory_order_relaxed);
+    return tail + 1 - head < kSize;
+  }
+
+  [[nodiscard]] bool Full() const noexcept
+  {
+    return mTail.load(std::memory_order_relaxed) -
+             mHead.load(std::memory_order_relaxed) >=
+           kSize;
+  }
+
+  /**
+   * @brief Pass every recorded slot to @p fn and empty the buffer. Call with
+   * an exclusive lock held, so no reader is halfway through Record().
+   */
+  template<typename Fn>
+  void Drain(Fn&& fn)
+  {
+    const auto head = mHead.load(std::memory_order_relaxed);
+    const auto tail = mTail.load(std::memory_order_relaxed);
+    const auto end = std::min<std::uint64_t>(tail, head + kSize);
+    for (auto i = head; i < end; ++i) {
+      fn(mSlots[i % kSize].load(std::memory_order_relaxed));
+    }
+    mHead.store(tail, std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<std::uint32_t>, kSize> mSlots{};
+  std::atomic<std::uint64_t> mHead{ 0 };
+  std::atomic<std::uint64_t> mTail{ 0 };
+};
+} // namespace detail
+
+/**
+ * @brief A concurrent cache with CLOCK eviction, sharded over Mytexes.
+ *
+ * Every shard holds up to capacity / shards entries, and evicts with the
+ * CLOCK algorithm (second chance): entries that were used since the clock
+ * hand last passed them are skipped once.
+ *
+ * Hits only take the shard's lock in shared mode. Instead of updating the
+ * eviction state under an exclusive lock they record the access in a lossy
+ * read buffer, which is applied in a batch by the next thread to lock the
+ * shard exclusively. When a buffer fills up, the next reader tries to drain it
+ * first, without waiting if the shard is busy.
+ */
+template<typename K,
+         typename V,
+         typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+class MytexCache
+{
+  struct State;
+
+public:
+  using SharedLock = std::shared_lock<std::shared_mutex>;
+  using SharedOptionalGuard = OptionalMytexGuard<const V, SharedLock>;
+
+  static constexpr std::size_t kDefaultShards = 16;
+
+  /**
+   * @param capacity The total number of entries, spread evenly over the
+   *                 shards.
+   * @param shards   The number of shards.
+   */
+  explicit MytexCache(std::size_t capacity,
+                      std::size_t shards = kDefaultShards,
+                      Hash hash = Hash(),
+                      KeyEqual keyEqual = KeyEqual())
+    : mHash(hash)
+    , mShardCount(std::max<std::size_t>(shards, 1))
+    , mShards(std::make_unique<Shard[]>(mShardCount))
+  {
+    const auto perShard =
+      std::max<std::size_t>((capacity + mShardCount - 1) / mShardCount, 1);
+    for (std::size_t i = 0; i < mShardCount; ++i) {
+      mShards[i].state.Lock()->Reset(perShard, hash, keyEqual);
+    }
+  }
+
+  /**
+   * @brief Look up @p key, counting it as a use.
+   *
+   * @returns An OptionalMytexGuard referencing the value if @p key is cached.
+   *          Its shard stays locked in shared mode until the guard goes out of
+   *          scope.
+   */
+  SharedOptionalGuard LockShared(const K& key) const
+  {
+    auto& shard = ShardOf(key);
+    if (shard.reads.Full()) {
+      if (auto state = shard.state.TryLock()) {
+        Drain(shard, *state);
+      }
+    }
+
+    auto state = shard.state.LockShared();
+    const auto it = state->index.find(key);
+    if (it == state->index.end()) {
+      return {};
+    }
+    const auto slot = it->second;
+    shard.reads.Record(slot);
+    return std::move(state).Map([slot](const State& s) -> const V& {
+      return s.entries[slot].item->second;
+    });
+  }
+
+  /** @returns A copy of the value for @p key, if it's cached. */
+  std::optional<V> Find(const K& key) const
+  {
+    if (auto value = LockShared(key)) {
+      return *value;
+    }
+    return {};
+  }
+
+  /** @brief Cache @p value for @p key, evicting another entry if needed. */
+  void Insert(const K& key, V value)
+  {
+    auto& shard = ShardOf(key);
+    auto state = shard.state.Lock();
+    Drain(shard, *state);
+
+    if (const auto it = state->index.find(key); it != state->index.end()) {
+      state->entries[it->second].item->second = std::move(value);
+      return;
+    }
+
+    std::uint32_t slot = 0;
+    if (!state->free.empty()) {
+      slot = state->free.back();
+      state->free.pop_back();
+    } else if (state->entries.size() < state->capacity) {
+      slot = static_cast<std::uint32_t>(state->entries.size());
+      state->entries.emplace_back();
+    } else {
+      slot = Evict(*state);
+    }
+
+    auto& entry = state->entries[slot];
+    entry.item.emplace(key, std::move(value));
+    entry.referenced = false;
+    state->index.emplace(key, slot);
+  }
+
+  /** @returns Whether @p key was cached. */
+  bool Erase(const K& key)
+  {
+    auto& shard = ShardOf(key);
+    auto state = shard.state.Lock();
+    Drain(shard, *state);
+
+    const auto it = state->index.find(key);
+    if (it == state->index.end()) {
+      return false;
+    }
+    state->entries[it->second].item.reset();
+    state->free.push_back(it->second);
+    state->index.erase(it);
+    return true;
+  }
+
+  /** @returns The number of cached entries. */
+  [[nodiscard]] std::size_t Size() const
+  {
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < mShardCount; ++i) {
+      size += mShards[i].state.LockShared()->index.size();
+    }
+    return size;
+  }
+
+private:
+  struct Entry
+  {
+    std::optional<std::pair<K, V>> item;
+    // Set when the entry has been used since the clock hand last passed.
+    bool referenced = false;
+  };
+
+  struct State
+  {
+    void Reset(std::size_t slots, const Hash& hash, const KeyEqual& keyEqual)
+    {
+      capacity = slots;
+      index = decltype(index)(slots, hash, keyEqual);
+      entries.reserve(slots);
+    }
+
+    std::size_t capacity = 0;
+    std::unordered_map<K, std::uint32_t, Hash, KeyEqual> index;
+    std::vector<Entry> entries;
+    std::vector<std::uint32_t> free;
+    std::size_t hand = 0;
+  };
+
+  struct alignas(64) Shard
+  {
+    Mytex<State> state;
+    detail::ReadBuffer reads;
+  };
+
+  Shard& ShardOf(const K& key) const
+  {
+    const auto hash = detail::MixHash(static_cast<std::uint64_t>(mHash(key)));
+    return mShards[hash % mShardCount];
+  }
+
+  static void Drain(Shard& shard, State& state)
+  {
+    shard.reads.Drain([&state](std::uint32_t slot) {
+      // The slot may have been reused since. That only costs some accuracy.
+      if (slot < state.entries.size()) {
+        state.entries[slot].referenced = true;
+      }
+    });
+  }
+
+  /** @returns The slot of an entry that was evicted to make room. */
+  static std::uint32_t Evict(State& state)
+  {
+    for (;; state.hand = (state.hand + 1) % state.entries.size()) {
+      auto& entry = state.entries[state.hand];
+      if (entry.item && entry.referenced) {
+        entry.referenced = false;
+        continue;
+      }
+      const auto slot = static_cast<std::uint32_t>(state.hand);
+      state.hand = (state.hand + 1) % state.entries.size();
+      if (entry.item) {
+        state.index.erase(entry.item->first);
+        entry.item.reset();
+      }
+      return slot;
+    }
+  }
+
+  Hash mHash;
+  std::size_t mShardCount;
+  std::unique_ptr<Shard[]> mShards;
+};
+} // namespace baudvine
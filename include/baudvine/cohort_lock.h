@@ -0,0 +1,160 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "numa.h"
+#include "spin_wait.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace baudvine {
+/**
+ * @brief A NUMA-aware Lockable that keeps the lock on one node for a while.
+ *
+ * This is a lock cohort (C-BO-TKT in the literature): every node has its own
+ * ticket lock, and the holder of a node lock competes for a global
+ * backoff spinlock. When the global holder releases the lock and another
+ * thread on the same node is already queued, it hands over the global lock
+ * along with the node lock, so the protected data stays in that node's caches.
+ * After @c maxLocalHandoffs such handoffs in a row the global lock is released
+ * regardless, giving other nodes a turn.
+ *
+ * Threads are assigned to nodes with CurrentNumaNode(), so
+ * SimulateNumaNodes() can be used to exercise the cohort logic on a
+ * single-node machine.
+ *
+ * Waiters spin (backing off to yielding), so this is meant for short critical
+ * sections.
+ */
+class CohortLock
+{
+public:
+  static constexpr std::uint32_t kDefaultMaxLocalHandoffs = 64;
+
+  /** @brief One cohort per NUMA node, with the default handoff limit. */
+  CohortLock()
+    : CohortLock(NumaNodeCount(), kDefaultMaxLocalHandoffs)
+  {
+  }
+
+  /**
+   * @param nodes            The number of cohorts. Node numbers beyond that
+   *                         wrap around.
+   * @param maxLocalHandoffs How often the lock may be passed within a node
+   *                         before it has to be released globally.
+   */
+  CohortLock(std::size_t nodes, std::uint32_t maxLocalHandoffs)
+    : mNodes(std::max<std::size_t>(nodes, 1))
+    , mCohorts(std::make_unique<Cohort[]>(mNodes))
+    , mMaxLocalHandoffs(maxLocalHandoffs)
+  {
+  }
+
+  CohortLock(const CohortLock&) = delete;
+  CohortLock& operator=(const CohortLock&) = delete;
+  CohortLock(CohortLock&&) = delete;
+  CohortLock& operator=(CohortLock&&) = delete;
+  ~CohortLock() = default;
+
+  void lock()
+  {
+    const std::size_t node = CurrentNumaNode() % mNodes;
+    auto& cohort = mCohorts[node];
+
+    const auto ticket = cohort.next.fetch_add(1, std::memory_order_relaxed);
+    detail::SpinWait spin;
+    while (cohort.serving.load(std::memory_order_acquire) != ticket) {
+      spin();
+    }
+
+    if (!cohort.ownsGlobal) {
+      LockGlobal();
+    }
+    mHolderNode = node;
+  }
+
+  bool try_lock()
+  {
+    const std::size_t node = CurrentNumaNode() % mNodes;
+    auto& cohort = mCohorts[node];
+
+    auto ticket = cohort.serving.load(std::memory_order_acquire);
+    if (!cohort.next.compare_exchange_strong(
+          ticket, ticket + 1, std::memory_order_acquire)) {
+      return false;
+    }
+
+    if (!cohort.ownsGlobal && !TryLockGlobal()) {
+      cohort.serving.store(ticket + 1, std::memory_order_release);
+      return false;
+    }
+    mHolderNode = node;
+    return true;
+  }
+
+  void unlock()
+  {
+    auto& cohort = mCohorts[mHolderNode];
+    const auto serving = cohort.serving.load(std::memory_order_relaxed);
+    const bool localWaiters =
+      cohort.next.load(std::memory_order_relaxed) != serving + 1;
+
+    if (localWaiters && cohort.handoffs < mMaxLocalHandoffs) {
+      ++cohort.handoffs;
+      cohort.ownsGlobal = true;
+    } else {
+      cohort.handoffs = 0;
+      cohort.ownsGlobal = false;
+      mGlobal.store(false, std::memory_order_release);
+    }
+    cohort.serving.store(serving + 1, std::memory_order_release);
+  }
+
+private:
+  struct alignas(64) Cohort
+  {
+    std::atomic<std::uint32_t> next{ 0 };
+    std::atomic<std::uint32_t> serving{ 0 };
+    // Only touched by the holder of this cohort's ticket lock.
+    bool ownsGlobal = false;
+    std::uint32_t handoffs = 0;
+  };
+
+  void LockGlobal()
+  {
+    detail::SpinWait spin;
+    while (!TryLockGlobal()) {
+      spin();
+    }
+  }
+
+  bool TryLockGlobal()
+  {
+    return !mGlobal.load(std::memory_order_relaxed) &&
+           !mGlobal.exchange(true, std::memory_order_acquire);
+  }
+
+  const std::size_t mNodes;
+  const std::unique_ptr<Cohort[]> mCohorts;
+  const std::uint32_t mMaxLocalHandoffs;
+  alignas(64) std::atomic<bool> mGlobal{ false };
+  // Only touched by the holder of the lock.
+  std::size_t mHolderNode = 0;
+};
+} // namespace baudvine
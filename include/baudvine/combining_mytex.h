@@ -0,0 +1,217 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "per_thread.h"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+
+namespace baudvine {
+/**
+ * @brief A Mytex that can be handed work instead of waited for.
+ *
+ * Post() pushes an operation onto a lock-free stack and returns right away if
+ * the lock is taken. Whoever holds it runs the posted operations just before
+ * releasing it, so they're applied by the thread that's already in there.
+ * When nobody holds the lock, Post() takes it and runs the operation itself.
+ * Operations are run one at a time with the lock held exclusively, in no
+ * particular order between threads. Each Post() allocates a node for its
+ * operation.
+ *
+ * Shared holders can't run operations, so the last one to leave passes them to
+ * the next exclusive locker, or runs them itself if there is none. Posted
+ * operations must not throw.
+ *
+ * This relies on try_lock() only failing when the lock is actually held, which
+ * is true for the standard mutexes on common platforms even though the
+ * standard allows spurious failures.
+ */
+template<typename T, typename Lockable = std::shared_mutex>
+class CombiningMytex
+{
+  using InnerGuard = typename Mytex<T, Lockable>::Guard;
+  using InnerSharedGuard = typename Mytex<T, Lockable>::SharedGuard;
+  template<typename Inner>
+  class CombineLock;
+
+public:
+  using value_type = T;
+  using Operation = std::function<void(T&)>;
+  using Guard = MytexGuard<T, CombineLock<InnerGuard>>;
+  using SharedGuard = MytexGuard<const T, CombineLock<InnerSharedGuard>>;
+
+  /**
+   * @brief Construct the guarded object.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit CombiningMytex(Args&&... initialize)
+    : mMytex(std::forward<Args>(initialize)...)
+  {
+  }
+  CombiningMytex(const CombiningMytex&) = delete;
+  CombiningMytex& operator=(const CombiningMytex&) = delete;
+  ~CombiningMytex()
+  {
+    // Normally empty: every Post() and every release runs what's there.
+    Node* node = mPosted.exchange(nullptr, std::memory_order_acquire);
+    while (node != nullptr) {
+      delete std::exchange(node, node->next);
+    }
+  }
+
+  /**
+   * @brief Lock in exclusive mode. Posted operations are run when the guard is
+   * released.
+   *
+   * @returns A MytexGuard referencing the object.
+   */
+  Guard Lock()
+  {
+    auto guard = mMytex.Lock();
+    T* object = &*guard;
+    return { object, CombineLock<InnerGuard>(this, std::move(guard)) };
+  }
+
+  /**
+   * @brief Lock in shared mode.
+   *
+   * @returns A MytexGuard with a const reference to the object.
+   */
+  SharedGuard LockShared()
+  {
+    auto guard = mMytex.LockShared();
+    const T* object = &*guard;
+    return { object,
+             CombineLock<InnerSharedGuard>(this, std::move(guard)) };
+  }
+
+  /**
+   * @brief Apply @p operation to the object with the lock held, either right
+   * now on this thread or when the current holder releases it.
+   *
+   * If the calling thread holds a guard itself, or is running a posted
+   * operation, @p operation only runs once that guard is released or the
+   * running operation returns.
+   */
+  void Post(Operation operation)
+  {
+    auto* node = new Node{ std::move(operation), nullptr };
+    node->next = mPosted.load(std::memory_order_relaxed);
+    while (!mPosted.compare_exchange_weak(node->next,
+                                          node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+    // Trying to lock a mutex we already hold is undefined, and our own release
+    // runs the operation anyway.
+    if (mHeldHere.Local() == 0) {
+      Combine();
+    }
+  }
+
+private:
+  struct Node
+  {
+    Operation operation;
+    Node* next;
+  };
+
+  /** @brief Holds the lock, and runs posted operations around releasing it. */
+  template<typename Inner>
+  class CombineLock
+  {
+  public:
+    CombineLock(CombiningMytex* owner, Inner guard)
+      : mOwner(owner)
+      , mGuard(std::move(guard))
+    {
+      ++mOwner->mHeldHere.Local();
+    }
+    CombineLock(CombineLock&& other) noexcept
+      : mOwner(std::exchange(other.mOwner, nullptr))
+      , mGuard(std::move(other.mGuard))
+    {
+    }
+    CombineLock& operator=(CombineLock&&) = delete;
+    ~CombineLock()
+    {
+      if (mOwner != nullptr) {
+        if constexpr (std::is_same_v<Inner, InnerGuard>) {
+          mOwner->Drain(**mGuard);
+        }
+        mGuard.reset();
+        --mOwner->mHeldHere.Local();
+        mOwner->Combine();
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mGuard.has_value(); }
+
+  private:
+    CombiningMytex* mOwner;
+    std::optional<Inner> mGuard;
+  };
+
+  /** @brief Run posted operations until there are none. Call locked. */
+  void Drain(T& object)
+  {
+    while (Node* newest =
+             mPosted.exchange(nullptr, std::memory_order_acquire)) {
+      while (newest != nullptr) {
+        newest->operation(object);
+        delete std::exchange(newest, newest->next);
+      }
+    }
+  }
+
+  /**
+   * @brief Run posted operations if the lock is free. If it isn't, the holder
+   * will.
+   */
+  void Combine()
+  {
+    for (;;) {
+      // Either a poster sees the lock released, or the releasing thread sees
+      // the post.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (mPosted.load(std::memory_order_relaxed) == nullptr) {
+        return;
+      }
+      auto guard = mMytex.TryLock();
+      if (!guard) {
+        return;
+      }
+      auto& heldHere = mHeldHere.Local();
+      ++heldHere;
+      Drain(*guard);
+      --heldHere;
+    }
+  }
+
+  Mytex<T, Lockable> mMytex;
+  std::atomic<Node*> mPosted{ nullptr };
+  // How many guards each thread holds, including while draining.
+  detail::PerThread<std::size_t> mHeldHere;
+};
+} // namespace baudvine
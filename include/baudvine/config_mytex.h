@@ -0,0 +1,304 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "derived_view.h"
+#include "per_thread.h"
+#include "periodic_thread.h"
+#include "snapshot_mytex.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief Calls a function on a thread of its own whenever a file is written
+ * or replaced.
+ *
+ * On Linux this watches the file's directory with inotify, so editors that
+ * save by renaming a new file over the old one are noticed too. Elsewhere it
+ * checks the modification time every FileWatcher::kPollInterval.
+ */
+class FileWatcher
+{
+public:
+  static constexpr std::chrono::milliseconds kPollInterval{ 500 };
+
+  /**
+   * @throws std::system_error if the watch can't be set up.
+   */
+  FileWatcher(std::filesystem::path path, std::function<void()> onChange)
+  {
+#if defined(__linux__)
+    auto directory = path.parent_path();
+    if (directory.empty()) {
+      directory = ".";
+    }
+    mInotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (mInotify < 0 ||
+        inotify_add_watch(
+          mInotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        pipe2(mStop, O_CLOEXEC) != 0) {
+      const int error = errno;
+      Close();
+      throw std::system_error(error, std::generic_category(), "baudvine");
+    }
+    mThread = std::thread([this,
+                           name = path.filename().string(),
+                           onChange = std::move(onChange)] {
+      Watch(name, onChange);
+    });
+#else
+    const auto initial = LastWriteTime(path);
+    mPoller.Start(kPollInterval,
+                  [path = std::move(path),
+                   onChange = std::move(onChange),
+                   last = initial]() mutable {
+                    const auto now = LastWriteTime(path);
+                    if (now != last) {
+                      last = now;
+                      onChange();
+                    }
+                  });
+#endif
+  }
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+  ~FileWatcher()
+  {
+#if defined(__linux__)
+    // Writing to a pipe nobody else uses can't fail.
+    const char stop = 0;
+    [[maybe_unused]] const auto written = write(mStop[1], &stop, 1);
+    mThread.join();
+    Close();
+#endif
+  }
+
+private:
+#if defined(__linux__)
+  void Watch(const std::string& name, const std::function<void()>& onChange)
+  {
+    alignas(inotify_event) char buffer[4096];
+    for (;;) {
+      pollfd fds[2] = { { mInotify, POLLIN, 0 }, { mStop[0], POLLIN, 0 } };
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      if (fds[1].revents != 0) {
+        return;
+      }
+      // Coalesce everything that's queued into one call.
+      bool changed = false;
+      ssize_t length = 0;
+      while ((length = read(mInotify, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+          const auto* event =
+            reinterpret_cast<const inotify_event*>(buffer + offset);
+          changed |= event->len != 0 && name == event->name;
+          offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+      }
+      if (changed) {
+        onChange();
+      }
+    }
+  }
+
+  void Close()
+  {
+    for (int fd : { mInotify, mStop[0], mStop[1] }) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  int mInotify = -1;
+  int mStop[2] = { -1, -1 };
+  std::thread mThread;
+#else
+  static std::filesystem::file_time_type LastWriteTime(
+    const std::filesystem::path& path)
+  {
+    std::error_code error;
+    return std::filesystem::last_write_time(path, error);
+  }
+
+  PeriodicThread mPoller;
+#endif
+};
+} // namespace detail
+
+/**
+ * @brief A read-mostly object, such as a configuration, that's read all the
+ * time and replaced every now and then.
+ *
+ * Get() returns a reference to a snapshot cached for the calling thread, and
+ * only checks that it's current with a relaxed load of the version. Publish()
+ * replaces the value for every later Get(), and WatchFile() keeps it in sync
+ * with a file, parsing it on a background thread whenever it changes.
+ * LockShared() returns a snapshot that can be held on to regardless of
+ * reloads.
+ */
+template<typename T>
+class ConfigMytex
+{
+public:
+  using value_type = T;
+  using SharedGuard = typename SnapshotMytex<T>::SharedGuard;
+
+  /**
+   * @brief Construct the first value.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit ConfigMytex(Args&&... initialize)
+    : mSnapshots(std::forward<Args>(initialize)...)
+  {
+  }
+  ConfigMytex(const ConfigMytex&) = delete;
+  ConfigMytex& operator=(const ConfigMytex&) = delete;
+  ~ConfigMytex() { StopWatching(); }
+
+  /**
+   * @returns The current value. The reference stays valid until the calling
+   *          thread calls Get() again after a new value was published.
+   */
+  const T& Get() const
+  {
+    auto& cache = mCaches.Local();
+    const auto version = mSnapshots.Version();
+    if (!cache.snapshot || cache.version != version) {
+      // Pairs with the release in Publish(), so the snapshot is at least as
+      // new as the version.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      cache.snapshot.emplace(mSnapshots.LockShared());
+      cache.version = version;
+    }
+    return **cache.snapshot;
+  }
+
+  /** @returns A snapshot of the current value that may be kept. */
+  SharedGuard LockShared() const { return mSnapshots.LockShared(); }
+
+  /** @brief Replace the value. Readers pick it up on their next Get(). */
+  void Publish(T value) { mSnapshots.Publish(std::move(value)); }
+
+  /** @returns How many values have been published, including the first. */
+  [[nodiscard]] std::uint64_t Version() const noexcept
+  {
+    return mSnapshots.Version();
+  }
+
+  /**
+   * @brief Make a view of something computed from the value, which is only
+   * recomputed after a new value was published.
+   *
+   * @returns A DerivedView, which must not outlive this ConfigMytex.
+   */
+  template<typename Fn>
+  DerivedView<ConfigMytex, Fn> Derived(Fn fn) const
+  {
+    return { *this, std::move(fn) };
+  }
+
+  /**
+   * @brief Load @p path with @p parse now, and again whenever it changes.
+   *
+   * Reloads run on a background thread. If @p parse throws during a reload,
+   * the current value stays and the exception is passed to @p onError.
+   * Replaces any earlier watch.
+   *
+   * @param parse Called with the path, returns a T.
+   * @throws Whatever @p parse throws for the initial load, or
+   *         std::system_error if the file can't be watched.
+   */
+  void WatchFile(std::filesystem::path path,
+                 std::function<T(const std::filesystem::path&)> parse,
+                 std::function<void(std::exception_ptr)> onError = {})
+  {
+    StopWatching();
+    // Watch before the initial load, so a write in between isn't missed.
+    // Loads take turns, so whichever reads the file last also publishes last.
+    auto watcher = std::make_unique<detail::FileWatcher>(
+      path, [this, path, parse, onError = std::move(onError)] {
+        std::lock_guard lock(mLoadMutex);
+        try {
+          Publish(parse(path));
+        } catch (...) {
+          if (onError) {
+            onError(std::current_exception());
+          }
+        }
+      });
+    {
+      std::lock_guard lock(mLoadMutex);
+      Publish(parse(path));
+    }
+    std::lock_guard lock(mWatcherMutex);
+    mWatcher = std::move(watcher);
+  }
+
+  /** @brief Stop reloading from the file given to WatchFile(). */
+  void StopWatching()
+  {
+    std::unique_ptr<detail::FileWatcher> watcher;
+    {
+      std::lock_guard lock(mWatcherMutex);
+      watcher = std::move(mWatcher);
+    }
+  }
+
+private:
+  struct Cache
+  {
+    std::uint64_t version = 0;
+    std::optional<SharedGuard> snapshot;
+  };
+
+  SnapshotMytex<T> mSnapshots;
+  mutable detail::PerThread<Cache> mCaches;
+  // Held while a file is parsed and published.
+  std::mutex mLoadMutex;
+  std::mutex mWatcherMutex;
+  // Protected by mWatcherMutex
+  std::unique_ptr<detail::FileWatcher> mWatcher;
+};
+} // namespace baudvine
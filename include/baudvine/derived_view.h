@@ -0,0 +1,144 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "spin_wait.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace baudvine {
+/**
+ * @brief Something computed from a versioned object, recomputed only when the
+ * object has changed.
+ *
+ * Returned by SnapshotMytex::Derived(), ConfigMytex::Derived() and
+ * VersionedMytex::Derived(). Get() compares the source's version with the one
+ * the cached result was computed at. When it's behind, one caller recomputes
+ * it from whatever the source's LockShared() returns, while the others carry
+ * on with the previous result. That's a snapshot that holds no lock for
+ * SnapshotMytex, and a shared guard for VersionedMytex. Only the very first
+ * Get() calls wait for a result.
+ *
+ * @tparam Source Has Version() and LockShared(), like SnapshotMytex. The
+ *         version may only increase, and LockShared() must return a value at
+ *         least as new as a Version() read before it.
+ * @tparam Fn Computes the derived value from a const reference to the source's
+ *            value.
+ */
+template<typename Source, typename Fn>
+class DerivedView
+{
+public:
+  using value_type = std::decay_t<
+    std::invoke_result_t<const Fn&, const typename Source::value_type&>>;
+
+  /** @param source Must outlive the view. */
+  DerivedView(const Source& source, Fn fn)
+    : mSource(&source)
+    , mFn(std::move(fn))
+  {
+  }
+  DerivedView(const DerivedView&) = delete;
+  DerivedView& operator=(const DerivedView&) = delete;
+
+  /**
+   * @returns The derived value for the source's current version, or for an
+   *          earlier one while another thread is computing that.
+   * @throws Whatever the function throws, if this call ran it.
+   */
+  std::shared_ptr<const value_type> Get() const
+  {
+    const auto version = mSource->Version();
+    auto cached = std::atomic_load(&mCached);
+    if (cached && cached->version == version) {
+      return { cached, &cached->value };
+    }
+
+    detail::SpinWait wait;
+    for (;;) {
+      if (!mComputing.exchange(true, std::memory_order_acquire)) {
+        return Compute();
+      }
+      if (cached) {
+        // Stale, but someone is on it.
+        return { cached, &cached->value };
+      }
+      wait();
+      cached = std::atomic_load(&mCached);
+    }
+  }
+
+  /**
+   * @returns The source version the current result was computed at, or 0 if
+   *          there is none yet.
+   */
+  [[nodiscard]] std::uint64_t Version() const
+  {
+    const auto cached = std::atomic_load(&mCached);
+    return cached ? cached->version : 0;
+  }
+
+private:
+  struct Computed
+  {
+    std::uint64_t version;
+    value_type value;
+  };
+
+  /** @brief Compute a fresh result. Call with mComputing set. */
+  std::shared_ptr<const value_type> Compute() const
+  {
+    class Done
+    {
+    public:
+      explicit Done(std::atomic<bool>& computing)
+        : mComputing(computing)
+      {
+      }
+      Done(const Done&) = delete;
+      Done& operator=(const Done&) = delete;
+      ~Done() { mComputing.store(false, std::memory_order_release); }
+
+    private:
+      std::atomic<bool>& mComputing;
+    } done(mComputing);
+
+    // Someone else may have just finished.
+    const auto version = mSource->Version();
+    auto cached = std::atomic_load(&mCached);
+    if (cached && cached->version == version) {
+      return { cached, &cached->value };
+    }
+
+    // The snapshot is at least as new as the version, so the result may be
+    // labeled older than it is. That costs an extra computation at worst.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto snapshot = mSource->LockShared();
+    auto fresh =
+      std::make_shared<const Computed>(Computed{ version, mFn(*snapshot) });
+    std::atomic_store(&mCached, fresh);
+    return { fresh, &fresh->value };
+  }
+
+  const Source* mSource;
+  Fn mFn;
+  mutable std::shared_ptr<const Computed> mCached;
+  mutable std::atomic<bool> mComputing{ false };
+};
+} // namespace baudvine
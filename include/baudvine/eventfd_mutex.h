@@ -0,0 +1,224 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace baudvine {
+/**
+ * @brief A shared mutex that signals a file descriptor when it's released, so
+ * event loops can wait for it with epoll or io_uring alongside their sockets.
+ *
+ * Event-loop code doesn't call lock(). It registers as a waiter, tries the
+ * lock, and if that fails waits for Fd() to become readable before trying
+ * again:
+ *
+ *     baudvine::EventfdMutex mutex;
+ *     baudvine::Mytex<Foo, baudvine::EventfdMutex> mytex(mutex);
+ *     auto waiter = mutex.RegisterWaiter();
+ *     if (auto guard = mytex.TryLock()) { ... }
+ *     // else add mutex.Fd() to the epoll set; when it's readable, call
+ *     // mutex.ClearReadiness() and TryLock() again.
+ *
+ * While any waiters are registered, releasing the mutex makes Fd() readable.
+ * A registered waiter whose TryLock() fails is always woken again later, so no
+ * wakeups are lost as long as it stays registered until it has the lock.
+ *
+ * This is a handle: copies share the same mutex, so keep one to get at Fd()
+ * after moving another into a Mytex. lock() and lock_shared() work too, for
+ * threads that can block; they wait with poll().
+ */
+class EventfdMutex
+{
+  struct State;
+
+public:
+  /** @brief Unregisters a waiter when destroyed. */
+  class WaiterRegistration
+  {
+  public:
+    explicit WaiterRegistration(std::shared_ptr<State> state)
+      : mState(std::move(state))
+    {
+      mState->waiters.fetch_add(1, std::memory_order_relaxed);
+      // Pairs with the fence in Signal(). The TryLock() that follows reads the
+      // word with weaker orderings, which a seq_cst fetch_add alone wouldn't
+      // keep from seeing a stale writer.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    WaiterRegistration(WaiterRegistration&&) noexcept = default;
+    WaiterRegistration& operator=(WaiterRegistration&&) = delete;
+    ~WaiterRegistration()
+    {
+      if (mState) {
+        mState->waiters.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    std::shared_ptr<State> mState;
+  };
+
+  /**
+   * @throws std::system_error if the eventfd can't be created.
+   */
+  EventfdMutex()
+    : mState(std::make_shared<State>())
+  {
+  }
+
+  /** @returns A file descriptor that's readable after a release. */
+  [[nodiscard]] int Fd() const noexcept { return mState->fd; }
+
+  /**
+   * @brief Register as a waiter. Do this before the TryLock() that might fail.
+   *
+   * @returns A registration that should be kept until the lock was acquired
+   *          or the caller gave up.
+   */
+  [[nodiscard]] WaiterRegistration RegisterWaiter() const
+  {
+    return WaiterRegistration(mState);
+  }
+
+  /**
+   * @brief Make Fd() unreadable again until the next release. Call this after
+   * it became readable and before trying to lock. A waiter that clears the
+   * readiness shouldn't give up without trying, or another waiter may miss
+   * the release.
+   */
+  void ClearReadiness() const noexcept
+  {
+    std::uint64_t count = 0;
+    [[maybe_unused]] const auto read = ::read(Fd(), &count, sizeof(count));
+  }
+
+  void lock()
+  {
+    if (try_lock()) {
+      return;
+    }
+    auto waiter = RegisterWaiter();
+    while (!try_lock()) {
+      Wait();
+    }
+  }
+
+  bool try_lock() noexcept
+  {
+    std::int32_t expected = kFree;
+    return mState->word.compare_exchange_strong(
+      expected, kWriter, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
+  void unlock() noexcept
+  {
+    mState->word.store(kFree, std::memory_order_release);
+    Signal();
+  }
+
+  void lock_shared()
+  {
+    if (try_lock_shared()) {
+      return;
+    }
+    auto waiter = RegisterWaiter();
+    while (!try_lock_shared()) {
+      Wait();
+    }
+  }
+
+  bool try_lock_shared() noexcept
+  {
+    auto word = mState->word.load(std::memory_order_relaxed);
+    while (word != kWriter) {
+      if (mState->word.compare_exchange_weak(word,
+                                             word + 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void unlock_shared() noexcept
+  {
+    // Only writers can be waiting for readers, and only for the last one.
+    if (mState->word.fetch_sub(1, std::memory_order_release) == 1) {
+      Signal();
+    }
+  }
+
+private:
+  static constexpr std::int32_t kFree = 0;
+  static constexpr std::int32_t kWriter = -1;
+
+  struct State
+  {
+    State()
+      : fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    {
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "baudvine");
+      }
+    }
+    State(const State&) = delete;
+    State& operator=(const State&) = delete;
+    ~State() { close(fd); }
+
+    const int fd;
+    // kFree, kWriter, or the number of readers.
+    std::atomic<std::int32_t> word{ kFree };
+    std::atomic<std::uint32_t> waiters{ 0 };
+  };
+
+  /** @brief Make Fd() readable if anyone is waiting. Call after releasing. */
+  void Signal() const noexcept
+  {
+    // Either a new waiter's TryLock() sees the release, or this sees the
+    // waiter: the two fences are ordered one way or the other, and whichever
+    // comes second sees the store before the first.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mState->waiters.load(std::memory_order_relaxed) != 0) {
+      const std::uint64_t one = 1;
+      // Only fails if the counter would overflow, which means it's readable.
+      [[maybe_unused]] const auto written = write(Fd(), &one, sizeof(one));
+    }
+  }
+
+  /** @brief Block until Fd() is readable, then clear it. */
+  void Wait() const noexcept
+  {
+    pollfd fd{ Fd(), POLLIN, 0 };
+    while (poll(&fd, 1, -1) < 0 && errno == EINTR) {
+    }
+    ClearReadiness();
+  }
+
+  std::shared_ptr<State> mState;
+};
+} // namespace baudvine
+#endif
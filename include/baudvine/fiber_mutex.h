@@ -0,0 +1,252 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#if defined(__linux__)
+#include <ucontext.h>
+#endif
+
+namespace baudvine {
+/**
+ * @brief A Lockable for code running in user-space fibers. When it's taken,
+ * lock() suspends only the calling fiber rather than the thread it runs on.
+ *
+ * @tparam Scheduler Provides static hooks into the fiber scheduler:
+ *   - `Scheduler::Fiber`, a copyable handle to a fiber.
+ *   - `Scheduler::Current()`, the calling fiber's handle.
+ *   - `Scheduler::Suspend()`, which parks the calling fiber until someone
+ *     calls `Resume()` for it. If `Resume()` was already called since the last
+ *     `Suspend()`, it returns right away, like a thread park permit.
+ *   - `Scheduler::Resume(fiber)`, which makes a suspended fiber runnable
+ *     again. It may be called from any fiber that the scheduler allows, and
+ *     mustn't switch fibers itself: unlock() calls it with a mutex held.
+ *
+ * Waiters queue up in FIFO order, and unlock() hands the lock straight to the
+ * first of them, so a fiber that was resumed never has to compete for it
+ * again. The queue nodes live on the waiting fibers' stacks.
+ */
+template<typename Scheduler>
+class BasicFiberMutex
+{
+public:
+  BasicFiberMutex() = default;
+  BasicFiberMutex(const BasicFiberMutex&) = delete;
+  BasicFiberMutex& operator=(const BasicFiberMutex&) = delete;
+
+  void lock()
+  {
+    Waiter self{ Scheduler::Current() };
+    {
+      std::lock_guard lock(mQueueMutex);
+      if (!mLocked) {
+        mLocked = true;
+        return;
+      }
+      (mTail != nullptr ? mTail->next : mHead) = &self;
+      mTail = &self;
+    }
+    for (;;) {
+      Scheduler::Suspend();
+      // Only seen once unlock() is done resuming us and has let go of self.
+      std::lock_guard lock(mQueueMutex);
+      if (self.granted) {
+        return;
+      }
+    }
+  }
+
+  bool try_lock()
+  {
+    std::lock_guard lock(mQueueMutex);
+    return !std::exchange(mLocked, true);
+  }
+
+  void unlock()
+  {
+    std::lock_guard lock(mQueueMutex);
+    Waiter* waiter = mHead;
+    if (waiter == nullptr) {
+      mLocked = false;
+      return;
+    }
+    mHead = waiter->next;
+    if (mHead == nullptr) {
+      mTail = nullptr;
+    }
+    // The waiter checks for the grant under mQueueMutex, so its fiber can't
+    // leave lock() (and finish) before Resume() is done with it.
+    waiter->granted = true;
+    Scheduler::Resume(waiter->fiber);
+  }
+
+private:
+  struct Waiter
+  {
+    typename Scheduler::Fiber fiber;
+    Waiter* next = nullptr;
+    // Protected by mQueueMutex
+    bool granted = false;
+  };
+
+  std::mutex mQueueMutex;
+  // Protected by mQueueMutex
+  bool mLocked = false;
+  Waiter* mHead = nullptr;
+  Waiter* mTail = nullptr;
+};
+
+#if defined(__linux__)
+namespace detail {
+struct UcontextFiber
+{
+  ucontext_t context{};
+  std::unique_ptr<char[]> stack;
+  std::function<void()> fn;
+  bool suspended = false;
+  bool permit = false;
+};
+
+/** @brief The fibers of one thread. */
+struct UcontextCarrier
+{
+  ucontext_t main{};
+  UcontextFiber* current = nullptr;
+  std::deque<UcontextFiber*> ready;
+};
+
+inline UcontextCarrier&
+CurrentCarrier()
+{
+  thread_local UcontextCarrier carrier;
+  return carrier;
+}
+} // namespace detail
+
+/**
+ * @brief A minimal fiber scheduler on top of ucontext, for BasicFiberMutex.
+ *
+ * Each thread runs its own fibers: Spawn() adds one to the calling thread, and
+ * Run() switches between them until all have finished. Fibers can't move
+ * between threads, and Resume() must be called on the thread that runs the
+ * fiber. swapcontext() also saves the signal mask with a system call, so
+ * production schedulers generally switch stacks some cheaper way.
+ */
+class UcontextScheduler
+{
+public:
+  using Fiber = detail::UcontextFiber*;
+
+  static constexpr std::size_t kDefaultStackSize = 64 * 1024;
+
+  /**
+   * @brief Start a fiber on the calling thread. It first runs during Run().
+   *
+   * @param fn What the fiber runs. Exceptions it throws call std::terminate().
+   */
+  static void Spawn(std::function<void()> fn,
+                    std::size_t stackSize = kDefaultStackSize)
+  {
+    auto fiber = std::make_unique<detail::UcontextFiber>();
+    // Not value-initialized, so untouched stack pages are never committed.
+    fiber->stack.reset(new char[stackSize]);
+    fiber->fn = std::move(fn);
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack.get();
+    fiber->context.uc_stack.ss_size = stackSize;
+    fiber->context.uc_link = &detail::CurrentCarrier().main;
+    makecontext(&fiber->context, &Entry, 0);
+    detail::CurrentCarrier().ready.push_back(fiber.release());
+  }
+
+  /**
+   * @brief Run the calling thread's fibers until they've all finished, or
+   * until all that are left are suspended.
+   */
+  static void Run()
+  {
+    auto& carrier = detail::CurrentCarrier();
+    while (!carrier.ready.empty()) {
+      carrier.current = carrier.ready.front();
+      carrier.ready.pop_front();
+      swapcontext(&carrier.main, &carrier.current->context);
+      if (!carrier.current->fn) {
+        delete carrier.current;
+      }
+      carrier.current = nullptr;
+    }
+  }
+
+  /** @brief Let the calling thread's other ready fibers run. */
+  static void Yield()
+  {
+    auto& carrier = detail::CurrentCarrier();
+    carrier.ready.push_back(carrier.current);
+    SwitchToMain();
+  }
+
+  /** @returns The calling fiber, or nullptr outside of Run(). */
+  static Fiber Current() { return detail::CurrentCarrier().current; }
+
+  static void Suspend()
+  {
+    Fiber self = Current();
+    if (std::exchange(self->permit, false)) {
+      return;
+    }
+    self->suspended = true;
+    SwitchToMain();
+  }
+
+  static void Resume(Fiber fiber)
+  {
+    if (std::exchange(fiber->suspended, false)) {
+      detail::CurrentCarrier().ready.push_back(fiber);
+    } else {
+      fiber->permit = true;
+    }
+  }
+
+private:
+  static void Entry()
+  {
+    auto* fiber = Current();
+    try {
+      fiber->fn();
+    } catch (...) {
+      std::terminate();
+    }
+    // Tells Run() it's finished. Returning resumes uc_link.
+    fiber->fn = nullptr;
+  }
+
+  static void SwitchToMain()
+  {
+    auto& carrier = detail::CurrentCarrier();
+    swapcontext(&carrier.current->context, &carrier.main);
+  }
+};
+
+/** @brief A Lockable that suspends ucontext fibers instead of threads. */
+using FiberMutex = BasicFiberMutex<UcontextScheduler>;
+#endif
+} // namespace baudvine
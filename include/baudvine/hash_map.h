@@ -0,0 +1,567 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BAUDVINE_MYTEX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace baudvine {
+namespace detail {
+/** @returns The index of the lowest set bit in @p mask, which can't be 0. */
+inline std::uint32_t
+LowestBit(std::uint32_t mask) noexcept
+{
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return static_cast<std::uint32_t>(index);
+#else
+  return static_cast<std::uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+/** @brief Spreads the entropy of weak hashes (like std::hash<int>). */
+inline std::uint64_t
+MixHash(std::uint64_t hash) noexcept
+{
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * @brief Sixteen control bytes of an open-addressing table, matched all at
+ * once with SSE2 where that's available.
+ *
+ * A control byte is kEmpty, kDeleted, or (for a full slot) the low seven bits
+ * of the hash of its key.
+ */
+class ControlGroup
+{
+public:
+  static constexpr std::size_t kWidth = 16;
+  static constexpr std::int8_t kEmpty = -128;
+  static constexpr std::int8_t kDeleted = -2;
+
+  explicit ControlGroup(const std::int8_t* control) noexcept
+#if defined(BAUDVINE_MYTEX_SSE2)
+    : mControl(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(control))) // NOLINT
+#else
+    : mControl(control)
+#endif
+  {
+  }
+
+  /** @returns A bit for every slot whose control byte is @p h2. */
+  [[nodiscard]] std::uint32_t Match(std::int8_t h2) const noexcept
+  {
+#if defined(BAUDVINE_MYTEX_SSE2)
+    return static_cast<std::uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(mControl, _mm_set1_epi8(h2))));
+#else
+    return MatchIf([h2](std::int8_t c) { return c == h2; });
+#endif
+  }
+
+  /** @returns A bit for every empty slot. */
+  [[nodiscard]] std::uint32_t MatchEmpty() const noexcept
+  {
+    return Match(kEmpty);
+  }
+
+  /** @returns A bit for every slot that's empty or deleted. */
+  [[nodiscard]] std::uint32_t MatchAvailable() const noexcept
+  {
+#if defined(BAUDVINE_MYTEX_SSE2)
+    // Only kEmpty and kDeleted have the sign bit set.
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(mControl));
+#else
+    return MatchIf([](std::int8_t c) { return c < 0; });
+#endif
+  }
+
+private:
+#if defined(BAUDVINE_MYTEX_SSE2)
+  __m128i mControl;
+#else
+  template<typename Pred>
+  std::uint32_t MatchIf(Pred pred) const noexcept
+  {
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < kWidth; ++i) {
+      if (pred(mControl[i])) {
+        mask |= 1U << i;
+      }
+    }
+    return mask;
+  }
+
+  const std::int8_t* mControl;
+#endif
+};
+} // namespace detail
+
+/**
+ * @brief A concurrent hash map, striped over Mytexes.
+ *
+ * Keys are spread over a fixed number of stripes by the top bits of their
+ * hash, and every stripe is a Mytex around its own open-addressing table.
+ * Slots are found by comparing sixteen control bytes at a time, which uses
+ * SSE2 where available.
+ *
+ * When a stripe's table fills up it is replaced by a bigger one, but the
+ * entries aren't all moved in one go: every exclusive operation on the stripe
+ * moves a few of them until the old table is empty. Lookups check both tables
+ * meanwhile.
+ *
+ * LockShared() and Lock() return guards that keep the stripe locked, so the
+ * value they reference stays put until they go out of scope. Don't look up
+ * another key while holding one: it might be in the same stripe.
+ */
+template<typename K,
+         typename V,
+         typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+class MytexHashMap
+{
+  struct Stripe;
+
+public:
+  using SharedLock = std::shared_lock<std::shared_mutex>;
+  using ExclusiveLock = std::unique_lock<std::shared_mutex>;
+  using OptionalGuard = OptionalMytexGuard<V, ExclusiveLock>;
+  using SharedOptionalGuard = OptionalMytexGuard<const V, SharedLock>;
+
+  static constexpr std::size_t kDefaultStripes = 64;
+
+  /**
+   * @param stripes  The number of stripes, rounded up to a power of two.
+   * @param hash     The hash function.
+   * @param keyEqual The key comparison.
+   */
+  explicit MytexHashMap(std::size_t stripes = kDefaultStripes,
+                        Hash hash = Hash(),
+                        KeyEqual keyEqual = KeyEqual())
+    : mHash(std::move(hash))
+    , mKeyEqual(std::move(keyEqual))
+  {
+    while ((std::size_t{ 1 } << mStripeBits) < stripes) {
+      ++mStripeBits;
+    }
+    mStripes = std::make_unique<Stripe[]>(std::size_t{ 1 } << mStripeBits);
+  }
+
+  /**
+   * @brief Look up @p key in shared mode.
+   *
+   * @returns An OptionalMytexGuard referencing the value if @p key is there.
+   *          Its stripe stays locked in shared mode until the guard goes out of
+   *          scope.
+   */
+  SharedOptionalGuard LockShared(const K& key) const
+  {
+    const auto hash = HashOf(key);
+    auto shard = StripeOf(hash).shard.LockShared();
+    const auto* entry = Find(*shard, key, hash);
+    if (entry == nullptr) {
+      return {};
+    }
+    return std::move(shard).Map(
+      [entry](const Shard&) -> const V& { return entry->second; });
+  }
+
+  /**
+   * @brief Look up @p key in exclusive mode.
+   *
+   * @returns An OptionalMytexGuard referencing the value if @p key is there.
+   *          Its stripe stays locked until the guard goes out of scope.
+   */
+  OptionalGuard Lock(const K& key)
+  {
+    const auto hash = HashOf(key);
+    auto shard = StripeOf(hash).shard.Lock();
+    Migrate(*shard);
+    auto* entry = Find(*shard, key, hash);
+    if (entry == nullptr) {
+      return {};
+    }
+    return std::move(shard).Map(
+      [entry](Shard&) -> V& { return entry->second; });
+  }
+
+  /** @returns A copy of the value for @p key, if there is one. */
+  std::optional<V> Find(const K& key) const
+  {
+    if (auto value = LockShared(key)) {
+      return *value;
+    }
+    return {};
+  }
+
+  [[nodiscard]] bool Contains(const K& key) const
+  {
+    return LockShared(key).has_value();
+  }
+
+  /**
+   * @brief Insert @p key, unless it's already there.
+   *
+   * @returns Whether @p key was inserted.
+   */
+  bool Insert(const K& key, V value)
+  {
+    const auto hash = HashOf(key);
+    auto shard = StripeOf(hash).shard.Lock();
+    Migrate(*shard);
+    if (Find(*shard, key, hash) != nullptr) {
+      return false;
+    }
+    InsertNew(*shard, key, std::move(value), hash);
+    return true;
+  }
+
+  /**
+   * @brief Insert @p key, or overwrite its value if it's already there.
+   *
+   * @returns Whether @p key is new.
+   */
+  bool InsertOrAssign(const K& key, V value)
+  {
+    const auto hash = HashOf(key);
+    auto shard = StripeOf(hash).shard.Lock();
+    Migrate(*shard);
+    if (auto* entry = Find(*shard, key, hash)) {
+      entry->second = std::move(value);
+      return false;
+    }
+    InsertNew(*shard, key, std::move(value), hash);
+    return true;
+  }
+
+  /** @returns Whether @p key was there. */
+  bool Erase(const K& key)
+  {
+    const auto hash = HashOf(key);
+    auto shard = StripeOf(hash).shard.Lock();
+    Migrate(*shard);
+    for (auto* table : { &shard->current, &shard->old }) {
+      if (const auto slot = table->Find(key, hash, mKeyEqual)) {
+        table->EraseAt(*slot);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @returns The number of entries. Stripes are counted one at a time, so
+   *          this is only exact if nothing is being modified concurrently.
+   */
+  [[nodiscard]] std::size_t Size() const
+  {
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < StripeCount(); ++i) {
+      auto shard = mStripes[i].shard.LockShared();
+      size += shard->current.Size() + shard->old.Size();
+    }
+    return size;
+  }
+
+  [[nodiscard]] std::size_t StripeCount() const noexcept
+  {
+    return std::size_t{ 1 } << mStripeBits;
+  }
+
+private:
+  using Entry = std::pair<K, V>;
+  using Group = detail::ControlGroup;
+
+  // The number of old slots moved by every exclusive operation while a
+  // stripe is being resized.
+  static constexpr std::size_t kMigrateBatch = 32;
+
+  /** @brief An open-addressing table of groups of sixteen slots. */
+  class Table
+  {
+  public:
+    Table() = default;
+
+    explicit Table(std::size_t capacity)
+      : mCapacity(capacity)
+      , mControl(std::make_unique<std::int8_t[]>(capacity))
+      , mSlots(std::make_unique<Slot[]>(capacity))
+    {
+      std::fill_n(mControl.get(), capacity, Group::kEmpty);
+    }
+
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+    Table(Table&& other) noexcept { *this = std::move(other); }
+
+    Table& operator=(Table&& other) noexcept
+    {
+      Clear();
+      mCapacity = std::exchange(other.mCapacity, 0);
+      mSize = std::exchange(other.mSize, 0);
+      mUsed = std::exchange(other.mUsed, 0);
+      mControl = std::move(other.mControl);
+      mSlots = std::move(other.mSlots);
+      return *this;
+    }
+
+    ~Table() { Clear(); }
+
+    [[nodiscard]] std::size_t Capacity() const noexcept { return mCapacity; }
+    [[nodiscard]] std::size_t Size() const noexcept { return mSize; }
+
+    /** @returns Whether one more insert would push the load over 7/8. */
+    [[nodiscard]] bool Full() const noexcept
+    {
+      return (mUsed + 1) * 8 > mCapacity * 7;
+    }
+
+    [[nodiscard]] bool IsFull(std::size_t slot) const noexcept
+    {
+      return mControl[slot] >= 0;
+    }
+
+    Entry& At(std::size_t slot) noexcept { return mSlots[slot].entry; }
+    const Entry& At(std::size_t slot) const noexcept
+    {
+      return mSlots[slot].entry;
+    }
+
+    template<typename Eq>
+    std::optional<std::size_t> Find(const K& key,
+                                    std::uint64_t hash,
+                                    const Eq& keyEqual) const
+    {
+      if (mCapacity == 0) {
+        return {};
+      }
+      const auto h2 = H2(hash);
+      for (Probe probe(hash, mCapacity); probe.Valid(); probe.Next()) {
+        const Group group(&mControl[probe.Offset()]);
+        for (auto match = group.Match(h2); match != 0; match &= match - 1) {
+          const auto slot = probe.Offset() + detail::LowestBit(match);
+          if (keyEqual(mSlots[slot].entry.first, key)) {
+            return slot;
+          }
+        }
+        if (group.MatchEmpty() != 0) {
+          return {};
+        }
+      }
+      return {};
+    }
+
+    /** @brief Insert a key that isn't there yet. The table must not be full. */
+    Entry& Insert(Entry&& entry, std::uint64_t hash)
+    {
+      for (Probe probe(hash, mCapacity);; probe.Next()) {
+        const auto available =
+          Group(&mControl[probe.Offset()]).MatchAvailable();
+        if (available == 0) {
+          continue;
+        }
+        const auto slot = probe.Offset() + detail::LowestBit(available);
+        if (mControl[slot] == Group::kEmpty) {
+          ++mUsed;
+        }
+        auto* constructed = new (&mSlots[slot].entry) Entry(std::move(entry));
+        mControl[slot] = H2(hash);
+        ++mSize;
+        return *constructed;
+      }
+    }
+
+    void EraseAt(std::size_t slot)
+    {
+      mSlots[slot].entry.~Entry();
+      // A tombstone, so probes for other keys carry on past it.
+      mControl[slot] = Group::kDeleted;
+      --mSize;
+    }
+
+  private:
+    union Slot
+    {
+      Slot() {} // NOLINT: members are constructed on insertion.
+      ~Slot() {}
+      Entry entry;
+    };
+
+    /** @brief Triangular probing over groups, which visits every group. */
+    class Probe
+    {
+    public:
+      Probe(std::uint64_t hash, std::size_t capacity)
+        : mMask(capacity / Group::kWidth - 1)
+        , mGroup(static_cast<std::size_t>(hash >> 7) & mMask)
+      {
+      }
+
+      [[nodiscard]] bool Valid() const noexcept { return mStep <= mMask; }
+      [[nodiscard]] std::size_t Offset() const noexcept
+      {
+        return mGroup * Group::kWidth;
+      }
+      void Next() noexcept { mGroup = (mGroup + ++mStep) & mMask; }
+
+    private:
+      std::size_t mMask;
+      std::size_t mGroup;
+      std::size_t mStep = 0;
+    };
+
+    static std::int8_t H2(std::uint64_t hash) noexcept
+    {
+      return static_cast<std::int8_t>(hash & 0x7f);
+    }
+
+    void Clear() noexcept
+    {
+      for (std::size_t slot = 0; slot < mCapacity; ++slot) {
+        if (IsFull(slot)) {
+          mSlots[slot].entry.~Entry();
+        }
+      }
+    }
+
+    std::size_t mCapacity = 0;
+    std::size_t mSize = 0;
+    // Full slots and tombstones.
+    std::size_t mUsed = 0;
+    std::unique_ptr<std::int8_t[]> mControl;
+    std::unique_ptr<Slot[]> mSlots;
+  };
+
+  struct Shard
+  {
+    Table current;
+    // The table being moved into current, if a resize is under way.
+    Table old;
+    // How many slots of old have been moved so far.
+    std::size_t migrated = 0;
+  };
+
+  struct alignas(64) Stripe
+  {
+    Mytex<Shard> shard;
+  };
+
+  std::uint64_t HashOf(const K& key) const
+  {
+    return detail::MixHash(static_cast<std::uint64_t>(mHash(key)));
+  }
+
+  Stripe& StripeOf(std::uint64_t hash) const
+  {
+    // The top bits pick the stripe, the bottom ones the slot within it.
+    return mStripes[mStripeBits == 0 ? 0 : hash >> (64 - mStripeBits)];
+  }
+
+  const Entry* Find(const Shard& shard, const K& key, std::uint64_t hash) const
+  {
+    for (const auto* table : { &shard.current, &shard.old }) {
+      if (const auto slot = table->Find(key, hash, mKeyEqual)) {
+        return &table->At(*slot);
+      }
+    }
+    return nullptr;
+  }
+
+  Entry* Find(Shard& shard, const K& key, std::uint64_t hash) const
+  {
+    return const_cast<Entry*>(Find(std::as_const(shard), key, hash));
+  }
+
+  void InsertNew(Shard& shard, const K& key, V&& value, std::uint64_t hash)
+  {
+    if (shard.current.Full()) {
+      Grow(shard);
+    }
+    shard.current.Insert(Entry(key, std::move(value)), hash);
+  }
+
+  /** @brief Start moving current into a new table. */
+  void Grow(Shard& shard)
+  {
+    // The previous resize usually finished long ago, but a burst of inserts
+    // can get here first.
+    Migrate(shard, shard.old.Capacity());
+
+    const auto size = shard.current.Size();
+    auto capacity = std::max(shard.current.Capacity(), 2 * Group::kWidth);
+    // Mostly tombstones: rehash at the same size.
+    if (size * 2 > capacity) {
+      capacity *= 2;
+    }
+    shard.old = std::exchange(shard.current, Table(capacity));
+    shard.migrated = 0;
+    Migrate(shard);
+  }
+
+  /** @brief Move up to @p slots old slots into the current table. */
+  void Migrate(Shard& shard, std::size_t slots = kMigrateBatch)
+  {
+    if (shard.old.Capacity() == 0) {
+      return;
+    }
+    const auto end = std::min(shard.migrated + slots, shard.old.Capacity());
+    for (; shard.migrated < end; ++shard.migrated) {
+      if (!shard.old.IsFull(shard.migrated)) {
+        continue;
+      }
+      auto& entry = shard.old.At(shard.migrated);
+      shard.current.Insert(std::move(entry), HashOf(entry.first));
+      shard.old.EraseAt(shard.migrated);
+    }
+    if (shard.migrated == shard.old.Capacity()) {
+      shard.old = Table();
+      shard.migrated = 0;
+    }
+  }
+
+  Hash mHash;
+  KeyEqual mKeyEqual;
+  std::size_t mStripeBits = 0;
+  std::unique_ptr<Stripe[]> mStripes;
+};
+} // namespace baudvine
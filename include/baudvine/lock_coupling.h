@@ -0,0 +1,193 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+
+#include <cassert>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+
+namespace baudvine {
+/** @brief How LockCouplingCursor locks a node. */
+enum class CouplingMode
+{
+  Shared,
+  Exclusive,
+};
+
+/**
+ * @brief Hand-over-hand traversal of a structure made of Mytex nodes.
+ *
+ * Lists and trees where every node is a Mytex can be traversed without a
+ * global lock by locking the next node before releasing the previous one
+ * (lock coupling, or crabbing). The cursor holds at most two nodes at a time:
+ * the current node and its parent. Descend() locks the child while the
+ * current node is still held, and only then lets go of the old parent.
+ *
+ * A typical writer descends in shared mode and locks only the node it is
+ * going to change in exclusive mode, either by passing
+ * CouplingMode::Exclusive to the last Descend() or with Upgrade().
+ *
+ * This is free of deadlocks as long as every thread locks nodes in the same
+ * (root to leaf) order, and a node is only unlinked by a thread that holds its
+ * parent in exclusive mode.
+ */
+template<typename T, typename Lockable = std::shared_mutex>
+class LockCouplingCursor
+{
+public:
+  using Node = Mytex<T, Lockable>;
+
+  /**
+   * @brief Start a traversal at @p root.
+   *
+   * @param root The first node, which is locked right away.
+   * @param mode How to lock it.
+   */
+  explicit LockCouplingCursor(Node& root,
+                              CouplingMode mode = CouplingMode::Shared)
+  {
+    Acquire(mCurrent, root, mode);
+  }
+
+  /**
+   * @brief Move to @p child.
+   *
+   * The old parent is released first, and the child is locked while the
+   * current node is still held. It then becomes the parent, so no more than
+   * two nodes are ever held.
+   *
+   * @param child A node reachable from the current one.
+   * @param mode  How to lock the child.
+   */
+  void Descend(Node& child, CouplingMode mode = CouplingMode::Shared)
+  {
+    assert(mCurrent.node != nullptr);
+    mParent.Reset();
+    mParent = std::move(mCurrent);
+    Acquire(mCurrent, child, mode);
+  }
+
+  /**
+   * @brief Relock the current node in exclusive mode.
+   *
+   * Lockables can't upgrade in place, so the node is briefly unlocked. Its
+   * parent stays locked meanwhile, so it can't be unlinked, but its contents
+   * may have changed and should be checked again.
+   *
+   * At the root, or after ReleaseParent(), there's no parent to hold, so this
+   * is a plain relock: another writer can get in between, and may even unlink
+   * the node if the structure allows that. Callers that can't cope with that
+   * should start at the root in exclusive mode instead.
+   */
+  void Upgrade()
+  {
+    assert(mCurrent.node != nullptr);
+    if (mCurrent.exclusive) {
+      return;
+    }
+    mCurrent.shared.reset();
+    mCurrent.exclusive.emplace(mCurrent.node->Lock());
+  }
+
+  /** @brief Unlock the parent, keeping only the current node. */
+  void ReleaseParent() { mParent.Reset(); }
+
+  /** @brief Unlock everything. The cursor can't be used afterwards. */
+  void Release()
+  {
+    mParent.Reset();
+    mCurrent.Reset();
+  }
+
+  /** @returns Whether the current node is held in exclusive mode. */
+  [[nodiscard]] bool IsExclusive() const noexcept
+  {
+    return mCurrent.exclusive.has_value();
+  }
+
+  /** @returns The Mytex the cursor is at. */
+  [[nodiscard]] Node& CurrentNode() const noexcept { return *mCurrent.node; }
+
+  /** @returns A reference to the current node's contents. */
+  const T& operator*() const noexcept { return mCurrent.Get(); }
+  const T* operator->() const noexcept { return &**this; }
+
+  /**
+   * @returns A mutable reference to the current node's contents. Only valid
+   *          in exclusive mode.
+   */
+  T& Mutable() noexcept
+  {
+    assert(IsExclusive());
+    return **mCurrent.exclusive;
+  }
+
+  /** @returns The parent's contents, or nullptr if there is no parent. */
+  [[nodiscard]] const T* Parent() const noexcept
+  {
+    return mParent.node != nullptr ? &mParent.Get() : nullptr;
+  }
+
+  /**
+   * @returns The parent's contents, or nullptr if there is no parent. Only
+   *          valid if the parent was locked in exclusive mode.
+   */
+  T* MutableParent() noexcept
+  {
+    if (mParent.node == nullptr) {
+      return nullptr;
+    }
+    assert(mParent.exclusive);
+    return &**mParent.exclusive;
+  }
+
+private:
+  struct Held
+  {
+    Node* node = nullptr;
+    std::optional<typename Node::SharedGuard> shared;
+    std::optional<typename Node::Guard> exclusive;
+
+    [[nodiscard]] const T& Get() const noexcept
+    {
+      return exclusive ? **exclusive : **shared;
+    }
+
+    void Reset() noexcept
+    {
+      shared.reset();
+      exclusive.reset();
+      node = nullptr;
+    }
+  };
+
+  static void Acquire(Held& held, Node& node, CouplingMode mode)
+  {
+    held.Reset();
+    held.node = &node;
+    if (mode == CouplingMode::Exclusive) {
+      held.exclusive.emplace(node.Lock());
+    } else {
+      held.shared.emplace(node.LockShared());
+    }
+  }
+
+  Held mParent;
+  Held mCurrent;
+};
+} // namespace baudvine
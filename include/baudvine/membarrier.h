@@ -0,0 +1,97 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace baudvine::detail {
+#if defined(__linux__)
+inline bool
+RegisterMembarrier() noexcept
+{
+  const long supported = // NOLINT(google-runtime-int)
+    syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+  if (supported < 0 ||
+      (supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0 ||
+      (supported & MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED) == 0) {
+    return false;
+  }
+  return syscall(SYS_membarrier,
+                 MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+                 0,
+                 0) == 0;
+}
+#endif
+
+/**
+ * @brief Whether HeavyBarrier() can use membarrier(2).
+ *
+ * The first call registers the process for private expedited membarriers.
+ * Without that (old kernels, other platforms) both sides of the barrier pair
+ * fall back to ordinary sequentially consistent fences.
+ */
+inline bool
+MembarrierAvailable() noexcept
+{
+#if defined(__linux__)
+  static const bool available = RegisterMembarrier();
+  return available;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief The cheap half of an asymmetric fence pair.
+ *
+ * Only prevents compiler reordering when membarrier(2) is available: the
+ * matching HeavyBarrier() makes every running thread of the process execute a
+ * full fence on its behalf.
+ */
+inline void
+LightBarrier() noexcept
+{
+  if (MembarrierAvailable()) {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  } else {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+/**
+ * @brief The expensive half of an asymmetric fence pair.
+ *
+ * Acts as a full fence on this thread and on every other thread of the
+ * process, so a store-then-load sequence separated by LightBarrier() in one
+ * thread and by HeavyBarrier() in another can't be reordered on both sides.
+ */
+inline void
+HeavyBarrier() noexcept
+{
+#if defined(__linux__)
+  if (MembarrierAvailable()) {
+    syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    return;
+  }
+#endif
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+} // namespace baudvine::detail
@@ -0,0 +1,373 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "per_thread.h"
+#include "spin_wait.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief The clock shared by every MvccMytex, and the timestamps that readers
+ * have pinned.
+ *
+ * Writers draw a stamp from the clock and then publish it in stamp order, so
+ * once Visible() has reached a stamp, every version with that stamp or an
+ * earlier one is in place and a reader at that timestamp sees a fixed state.
+ */
+class MvccClock
+{
+public:
+  static constexpr std::uint64_t kUnpinned =
+    std::numeric_limits<std::uint64_t>::max();
+
+  static MvccClock& Instance()
+  {
+    static MvccClock clock;
+    return clock;
+  }
+
+  /** @returns The newest timestamp whose writes are all published. */
+  [[nodiscard]] std::uint64_t Visible() const noexcept
+  {
+    return mVisible.load(std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Draw a stamp, pass it to @p link to put the new version in place,
+   * and make it visible once every earlier stamp is.
+   */
+  template<typename Fn>
+  void Commit(Fn&& link)
+  {
+    const auto stamp = mNext.fetch_add(1, std::memory_order_relaxed) + 1;
+    link(stamp);
+    SpinWait wait;
+    while (mVisible.load(std::memory_order_acquire) != stamp - 1) {
+      wait();
+    }
+    mVisible.store(stamp, std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Pin the current timestamp for the calling thread. Versions it can
+   * see won't be collected until it's unpinned.
+   *
+   * @returns The pinned timestamp.
+   */
+  std::uint64_t Pin()
+  {
+    auto& slot = mReaders.Local();
+    if (slot.depth++ != 0) {
+      // An older timestamp is pinned already, which protects newer ones too.
+      return Visible();
+    }
+    for (;;) {
+      const auto now = Visible();
+      slot.pinned.store(now, std::memory_order_seq_cst);
+      // A collector that read Visible() before our store can't have seen a
+      // newer value than this.
+      if (Visible() == now) {
+        return now;
+      }
+    }
+  }
+
+  /** @brief Undo one Pin() by the calling thread. */
+  void Unpin()
+  {
+    auto& slot = mReaders.Local();
+    if (--slot.depth == 0) {
+      slot.pinned.store(kUnpinned, std::memory_order_release);
+    }
+  }
+
+  /** @returns The oldest timestamp any reader may still be reading at. */
+  std::uint64_t OldestPinned()
+  {
+    auto oldest = Visible();
+    mReaders.ForEach([&oldest](const Reader& reader) {
+      oldest =
+        std::min(oldest, reader.pinned.load(std::memory_order_seq_cst));
+    });
+    return oldest;
+  }
+
+private:
+  MvccClock() = default;
+
+  struct Reader
+  {
+    std::atomic<std::uint64_t> pinned{ kUnpinned };
+    // Only touched by the owning thread.
+    std::uint32_t depth = 0;
+  };
+
+  std::atomic<std::uint64_t> mNext{ 0 };
+  std::atomic<std::uint64_t> mVisible{ 0 };
+  PerThread<Reader> mReaders;
+};
+} // namespace detail
+
+/**
+ * @brief A pinned point in time to read MvccMytexes at.
+ *
+ * Every MvccMytex read at the same snapshot reflects the same moment, and the
+ * versions it sees stay alive until the snapshot is destroyed. Like a lock, a
+ * snapshot must be released by the thread that took it.
+ */
+class MvccSnapshot
+{
+public:
+  MvccSnapshot()
+    : mTimestamp(detail::MvccClock::Instance().Pin())
+    , mPinned(true)
+  {
+  }
+  MvccSnapshot(const MvccSnapshot&) = delete;
+  MvccSnapshot& operator=(const MvccSnapshot&) = delete;
+  MvccSnapshot(MvccSnapshot&& other) noexcept
+    : mTimestamp(other.mTimestamp)
+    , mPinned(std::exchange(other.mPinned, false))
+  {
+  }
+  MvccSnapshot& operator=(MvccSnapshot&& other) noexcept
+  {
+    if (this != &other) {
+      Release();
+      mTimestamp = other.mTimestamp;
+      mPinned = std::exchange(other.mPinned, false);
+    }
+    return *this;
+  }
+  ~MvccSnapshot() { Release(); }
+
+  /** @returns The timestamp this snapshot reads at. */
+  [[nodiscard]] std::uint64_t Timestamp() const noexcept { return mTimestamp; }
+
+  /** @returns Whether this snapshot is still pinned, for MytexGuard. */
+  [[nodiscard]] bool owns_lock() const noexcept { return mPinned; }
+
+private:
+  void Release()
+  {
+    if (mPinned) {
+      detail::MvccClock::Instance().Unpin();
+      mPinned = false;
+    }
+  }
+
+  std::uint64_t mTimestamp;
+  bool mPinned;
+};
+
+/**
+ * @brief A guarded object with multi-version concurrency control.
+ *
+ * Writers never modify the object in place. Lock() hands out a private copy of
+ * the newest version, which is stamped with the global clock and published
+ * when the guard is released. Readers pin a timestamp (an MvccSnapshot) and
+ * read the newest version at or before it, without taking a lock or waiting
+ * for writers. Since the clock is shared, reads of several MvccMytexes at one
+ * snapshot are consistent with each other.
+ *
+ * Old versions are collected once no pinned timestamp can see them anymore.
+ * Writers do that every few commits; Collect() does it on demand, for
+ * instance from a maintenance thread.
+ */
+template<typename T>
+class MvccMytex
+{
+  struct Version;
+  class WriteLock;
+
+public:
+  using value_type = T;
+  using Guard = MytexGuard<T, WriteLock>;
+  using SharedGuard = MytexGuard<const T, MvccSnapshot>;
+
+  /** @brief How many commits go by between automatic collections. */
+  static constexpr std::uint32_t kCollectEvery = 8;
+
+  /**
+   * @brief Construct the first version. It's visible at every timestamp.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit MvccMytex(Args&&... initialize)
+    : mHead(new Version(0, nullptr, std::forward<Args>(initialize)...))
+  {
+  }
+  MvccMytex(const MvccMytex&) = delete;
+  MvccMytex& operator=(const MvccMytex&) = delete;
+  ~MvccMytex()
+  {
+    Free(mHead.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief Start a write. Other writers wait; readers don't.
+   *
+   * @returns A MytexGuard referencing a copy of the newest version. The copy
+   *          becomes the newest version when the guard is released.
+   */
+  Guard Lock()
+  {
+    std::unique_lock lock(mWriteMutex);
+    auto* newest = mHead.load(std::memory_order_relaxed);
+    auto draft = std::make_unique<Version>(0, newest, newest->value);
+    T* object = &draft->value;
+    return { object, WriteLock(this, std::move(lock), std::move(draft)) };
+  }
+
+  /**
+   * @brief Read the newest version. Never blocks.
+   *
+   * @returns A MytexGuard that keeps the version alive while it exists.
+   */
+  SharedGuard LockShared() const
+  {
+    MvccSnapshot snapshot;
+    const T* object = &ReadAt(snapshot);
+    return { object, std::move(snapshot) };
+  }
+
+  /**
+   * @returns The newest version at or before @p snapshot. The reference is
+   *          valid as long as the snapshot is.
+   */
+  const T& ReadAt(const MvccSnapshot& snapshot) const
+  {
+    const auto* version = mHead.load(std::memory_order_acquire);
+    while (version->stamp > snapshot.Timestamp()) {
+      version = version->older.load(std::memory_order_acquire);
+    }
+    return version->value;
+  }
+
+  /** @brief Free every version that no pinned timestamp can see. */
+  void Collect()
+  {
+    std::lock_guard lock(mWriteMutex);
+    CollectLocked();
+  }
+
+  /** @returns The number of versions currently kept. */
+  [[nodiscard]] std::size_t VersionCount() const
+  {
+    std::lock_guard lock(mWriteMutex);
+    std::size_t count = 0;
+    for (const auto* version = mHead.load(std::memory_order_relaxed);
+         version != nullptr;
+         version = version->older.load(std::memory_order_relaxed)) {
+      ++count;
+    }
+    return count;
+  }
+
+private:
+  struct Version
+  {
+    template<typename... Args>
+    Version(std::uint64_t stamp, Version* older, Args&&... initialize)
+      : value(std::forward<Args>(initialize)...)
+      , stamp(stamp)
+      , older(older)
+    {
+    }
+
+    T value;
+    std::uint64_t stamp;
+    std::atomic<Version*> older;
+  };
+
+  /** @brief Holds the write mutex and publishes the draft when released. */
+  class WriteLock
+  {
+  public:
+    WriteLock(MvccMytex* owner,
+              std::unique_lock<std::mutex> lock,
+              std::unique_ptr<Version> draft)
+      : mOwner(owner)
+      , mLock(std::move(lock))
+      , mDraft(std::move(draft))
+    {
+    }
+    WriteLock(WriteLock&&) noexcept = default;
+    WriteLock& operator=(WriteLock&&) = delete;
+    ~WriteLock()
+    {
+      if (mDraft) {
+        mOwner->Publish(std::move(mDraft));
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mLock.owns_lock(); }
+
+  private:
+    MvccMytex* mOwner;
+    std::unique_lock<std::mutex> mLock;
+    std::unique_ptr<Version> mDraft;
+  };
+
+  /** @brief Make @p draft the newest version. Call with mWriteMutex held. */
+  void Publish(std::unique_ptr<Version> draft)
+  {
+    detail::MvccClock::Instance().Commit([&](std::uint64_t stamp) {
+      draft->stamp = stamp;
+      mHead.store(draft.release(), std::memory_order_release);
+    });
+    if (++mCommits % kCollectEvery == 0) {
+      CollectLocked();
+    }
+  }
+
+  void CollectLocked()
+  {
+    // Everyone reads at this timestamp or later, so the newest version at or
+    // before it is the oldest one anybody still needs.
+    const auto oldest = detail::MvccClock::Instance().OldestPinned();
+    auto* version = mHead.load(std::memory_order_relaxed);
+    while (version->stamp > oldest) {
+      version = version->older.load(std::memory_order_relaxed);
+    }
+    Free(version->older.exchange(nullptr, std::memory_order_relaxed));
+  }
+
+  static void Free(Version* version)
+  {
+    while (version != nullptr) {
+      delete std::exchange(
+        version, version->older.load(std::memory_order_relaxed));
+    }
+  }
+
+  std::atomic<Version*> mHead;
+  mutable std::mutex mWriteMutex;
+  // Protected by mWriteMutex
+  std::uint32_t mCommits = 0;
+};
+} // namespace baudvine
@@ -18,6 +18,8 @@
 #include <mutex>
 #include <optional>
 #include <shared_mutex>
+#include <type_traits>
+#include <utility>
 
 namespace baudvine {
 /**
@@ -47,6 +49,23 @@ public:
   T* operator->() noexcept { return &**this; }
   const T* operator->() const noexcept { return &**this; }
 
+  /**
+   * @brief Narrow the guard down to part of the guarded object.
+   *
+   * The lock moves into the new guard, which leaves this one empty.
+   *
+   * @param fn Called with a reference to the guarded object, returns a
+   *           reference to something the lock also protects.
+   * @returns A MytexGuard referencing whatever @p fn returned.
+   */
+  template<typename Fn>
+  auto Map(Fn&& fn) &&
+  {
+    using U = std::remove_reference_t<std::invoke_result_t<Fn, T&>>;
+    U& part = std::forward<Fn>(fn)(*mObject);
+    return MytexGuard<U, Lock>(&part, std::move(mLock));
+  }
+
 private:
   T* mObject;
   Lock mLock;
@@ -74,6 +93,10 @@ public:
     : mInner(std::in_place, object, std::move(lock))
   {
   }
+  OptionalMytexGuard(MytexGuard<T, Lock>&& guard)
+    : mInner(std::move(guard))
+  {
+  }
 
   /** @brief Indicates whether this contains a (locked) value. */
   [[nodiscard]] bool has_value() const noexcept { return mInner.has_value(); }
@@ -101,6 +124,45 @@ private:
   std::optional<MytexGuard<T, Lock>> mInner{};
 };
 
+/**
+ * @brief A read of a guarded object that holds no lock at all.
+ *
+ * Returned by Mytex::LockOptimistic() for Lockables that support optimistic
+ * reads, such as VersionLock. The guarded object may be modified while this
+ * guard exists, so anything read through it is only trustworthy once
+ * Validate() has returned true afterwards. Reads through it must be atomic
+ * (see OptimisticCell), or they race with writers.
+ */
+template<typename T, typename Lockable>
+class OptimisticMytexGuard
+{
+public:
+  OptimisticMytexGuard(T* object, const Lockable& lockable)
+    : mObject(object)
+    , mLockable(&lockable)
+    , mVersion(lockable.ReadVersion())
+  {
+  }
+
+  /** @returns A reference to the guarded object. */
+  T& operator*() const noexcept { return *mObject; }
+  T* operator->() const noexcept { return mObject; }
+
+  /**
+   * @returns Whether the object is unchanged since this guard was created,
+   *          meaning everything read through it so far is consistent.
+   */
+  [[nodiscard]] bool Validate() const { return mLockable->Validate(mVersion); }
+
+  /** @returns The version the object was at when this guard was created. */
+  [[nodiscard]] auto Version() const noexcept { return mVersion; }
+
+private:
+  T* mObject;
+  const Lockable* mLockable;
+  decltype(std::declval<const Lockable&>().ReadVersion()) mVersion;
+};
+
 /** @brief A mutex that owns the resource it guards.
  *
  * By default this uses std::shared_mutex, but any class that supports the
@@ -117,6 +179,7 @@ public:
   using SharedGuard = MytexGuard<const T, SharedLock>;
   using OptionalGuard = OptionalMytexGuard<T, ExclusiveLock>;
   using SharedOptionalGuard = OptionalMytexGuard<const T, SharedLock>;
+  using OptimisticGuard = OptimisticMytexGuard<const T, Lockable>;
 
   /**
    * @brief Construct a new Mytex with an existing mutex and initialize the
@@ -202,6 +265,33 @@ public:
     return {};
   }
 
+  /**
+   * @brief Read the contained resource without locking.
+   *
+   * Only available when Lockable supports optimistic reads, like
+   * VersionLock. Waits for a writer if there is one.
+   *
+   * @returns An OptimisticMytexGuard. Whatever is read through it must be
+   *          checked with OptimisticMytexGuard::Validate() before use.
+   */
+  OptimisticGuard LockOptimistic() const { return { &mObject, mMutex }; }
+
+  /**
+   * @brief Turn an optimistic read into an exclusive lock, if nothing has
+   * been written since.
+   *
+   * @param guard A guard returned by this Mytex's LockOptimistic().
+   * @returns An OptionalMytexGuard which references the guarded resource if
+   *          and only if the lock is held.
+   */
+  OptionalGuard TryUpgrade(const OptimisticGuard& guard)
+  {
+    if (mMutex.TryUpgrade(guard.Version())) {
+      return { &mObject, ExclusiveLock(mMutex, std::adopt_lock) };
+    }
+    return {};
+  }
+
 private:
   T mObject;
   mutable Lockable mMutex;
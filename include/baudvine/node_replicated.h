@@ -0,0 +1,274 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "numa.h"
+#include "spin_wait.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <vector>
+
+namespace baudvine {
+/** @brief Construction options for NodeReplicated. */
+struct NodeReplicationOptions
+{
+  /** The number of replicas. 0 means one per NUMA node. */
+  std::size_t replicas = 0;
+  /** The number of operations the shared log can hold. */
+  std::size_t logSize = 1024;
+};
+
+/**
+ * @brief A guarded object that is replicated once per NUMA node.
+ *
+ * This follows the node replication (NR) design: every replica has its own
+ * reader-writer lock, and mutations are appended to a log that all replicas
+ * share. A mutation is applied to the local replica right away and to the
+ * other replicas lazily, the next time a thread on that node needs its
+ * replica to be up to date. Reads only ever touch the local replica and its
+ * lock, so read-mostly data scales across sockets without cache lines
+ * bouncing between them.
+ *
+ * Mutations are passed as functions (see With()) because they are replayed
+ * once per replica. They must be deterministic, must not throw, and must only
+ * touch the object they are given.
+ *
+ * Threads are assigned to replicas with CurrentNumaNode(), so with
+ * SimulateNumaNodes() or an explicit replica count the replication can be
+ * exercised on a single-socket machine as well.
+ */
+template<typename T>
+class NodeReplicated
+{
+  struct Replica;
+
+public:
+  using SharedLock = std::shared_lock<std::shared_mutex>;
+  using SharedGuard = MytexGuard<const T, SharedLock>;
+
+  /**
+   * @brief Construct the replicas.
+   *
+   * @param options    The number of replicas and the size of the log.
+   * @param initialize Constructor parameters for each replica. They are
+   *                   passed as lvalues, once per replica.
+   */
+  template<typename... Args>
+  explicit NodeReplicated(NodeReplicationOptions options,
+                          const Args&... initialize)
+    : mLog(std::max<std::size_t>(options.logSize, 1))
+  {
+    const std::size_t replicas =
+      options.replicas != 0 ? options.replicas : NumaNodeCount();
+    for (std::size_t i = 0; i < replicas; ++i) {
+      mReplicas.push_back(std::make_unique<Replica>(initialize...));
+    }
+  }
+
+  /**
+   * @brief Construct one replica per NUMA node.
+   *
+   * @param initialize Constructor parameters for each replica.
+   */
+  template<typename... Args>
+  explicit NodeReplicated(const Args&... initialize)
+    : NodeReplicated(NodeReplicationOptions{}, initialize...)
+  {
+  }
+
+  /**
+   * @brief Apply a mutation to the object.
+   *
+   * @p fn is applied to the calling thread's replica right away, and its
+   * result is returned. A copy is appended to the shared log for the other
+   * replicas to pick up.
+   *
+   * @param fn A copyable, deterministic function taking T&.
+   * @returns A copy of whatever @p fn returned for the local replica.
+   */
+  template<typename Fn>
+  decltype(auto) With(Fn&& fn)
+  {
+    // The local replica is locked before appending so nobody else can apply
+    // this entry to it before fn's result has been captured.
+    auto& replica = LocalReplica();
+    std::unique_lock lock(replica.mutex);
+    const std::uint64_t index = Append(fn, replica);
+    ApplyUntil(replica, index);
+    if constexpr (std::is_void_v<std::invoke_result_t<Fn&, T&>>) {
+      fn(replica.value);
+      Complete(replica, index);
+    } else {
+      auto result = fn(replica.value);
+      Complete(replica, index);
+      return result;
+    }
+  }
+
+  /**
+   * @brief Lock the local replica in shared mode.
+   *
+   * The replica is brought up to date with every mutation that completed
+   * before this call.
+   *
+   * @returns A MytexGuard with a const reference to the local replica.
+   */
+  SharedGuard LockShared() const
+  {
+    auto& replica = LocalReplica();
+    const auto completed = mCompleted.load(std::memory_order_acquire);
+    if (replica.applied.load(std::memory_order_acquire) < completed) {
+      std::lock_guard lock(replica.mutex);
+      ApplyUntil(replica, completed);
+    }
+    return { &replica.value, SharedLock(replica.mutex) };
+  }
+
+  /** @returns The number of replicas. */
+  [[nodiscard]] std::size_t ReplicaCount() const noexcept
+  {
+    return mReplicas.size();
+  }
+
+private:
+  static constexpr std::uint64_t kEmpty = ~std::uint64_t{ 0 };
+
+  struct alignas(64) Entry
+  {
+    std::atomic<std::uint64_t> index{ kEmpty };
+    std::function<void(T&)> op;
+  };
+
+  struct alignas(64) Replica
+  {
+    template<typename... Args>
+    explicit Replica(const Args&... initialize)
+      : value(initialize...)
+    {
+    }
+
+    std::shared_mutex mutex;
+    T value;
+    // Log entries before this one have been applied to value.
+    std::atomic<std::uint64_t> applied{ 0 };
+  };
+
+  Replica& LocalReplica() const
+  {
+    return *mReplicas[CurrentNumaNode() % mReplicas.size()];
+  }
+
+  /**
+   * @param held The replica whose exclusive lock the caller holds.
+   * @returns The log index of the new entry.
+   */
+  std::uint64_t Append(std::function<void(T&)> op, Replica& held)
+  {
+    const auto index = mTail.fetch_add(1, std::memory_order_relaxed);
+    auto& entry = mLog[index % mLog.size()];
+
+    // The slot still holds an entry from the previous lap until every replica
+    // has applied it. Replicas are only caught up opportunistically so this
+    // never waits on a lock whose holder might be waiting for us.
+    const std::uint64_t needed =
+      index >= mLog.size() ? index - mLog.size() + 1 : 0;
+    detail::SpinWait spin;
+    while (!HelpReplicas(needed, held)) {
+      spin();
+    }
+
+    entry.op = std::move(op);
+    entry.index.store(index, std::memory_order_release);
+    return index;
+  }
+
+  /** @returns Whether every replica has applied the entries before @p end. */
+  bool HelpReplicas(std::uint64_t end, Replica& held) const
+  {
+    bool done = true;
+    for (const auto& replica : mReplicas) {
+      if (replica->applied.load(std::memory_order_acquire) >= end) {
+        continue;
+      }
+      if (replica.get() == &held) {
+        ApplyAvailable(held, end);
+      } else if (std::unique_lock lock(replica->mutex, std::try_to_lock);
+                 lock.owns_lock()) {
+        ApplyAvailable(*replica, end);
+      }
+      done = done && replica->applied.load(std::memory_order_acquire) >= end;
+    }
+    return done;
+  }
+
+  /** @brief Apply entries before @p end, waiting for them to be written. */
+  void ApplyUntil(Replica& replica, std::uint64_t end) const
+  {
+    detail::SpinWait spin;
+    while (!ApplyAvailable(replica, end)) {
+      spin();
+    }
+  }
+
+  /**
+   * @brief Apply entries before @p end that have been written.
+   *
+   * Must hold the replica's exclusive lock.
+   *
+   * @returns Whether the replica has caught up to @p end.
+   */
+  bool ApplyAvailable(Replica& replica, std::uint64_t end) const
+  {
+    auto next = replica.applied.load(std::memory_order_relaxed);
+    for (; next < end; ++next) {
+      const auto& entry = mLog[next % mLog.size()];
+      if (entry.index.load(std::memory_order_acquire) != next) {
+        return false;
+      }
+      entry.op(replica.value);
+      // Published per entry so appenders waiting for this slot can proceed.
+      replica.applied.store(next + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  void Complete(Replica& replica, std::uint64_t index)
+  {
+    replica.applied.store(index + 1, std::memory_order_release);
+    auto completed = mCompleted.load(std::memory_order_relaxed);
+    while (completed <= index &&
+           !mCompleted.compare_exchange_weak(completed,
+                                             index + 1,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+    }
+  }
+
+  std::vector<Entry> mLog;
+  alignas(64) std::atomic<std::uint64_t> mTail{ 0 };
+  // One past the last entry whose With() call has applied it.
+  alignas(64) std::atomic<std::uint64_t> mCompleted{ 0 };
+  std::vector<std::unique_ptr<Replica>> mReplicas;
+};
+} // namespace baudvine
@@ -0,0 +1,182 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "per_thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace baudvine {
+/**
+ * @brief Which CPUs belong to which NUMA node.
+ *
+ * Nodes are numbered densely from zero in the order of their sysfs IDs, so
+ * they can be used as indices even on machines with gaps in the numbering.
+ */
+class NumaTopology
+{
+public:
+  /** @brief A machine with one node. */
+  NumaTopology() = default;
+
+  /**
+   * @brief Read the topology from sysfs.
+   *
+   * @param root The directory containing the node<N>/cpulist files. Anything
+   *             missing or unreadable results in a single-node topology.
+   */
+  static NumaTopology Load(
+    const std::filesystem::path& root = "/sys/devices/system/node")
+  {
+    std::vector<std::pair<std::size_t, std::filesystem::path>> nodes;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it(root, error), end;
+         !error && it != end;
+         it.increment(error)) {
+      const auto name = it->path().filename().string();
+      if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+          std::all_of(name.begin() + 4, name.end(), [](char c) {
+            return c >= '0' && c <= '9';
+          })) {
+        nodes.emplace_back(std::stoul(name.substr(4)), it->path());
+      }
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    NumaTopology topology;
+    if (nodes.empty()) {
+      return topology;
+    }
+    topology.mNodeCount = nodes.size();
+    for (std::size_t node = 0; node < nodes.size(); ++node) {
+      std::ifstream file(nodes[node].second / "cpulist");
+      std::string cpulist;
+      std::getline(file, cpulist);
+      for (const auto cpu : ParseCpuList(cpulist)) {
+        if (cpu >= topology.mCpuToNode.size()) {
+          topology.mCpuToNode.resize(cpu + 1, 0);
+        }
+        topology.mCpuToNode[cpu] = node;
+      }
+    }
+    return topology;
+  }
+
+  /** @brief Parse the "0-3,8,10-11" format used by sysfs. */
+  static std::vector<std::size_t> ParseCpuList(const std::string& cpulist)
+  {
+    std::vector<std::size_t> cpus;
+    std::istringstream stream(cpulist);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+      if (range.empty() || range.find_first_of("0123456789") != 0) {
+        continue;
+      }
+      const auto dash = range.find('-');
+      const std::size_t first = std::stoul(range.substr(0, dash));
+      const std::size_t last =
+        dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+      for (std::size_t cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+
+  [[nodiscard]] std::size_t NodeCount() const noexcept { return mNodeCount; }
+
+  /** @returns The node @p cpu belongs to, or 0 if it isn't known. */
+  [[nodiscard]] std::size_t NodeOfCpu(std::size_t cpu) const noexcept
+  {
+    return cpu < mCpuToNode.size() ? mCpuToNode[cpu] : 0;
+  }
+
+private:
+  std::size_t mNodeCount = 1;
+  std::vector<std::size_t> mCpuToNode;
+};
+
+namespace detail {
+inline std::atomic<std::size_t>&
+SimulatedNumaNodes()
+{
+  static std::atomic<std::size_t> nodes{ 0 };
+  return nodes;
+}
+
+inline const NumaTopology&
+SystemNumaTopology()
+{
+  static const NumaTopology topology = NumaTopology::Load();
+  return topology;
+}
+} // namespace detail
+
+/**
+ * @brief Pretend the machine has @p nodes NUMA nodes, for testing.
+ *
+ * Threads are spread over the simulated nodes round-robin by thread index
+ * rather than by CPU, so this works on single-CPU machines too. Pass 0 to go
+ * back to the real topology. Only affects locks constructed afterwards.
+ */
+inline void
+SimulateNumaNodes(std::size_t nodes) noexcept
+{
+  detail::SimulatedNumaNodes().store(nodes, std::memory_order_relaxed);
+}
+
+/** @returns The number of (possibly simulated) NUMA nodes. */
+inline std::size_t
+NumaNodeCount()
+{
+  const auto simulated =
+    detail::SimulatedNumaNodes().load(std::memory_order_relaxed);
+  return simulated != 0 ? simulated : detail::SystemNumaTopology().NodeCount();
+}
+
+/**
+ * @returns The (possibly simulated) NUMA node the calling thread is running
+ * on. Threads can migrate, so treat this as a hint.
+ */
+inline std::size_t
+CurrentNumaNode()
+{
+  const auto simulated =
+    detail::SimulatedNumaNodes().load(std::memory_order_relaxed);
+  if (simulated != 0) {
+    return detail::ThreadIndex() % simulated;
+  }
+#if defined(__linux__)
+  const int cpu = sched_getcpu();
+  if (cpu >= 0) {
+    return detail::SystemNumaTopology().NodeOfCpu(
+      static_cast<std::size_t>(cpu));
+  }
+#endif
+  return 0;
+}
+} // namespace baudvine
@@ -0,0 +1,320 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "executor.h"
+#include "mytex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+namespace detail {
+/**
+ * @brief One subscriber of an ObservableMytex, and whether a notification for
+ * it is queued or running.
+ */
+class Subscriber : public std::enable_shared_from_this<Subscriber>
+{
+public:
+  Subscriber(std::function<void()> callback, Executor executor)
+    : mCallback(std::move(callback))
+    , mExecutor(std::move(executor))
+  {
+  }
+
+  /** @brief Have the callback run once more, after whatever is queued. */
+  void Notify()
+  {
+    auto state = mState.load(std::memory_order_acquire);
+    for (;;) {
+      if (state == kScheduled || state == kRunningAgain) {
+        // The queued or next run will see this change.
+        return;
+      }
+      const auto next = state == kIdle ? kScheduled : kRunningAgain;
+      if (mState.compare_exchange_weak(
+            state, next, std::memory_order_acq_rel)) {
+        if (next == kScheduled) {
+          Schedule();
+        }
+        return;
+      }
+    }
+  }
+
+  void Cancel() { mActive.store(false, std::memory_order_relaxed); }
+  [[nodiscard]] bool Active() const
+  {
+    return mActive.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum State
+  {
+    kIdle,
+    kScheduled,
+    kRunning,
+    kRunningAgain,
+  };
+
+  void Schedule()
+  {
+    if (mExecutor) {
+      mExecutor([self = shared_from_this()] { self->Run(); });
+    } else {
+      Run();
+    }
+  }
+
+  void Run()
+  {
+    // Changes from here on schedule another run.
+    mState.store(kRunning, std::memory_order_release);
+    for (;;) {
+      if (Active()) {
+        mCallback();
+      }
+      auto state = kRunning;
+      if (mState.compare_exchange_strong(
+            state, kIdle, std::memory_order_acq_rel)) {
+        return;
+      }
+      // Something changed while the callback ran.
+      mState.store(kRunning, std::memory_order_release);
+    }
+  }
+
+  std::function<void()> mCallback;
+  Executor mExecutor;
+  std::atomic<State> mState{ kIdle };
+  std::atomic<bool> mActive{ true };
+};
+} // namespace detail
+
+/**
+ * @brief Keeps a callback subscribed to an ObservableMytex. Unsubscribes when
+ * destroyed.
+ *
+ * A subscription may outlive the ObservableMytex it came from.
+ */
+class Subscription
+{
+public:
+  Subscription() = default;
+  explicit Subscription(std::shared_ptr<detail::Subscriber> subscriber)
+    : mSubscriber(std::move(subscriber))
+  {
+  }
+  Subscription(Subscription&&) noexcept = default;
+  Subscription& operator=(Subscription&& other) noexcept
+  {
+    if (this != &other) {
+      Cancel();
+      mSubscriber = std::move(other.mSubscriber);
+    }
+    return *this;
+  }
+  ~Subscription() { Cancel(); }
+
+  /**
+   * @brief Stop notifying. A notification that's already running finishes.
+   */
+  void Cancel()
+  {
+    if (mSubscriber) {
+      mSubscriber->Cancel();
+      mSubscriber.reset();
+    }
+  }
+
+private:
+  std::shared_ptr<detail::Subscriber> mSubscriber;
+};
+
+/**
+ * @brief A Mytex that notifies subscribers after it's been modified.
+ *
+ * Releasing a guard from Lock() notifies every subscriber, after the lock is
+ * released. A subscriber's callback is never run while the Mytex is locked
+ * by the releasing thread, and never runs concurrently with itself. Writes
+ * that happen before a notification has started are covered by it, so a
+ * burst of writes usually results in a single call. The callback runs on the
+ * subscriber's executor, or on the releasing thread if it has none.
+ *
+ * Callbacks typically call LockShared() to see what changed. A callback that
+ * writes to the same ObservableMytex notifies itself again.
+ */
+template<typename T, typename Lockable = std::shared_mutex>
+class ObservableMytex
+{
+  class NotifyLock;
+
+public:
+  using value_type = T;
+  using Guard = MytexGuard<T, NotifyLock>;
+  using SharedGuard = typename Mytex<T, Lockable>::SharedGuard;
+
+  /**
+   * @brief Construct the guarded object.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit ObservableMytex(Args&&... initialize)
+    : mMytex(std::forward<Args>(initialize)...)
+  {
+  }
+
+  /**
+   * @brief Lock in exclusive mode.
+   *
+   * @returns A MytexGuard referencing the object. Subscribers are notified
+   *          after it's released.
+   */
+  Guard Lock()
+  {
+    auto guard = mMytex.Lock();
+    T* object = &*guard;
+    return { object, NotifyLock(this, std::move(guard)) };
+  }
+
+  /**
+   * @brief Lock in shared mode. Doesn't notify anyone.
+   *
+   * @returns A MytexGuard with a const reference to the object.
+   */
+  SharedGuard LockShared() const { return mMytex.LockShared(); }
+
+  /**
+   * @brief Call @p callback after every write, or once per burst of writes.
+   *
+   * @param executor Runs the callback. Without one, the callback runs on the
+   *        thread that released the lock, right after releasing it.
+   * @returns A Subscription that keeps the callback subscribed.
+   */
+  [[nodiscard]] Subscription Subscribe(std::function<void()> callback,
+                                       Executor executor = {})
+  {
+    auto subscriber = std::make_shared<detail::Subscriber>(
+      std::move(callback), std::move(executor));
+    std::lock_guard lock(mSubscribersMutex);
+    auto subscribers = ActiveSubscribers();
+    subscribers->push_back(subscriber);
+    std::shared_ptr<const Subscribers> replacement(std::move(subscribers));
+    std::atomic_store(&mSubscribers, std::move(replacement));
+    mHasSubscribers.store(true, std::memory_order_release);
+    return Subscription(std::move(subscriber));
+  }
+
+  /** @returns How many subscriptions haven't been found cancelled yet. */
+  [[nodiscard]] std::size_t SubscriberCount() const
+  {
+    const auto subscribers = std::atomic_load(&mSubscribers);
+    return subscribers ? subscribers->size() : 0;
+  }
+
+private:
+  using Subscribers = std::vector<std::shared_ptr<detail::Subscriber>>;
+
+  /** @brief Holds the lock, and notifies subscribers after releasing it. */
+  class NotifyLock
+  {
+  public:
+    NotifyLock(ObservableMytex* owner,
+               typename Mytex<T, Lockable>::Guard guard)
+      : mOwner(owner)
+      , mGuard(std::move(guard))
+    {
+    }
+    NotifyLock(NotifyLock&& other) noexcept
+      : mOwner(std::exchange(other.mOwner, nullptr))
+      , mGuard(std::move(other.mGuard))
+    {
+    }
+    NotifyLock& operator=(NotifyLock&&) = delete;
+    ~NotifyLock()
+    {
+      if (mOwner != nullptr) {
+        mGuard.reset();
+        mOwner->NotifyAll();
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mGuard.has_value(); }
+
+  private:
+    ObservableMytex* mOwner;
+    std::optional<typename Mytex<T, Lockable>::Guard> mGuard;
+  };
+
+  void NotifyAll()
+  {
+    if (!mHasSubscribers.load(std::memory_order_acquire)) {
+      return;
+    }
+    const auto subscribers = std::atomic_load(&mSubscribers);
+    if (!subscribers) {
+      return;
+    }
+    bool cancelled = false;
+    for (const auto& subscriber : *subscribers) {
+      if (subscriber->Active()) {
+        subscriber->Notify();
+      } else {
+        cancelled = true;
+      }
+    }
+    if (cancelled) {
+      // Drop them, so subscribers that come and go don't pile up.
+      std::lock_guard lock(mSubscribersMutex);
+      std::atomic_store(
+        &mSubscribers,
+        std::shared_ptr<const Subscribers>(ActiveSubscribers()));
+    }
+  }
+
+  /**
+   * @returns A copy of the subscriber list without cancelled subscribers.
+   *          Call with mSubscribersMutex held.
+   */
+  std::shared_ptr<Subscribers> ActiveSubscribers() const
+  {
+    auto subscribers = std::make_shared<Subscribers>();
+    if (const auto current = std::atomic_load(&mSubscribers)) {
+      std::copy_if(current->begin(),
+                   current->end(),
+                   std::back_inserter(*subscribers),
+                   [](const auto& existing) { return existing->Active(); });
+    }
+    return subscribers;
+  }
+
+  Mytex<T, Lockable> mMytex;
+  std::mutex mSubscribersMutex;
+  // Replaced under mSubscribersMutex, read with std::atomic_load.
+  std::shared_ptr<const Subscribers> mSubscribers;
+  std::atomic<bool> mHasSubscribers{ false };
+};
+} // namespace baudvine
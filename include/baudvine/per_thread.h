@@ -0,0 +1,171 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace baudvine::detail {
+/** @brief Hands out small, dense indices to live threads. */
+class ThreadIndexRegistry
+{
+public:
+  static constexpr std::size_t kMaxThreads = 4096;
+
+  static ThreadIndexRegistry& Instance()
+  {
+    static ThreadIndexRegistry registry;
+    return registry;
+  }
+
+  /**
+   * @returns The lowest index that isn't in use by another live thread.
+   * @throws std::length_error if kMaxThreads threads are already registered.
+   */
+  std::size_t Acquire()
+  {
+    std::lock_guard lock(mMutex);
+    for (std::size_t i = 0; i < mUsed.size(); ++i) {
+      if (!mUsed[i]) {
+        mUsed[i] = true;
+        return i;
+      }
+    }
+    if (mUsed.size() == kMaxThreads) {
+      throw std::length_error("baudvine: too many threads");
+    }
+    mUsed.push_back(true);
+    return mUsed.size() - 1;
+  }
+
+  void Release(std::size_t index)
+  {
+    std::lock_guard lock(mMutex);
+    mUsed[index] = false;
+  }
+
+private:
+  ThreadIndexRegistry() = default;
+
+  std::mutex mMutex;
+  std::vector<bool> mUsed;
+};
+
+/**
+ * @brief A small integer that identifies the calling thread.
+ *
+ * Unique among live threads. Indices are recycled when threads exit, so
+ * per-thread state indexed by them is inherited by later threads.
+ */
+inline std::size_t
+ThreadIndex()
+{
+  struct Holder
+  {
+    Holder()
+      : index(ThreadIndexRegistry::Instance().Acquire())
+    {
+    }
+    Holder(const Holder&) = delete;
+    Holder& operator=(const Holder&) = delete;
+    ~Holder() { ThreadIndexRegistry::Instance().Release(index); }
+
+    std::size_t index;
+  };
+
+  // The holder's destructor makes every access to it go through a TLS
+  // initialization check, so cache the index in a trivial thread_local.
+  constexpr std::size_t kUnset = ~std::size_t{ 0 };
+  thread_local std::size_t cached = kUnset;
+  if (cached == kUnset) {
+    thread_local const Holder holder;
+    cached = holder.index;
+  }
+  return cached;
+}
+
+/**
+ * @brief One T per thread, owned by an object rather than by the thread.
+ *
+ * Entries are allocated lazily in cache-line aligned chunks and are never
+ * freed before the PerThread itself, so other threads can safely inspect them
+ * with ForEach(). Entries are value-initialized and are reused (not reset)
+ * when a thread index is recycled.
+ */
+template<typename T, std::size_t ChunkSize = 64>
+class PerThread
+{
+public:
+  PerThread() = default;
+  PerThread(const PerThread&) = delete;
+  PerThread& operator=(const PerThread&) = delete;
+  ~PerThread()
+  {
+    for (auto& chunk : mChunks) {
+      delete[] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  /** @returns The calling thread's entry. */
+  T& Local() { return Get(ThreadIndex()); }
+
+  /** @returns The entry for thread index @p index. */
+  T& Get(std::size_t index)
+  {
+    auto& chunk = mChunks[index / ChunkSize];
+    Slot* slots = chunk.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+      auto* fresh = new Slot[ChunkSize]();
+      if (chunk.compare_exchange_strong(slots,
+                                        fresh,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        slots = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+    return slots[index % ChunkSize].value;
+  }
+
+  /** @brief Call @p fn for every entry that has been allocated so far. */
+  template<typename Fn>
+  void ForEach(Fn&& fn)
+  {
+    for (auto& chunk : mChunks) {
+      if (Slot* slots = chunk.load(std::memory_order_acquire)) {
+        for (std::size_t i = 0; i < ChunkSize; ++i) {
+          fn(slots[i].value);
+        }
+      }
+    }
+  }
+
+private:
+  struct alignas(64) Slot
+  {
+    T value{};
+  };
+
+  static constexpr std::size_t kChunks =
+    (ThreadIndexRegistry::kMaxThreads + ChunkSize - 1) / ChunkSize;
+
+  std::array<std::atomic<Slot*>, kChunks> mChunks{};
+};
+} // namespace baudvine::detail
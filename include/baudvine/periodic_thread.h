@@ -0,0 +1,68 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace baudvine::detail {
+/** @brief Calls a function every so often on a thread of its own. */
+class PeriodicThread
+{
+public:
+  PeriodicThread() = default;
+  PeriodicThread(const PeriodicThread&) = delete;
+  PeriodicThread& operator=(const PeriodicThread&) = delete;
+  ~PeriodicThread() { Stop(); }
+
+  /** @brief Call @p fn every @p period until Stop(), replacing any earlier. */
+  void Start(std::chrono::milliseconds period, std::function<void()> fn)
+  {
+    Stop();
+    mStop = false;
+    mThread = std::thread([this, period, fn = std::move(fn)] {
+      std::unique_lock lock(mMutex);
+      while (!mWake.wait_for(lock, period, [this] { return mStop; })) {
+        lock.unlock();
+        fn();
+        lock.lock();
+      }
+    });
+  }
+
+  void Stop()
+  {
+    if (!mThread.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard lock(mMutex);
+      mStop = true;
+    }
+    mWake.notify_all();
+    mThread.join();
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mWake;
+  bool mStop = false;
+  std::thread mThread;
+};
+} // namespace baudvine::detail
@@ -0,0 +1,352 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace baudvine {
+namespace detail {
+/** @returns The number of set bits in @p mask. */
+inline std::uint32_t
+PopCount(std::uint32_t mask) noexcept
+{
+#if defined(_MSC_VER)
+  return static_cast<std::uint32_t>(__popcnt(mask));
+#else
+  return static_cast<std::uint32_t>(__builtin_popcount(mask));
+#endif
+}
+} // namespace detail
+
+/**
+ * @brief An immutable hash map with cheap copies: a hash array mapped trie.
+ *
+ * Copying a PersistentMap copies one pointer. Set() and Erase() change only
+ * the map they're called on, by copying the nodes on the path to the key and
+ * sharing all the others with earlier copies, so a modified copy of a map
+ * with n entries costs O(log32 n) new memory. Nodes are never changed once
+ * they're shared, which makes it safe to read one copy while another thread
+ * modifies a different one.
+ *
+ * The layout follows CHAMP: each node keeps its entries and its children in
+ * two separate arrays, indexed by bitmaps of 32 hash fragments each, and a
+ * subtree that shrinks to a single entry is folded back into its parent.
+ */
+template<typename K,
+         typename V,
+         typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+class PersistentMap
+{
+public:
+  using key_type = K;
+  using mapped_type = V;
+
+  PersistentMap() = default;
+
+  /** @returns The number of entries. */
+  [[nodiscard]] std::size_t Size() const noexcept { return mSize; }
+  /** @returns Whether there are no entries. */
+  [[nodiscard]] bool Empty() const noexcept { return mSize == 0; }
+
+  /** @returns The value for @p key, or nullptr if there is none. */
+  const V* Find(const K& key) const
+  {
+    if (!mRoot) {
+      return nullptr;
+    }
+    const auto hash = HashOf(key);
+    const Node* node = mRoot.get();
+    for (unsigned shift = 0;; shift += kBits) {
+      if (shift >= kHashBits) {
+        for (const auto& entry : node->entries) {
+          if (KeyEqual()(entry.first, key)) {
+            return &entry.second;
+          }
+        }
+        return nullptr;
+      }
+      const auto bit = BitOf(hash, shift);
+      if ((node->dataMap & bit) != 0) {
+        const auto& entry = node->entries[IndexOf(node->dataMap, bit)];
+        return KeyEqual()(entry.first, key) ? &entry.second : nullptr;
+      }
+      if ((node->nodeMap & bit) == 0) {
+        return nullptr;
+      }
+      node = node->children[IndexOf(node->nodeMap, bit)].get();
+    }
+  }
+
+  /** @returns Whether there is an entry for @p key. */
+  [[nodiscard]] bool Contains(const K& key) const
+  {
+    return Find(key) != nullptr;
+  }
+
+  /**
+   * @brief Insert or replace the entry for @p key.
+   *
+   * @returns Whether a new entry was added.
+   */
+  bool Set(K key, V value)
+  {
+    bool added = false;
+    const auto hash = HashOf(key);
+    mRoot = SetIn(Root(),
+                  std::pair<K, V>(std::move(key), std::move(value)),
+                  hash,
+                  0,
+                  added);
+    mSize += added ? 1 : 0;
+    return added;
+  }
+
+  /**
+   * @brief Remove the entry for @p key.
+   *
+   * @returns Whether there was one.
+   */
+  bool Erase(const K& key)
+  {
+    if (!mRoot) {
+      return false;
+    }
+    bool removed = false;
+    auto root = EraseFrom(*mRoot, key, HashOf(key), 0, removed);
+    if (removed) {
+      mRoot = --mSize == 0 ? nullptr : std::move(root);
+    }
+    return removed;
+  }
+
+  /** @brief Call @p fn with every key and value, in no particular order. */
+  template<typename Fn>
+  void ForEach(Fn&& fn) const
+  {
+    if (mRoot) {
+      Visit(*mRoot, fn);
+    }
+  }
+
+private:
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+  using Entry = std::pair<K, V>;
+
+  struct Node
+  {
+    // Fragments that have an entry here, and those that have a child.
+    // Collision nodes, below the last fragment, use neither.
+    std::uint32_t dataMap = 0;
+    std::uint32_t nodeMap = 0;
+    std::vector<Entry> entries;
+    std::vector<NodePtr> children;
+  };
+
+  static constexpr unsigned kBits = 5;
+  static constexpr unsigned kHashBits = 64;
+
+  static std::uint64_t HashOf(const K& key)
+  {
+    return detail::MixHash(static_cast<std::uint64_t>(Hash()(key)));
+  }
+
+  static std::uint32_t BitOf(std::uint64_t hash, unsigned shift) noexcept
+  {
+    return std::uint32_t{ 1 } << ((hash >> shift) & ((1U << kBits) - 1));
+  }
+
+  static std::size_t IndexOf(std::uint32_t map, std::uint32_t bit) noexcept
+  {
+    return detail::PopCount(map & (bit - 1));
+  }
+
+  const Node& Root() const
+  {
+    static const Node empty;
+    return mRoot ? *mRoot : empty;
+  }
+
+  /** @returns A node holding just @p first and @p second. */
+  static NodePtr Pair(Entry first,
+                      std::uint64_t firstHash,
+                      Entry second,
+                      std::uint64_t secondHash,
+                      unsigned shift)
+  {
+    auto node = std::make_shared<Node>();
+    if (shift >= kHashBits) {
+      node->entries.push_back(std::move(first));
+      node->entries.push_back(std::move(second));
+      return node;
+    }
+    const auto firstBit = BitOf(firstHash, shift);
+    const auto secondBit = BitOf(secondHash, shift);
+    if (firstBit == secondBit) {
+      node->nodeMap = firstBit;
+      node->children.push_back(Pair(std::move(first),
+                                    firstHash,
+                                    std::move(second),
+                                    secondHash,
+                                    shift + kBits));
+      return node;
+    }
+    node->dataMap = firstBit | secondBit;
+    if (secondBit < firstBit) {
+      std::swap(first, second);
+    }
+    node->entries.push_back(std::move(first));
+    node->entries.push_back(std::move(second));
+    return node;
+  }
+
+  static NodePtr SetIn(const Node& node,
+                       Entry entry,
+                       std::uint64_t hash,
+                       unsigned shift,
+                       bool& added)
+  {
+    auto copy = std::make_shared<Node>(node);
+    if (shift >= kHashBits) {
+      for (auto& existing : copy->entries) {
+        if (KeyEqual()(existing.first, entry.first)) {
+          existing.second = std::move(entry.second);
+          return copy;
+        }
+      }
+      copy->entries.push_back(std::move(entry));
+      added = true;
+      return copy;
+    }
+
+    const auto bit = BitOf(hash, shift);
+    if ((node.dataMap & bit) != 0) {
+      const auto index = IndexOf(node.dataMap, bit);
+      auto& existing = copy->entries[index];
+      if (KeyEqual()(existing.first, entry.first)) {
+        existing.second = std::move(entry.second);
+        return copy;
+      }
+      // Two keys share this fragment: push both down a level.
+      const auto existingHash = HashOf(existing.first);
+      auto child = Pair(std::move(existing),
+                        existingHash,
+                        std::move(entry),
+                        hash,
+                        shift + kBits);
+      copy->entries.erase(copy->entries.begin() + index);
+      copy->dataMap &= ~bit;
+      copy->nodeMap |= bit;
+      copy->children.insert(
+        copy->children.begin() + IndexOf(copy->nodeMap, bit),
+        std::move(child));
+      added = true;
+      return copy;
+    }
+    if ((node.nodeMap & bit) != 0) {
+      auto& child = copy->children[IndexOf(node.nodeMap, bit)];
+      child = SetIn(*child, std::move(entry), hash, shift + kBits, added);
+      return copy;
+    }
+    copy->dataMap |= bit;
+    copy->entries.insert(copy->entries.begin() + IndexOf(copy->dataMap, bit),
+                         std::move(entry));
+    added = true;
+    return copy;
+  }
+
+  /** @returns The node without @p key, or nothing useful if !removed. */
+  static NodePtr EraseFrom(const Node& node,
+                           const K& key,
+                           std::uint64_t hash,
+                           unsigned shift,
+                           bool& removed)
+  {
+    if (shift >= kHashBits) {
+      for (std::size_t i = 0; i < node.entries.size(); ++i) {
+        if (KeyEqual()(node.entries[i].first, key)) {
+          auto copy = std::make_shared<Node>(node);
+          copy->entries.erase(copy->entries.begin() + i);
+          removed = true;
+          return copy;
+        }
+      }
+      return {};
+    }
+
+    const auto bit = BitOf(hash, shift);
+    if ((node.dataMap & bit) != 0) {
+      const auto index = IndexOf(node.dataMap, bit);
+      if (!KeyEqual()(node.entries[index].first, key)) {
+        return {};
+      }
+      auto copy = std::make_shared<Node>(node);
+      copy->entries.erase(copy->entries.begin() + index);
+      copy->dataMap &= ~bit;
+      removed = true;
+      return copy;
+    }
+    if ((node.nodeMap & bit) == 0) {
+      return {};
+    }
+
+    const auto childIndex = IndexOf(node.nodeMap, bit);
+    auto child =
+      EraseFrom(*node.children[childIndex], key, hash, shift + kBits, removed);
+    if (!removed) {
+      return {};
+    }
+    auto copy = std::make_shared<Node>(node);
+    if (child->children.empty() && child->entries.size() == 1) {
+      // A lone entry moves up to where it would be without the subtree.
+      copy->children.erase(copy->children.begin() + childIndex);
+      copy->nodeMap &= ~bit;
+      copy->dataMap |= bit;
+      copy->entries.insert(copy->entries.begin() +
+                             IndexOf(copy->dataMap, bit),
+                           child->entries.front());
+    } else {
+      copy->children[childIndex] = std::move(child);
+    }
+    return copy;
+  }
+
+  template<typename Fn>
+  static void Visit(const Node& node, Fn& fn)
+  {
+    for (const auto& entry : node.entries) {
+      fn(entry.first, entry.second);
+    }
+    for (const auto& child : node.children) {
+      Visit(*child, fn);
+    }
+  }
+
+  NodePtr mRoot;
+  std::size_t mSize = 0;
+};
+} // namespace baudvine
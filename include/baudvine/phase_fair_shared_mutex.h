@@ -0,0 +1,179 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace baudvine {
+/**
+ * @brief A SharedLockable that alternates between read and write phases.
+ *
+ * Neither readers nor writers can starve:
+ * - A writer that arrives during a read phase waits for the readers that are
+ *   already in (plus at most @p ReaderGrace latecomers) and then goes next.
+ *   Readers that show up after it wait for the following read phase.
+ * - A reader that arrives during a write phase waits for at most
+ *   @p WritersPerPhase writers, after which every waiting reader is let in at
+ *   once.
+ * - Writers are served in FIFO order.
+ *
+ * With the defaults this is the classic phase-fair lock: phases strictly
+ * alternate whenever both sides are waiting. Raising @p WritersPerPhase trades
+ * reader latency for writer throughput, raising @p ReaderGrace does the
+ * opposite.
+ *
+ * Waiting threads block on condition variables rather than spinning.
+ */
+template<std::size_t WritersPerPhase = 1, std::size_t ReaderGrace = 0>
+class BasicPhaseFairSharedMutex
+{
+  static_assert(WritersPerPhase > 0, "A write phase needs a writer");
+
+public:
+  BasicPhaseFairSharedMutex() = default;
+  BasicPhaseFairSharedMutex(const BasicPhaseFairSharedMutex&) = delete;
+  BasicPhaseFairSharedMutex& operator=(const BasicPhaseFairSharedMutex&) =
+    delete;
+  BasicPhaseFairSharedMutex(BasicPhaseFairSharedMutex&&) = delete;
+  BasicPhaseFairSharedMutex& operator=(BasicPhaseFairSharedMutex&&) = delete;
+  ~BasicPhaseFairSharedMutex() = default;
+
+  void lock()
+  {
+    std::unique_lock lock(mMutex);
+    const std::uint64_t ticket = mNextTicket++;
+    if (!mWriter && mReaders == 0 && ticket == mServing) {
+      mWriter = true;
+      mWritesThisPhase = 0;
+      ++mServing;
+      return;
+    }
+
+    ++mWaitingWriters;
+    mWriterCv.wait(lock, [&] { return ticket < mServing; });
+  }
+
+  bool try_lock()
+  {
+    std::lock_guard lock(mMutex);
+    if (mWriter || mReaders != 0 || mNextTicket != mServing) {
+      return false;
+    }
+    mWriter = true;
+    mWritesThisPhase = 0;
+    ++mNextTicket;
+    ++mServing;
+    return true;
+  }
+
+  void unlock()
+  {
+    std::lock_guard lock(mMutex);
+    mWriter = false;
+    ++mWritesThisPhase;
+    if (mWaitingReaders != 0 &&
+        (mWritesThisPhase >= WritersPerPhase || mWaitingWriters == 0)) {
+      StartReadPhase();
+    } else if (mWaitingWriters != 0) {
+      GrantWriter();
+    }
+  }
+
+  void lock_shared()
+  {
+    std::unique_lock lock(mMutex);
+    if (TryEnterReadPhase()) {
+      return;
+    }
+
+    ++mWaitingReaders;
+    const std::uint64_t phase = mReadPhase;
+    mReaderCv.wait(lock, [&] { return mReadPhase != phase; });
+  }
+
+  bool try_lock_shared()
+  {
+    std::lock_guard lock(mMutex);
+    return TryEnterReadPhase();
+  }
+
+  void unlock_shared()
+  {
+    std::lock_guard lock(mMutex);
+    if (--mReaders == 0 && mWaitingWriters != 0) {
+      mWritesThisPhase = 0;
+      GrantWriter();
+    }
+  }
+
+private:
+  bool TryEnterReadPhase()
+  {
+    if (mWriter || mWaitingReaders != 0) {
+      return false;
+    }
+    if (mWaitingWriters != 0) {
+      if (mLateReaders >= ReaderGrace) {
+        return false;
+      }
+      ++mLateReaders;
+    }
+    ++mReaders;
+    return true;
+  }
+
+  void StartReadPhase()
+  {
+    // The waiting readers are admitted here rather than when they wake up, so
+    // a writer that comes in between can't slip past them.
+    mReaders += mWaitingReaders;
+    mWaitingReaders = 0;
+    mWritesThisPhase = 0;
+    mLateReaders = 0;
+    ++mReadPhase;
+    mReaderCv.notify_all();
+  }
+
+  void GrantWriter()
+  {
+    mWriter = true;
+    --mWaitingWriters;
+    mLateReaders = 0;
+    ++mServing;
+    mWriterCv.notify_all();
+  }
+
+  std::mutex mMutex;
+  std::condition_variable mReaderCv;
+  std::condition_variable mWriterCv;
+
+  // Protected by mMutex
+  bool mWriter = false;
+  std::size_t mReaders = 0;
+  std::size_t mWaitingReaders = 0;
+  std::size_t mWaitingWriters = 0;
+  std::size_t mWritesThisPhase = 0;
+  std::size_t mLateReaders = 0;
+  std::uint64_t mReadPhase = 0;
+  std::uint64_t mNextTicket = 0;
+  std::uint64_t mServing = 0;
+};
+
+/** @brief A strictly alternating phase-fair SharedLockable. */
+using PhaseFairSharedMutex = BasicPhaseFairSharedMutex<>;
+} // namespace baudvine
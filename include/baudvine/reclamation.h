@@ -0,0 +1,475 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "per_thread.h"
+#include "periodic_thread.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+/** @brief Tuning for EpochDomain and HazardPointerDomain. */
+struct ReclamationOptions
+{
+  /** @brief Objects a thread retires before handing them to the domain. */
+  std::size_t batch = 64;
+  /**
+   * @brief Objects the domain holds before a retiring thread reclaims them
+   * itself instead of leaving it to the background thread.
+   */
+  std::size_t maxGarbage = 16384;
+};
+
+namespace detail {
+/** @brief A retired object and how to free it. */
+struct Retired
+{
+  void* object;
+  void (*deleter)(void*);
+  // Only used by EpochDomain.
+  std::uint64_t epoch;
+
+  void Free() const { deleter(object); }
+};
+
+template<typename T>
+void
+DeleteRetired(void* object)
+{
+  delete static_cast<T*>(object);
+}
+
+/**
+ * @brief What EpochDomain and HazardPointerDomain have in common: per-thread
+ * batches of retired objects, a shared list they're handed to, and a thread
+ * that reclaims them in the background.
+ *
+ * @tparam Domain Provides Reclaim(), and RetireEpoch() to tag retired objects.
+ * @tparam Slot Per-thread state with a `retired` vector.
+ */
+template<typename Domain, typename Slot>
+class RetireLists
+{
+public:
+  explicit RetireLists(ReclamationOptions options)
+    : mOptions(options)
+  {
+  }
+  RetireLists(const RetireLists&) = delete;
+  RetireLists& operator=(const RetireLists&) = delete;
+  ~RetireLists()
+  {
+    mBackground.Stop();
+    // Nobody can be reading anymore, so everything can go.
+    for (const auto& retired : mPending) {
+      retired.Free();
+    }
+    mSlots.ForEach([](Slot& slot) {
+      for (const auto& retired : slot.retired) {
+        retired.Free();
+      }
+    });
+  }
+
+  /** @brief Free @p object with `delete` once no reader can be using it. */
+  template<typename T>
+  void Retire(T* object)
+  {
+    Retire(object, &DeleteRetired<T>);
+  }
+
+  /** @brief Free @p object with @p deleter once no reader can be using it. */
+  void Retire(void* object, void (*deleter)(void*))
+  {
+    auto& slot = mSlots.Local();
+    slot.retired.push_back(
+      { object, deleter, static_cast<Domain*>(this)->RetireEpoch() });
+    mGarbage.fetch_add(1, std::memory_order_relaxed);
+    if (slot.retired.size() >= mOptions.batch) {
+      Flush();
+    }
+  }
+
+  /**
+   * @brief Hand the calling thread's retired objects to the domain, so the
+   * background thread or another thread's Reclaim() can free them.
+   */
+  void Flush()
+  {
+    auto& slot = mSlots.Local();
+    std::size_t pending = 0;
+    {
+      std::lock_guard lock(mMutex);
+      mPending.insert(mPending.end(), slot.retired.begin(), slot.retired.end());
+      pending = mPending.size();
+    }
+    slot.retired.clear();
+    if (pending > mOptions.maxGarbage) {
+      static_cast<Domain*>(this)->Reclaim();
+    }
+  }
+
+  /** @returns How many retired objects haven't been freed yet. */
+  [[nodiscard]] std::size_t Garbage() const noexcept
+  {
+    return mGarbage.load(std::memory_order_relaxed);
+  }
+
+  /** @brief Call Reclaim() every @p period on a background thread. */
+  void StartBackground(std::chrono::milliseconds period)
+  {
+    mBackground.Start(period,
+                      [this] { static_cast<Domain*>(this)->Reclaim(); });
+  }
+
+  /** @brief Stop the background thread, if there is one. */
+  void StopBackground() { mBackground.Stop(); }
+
+protected:
+  /**
+   * @brief Take the pending objects and free those that the predicate made by
+   * @p makeCanFree allows. The others stay pending.
+   *
+   * The predicate is made after the objects are taken, so it reflects what
+   * readers were doing after they were all retired.
+   *
+   * @returns The number of objects freed.
+   */
+  template<typename MakePredicate>
+  std::size_t FreePending(MakePredicate&& makeCanFree)
+  {
+    std::vector<Retired> candidates;
+    {
+      std::lock_guard lock(mMutex);
+      candidates.swap(mPending);
+    }
+    if (candidates.empty()) {
+      return 0;
+    }
+    const auto canFree = makeCanFree();
+    const auto kept =
+      std::partition(candidates.begin(), candidates.end(), canFree);
+    const auto freed =
+      static_cast<std::size_t>(std::distance(candidates.begin(), kept));
+    for (auto it = candidates.begin(); it != kept; ++it) {
+      it->Free();
+    }
+    mGarbage.fetch_sub(freed, std::memory_order_relaxed);
+    if (kept != candidates.end()) {
+      std::lock_guard lock(mMutex);
+      mPending.insert(mPending.end(), kept, candidates.end());
+    }
+    return freed;
+  }
+
+  PerThread<Slot> mSlots;
+
+private:
+  ReclamationOptions mOptions;
+  std::mutex mMutex;
+  // Protected by mMutex
+  std::vector<Retired> mPending;
+  std::atomic<std::size_t> mGarbage{ 0 };
+  PeriodicThread mBackground;
+};
+
+struct EpochSlot
+{
+  // The epoch the thread entered its critical section in, or kQuiescent.
+  std::atomic<std::uint64_t> local{ 0 };
+  // Only touched by the owning thread.
+  std::uint32_t depth = 0;
+  std::vector<Retired> retired;
+};
+
+struct HazardSlot
+{
+  static constexpr std::size_t kHazards = 8;
+
+  std::array<std::atomic<const void*>, kHazards> hazards{};
+  // Only touched by the owning thread.
+  std::uint32_t used = 0;
+  std::vector<Retired> retired;
+};
+} // namespace detail
+
+/**
+ * @brief Epoch-based memory reclamation.
+ *
+ * Readers Pin() the domain for as long as they use objects that writers may
+ * unlink and Retire(). Pinning records the global epoch in a per-thread slot,
+ * and the epoch only advances once every pinned thread has seen the current
+ * one. An object retired in epoch e is freed once the epoch reaches e + 2,
+ * when nobody can still be pinned from before it was unlinked.
+ *
+ * Pinning costs a store and a load and never waits, but a thread that stays
+ * pinned holds up all reclamation in the domain. Retired objects are
+ * collected per thread and handed over in batches. Reclaim() frees what it
+ * can, and StartBackground() has a thread call it periodically. Once more than
+ * ReclamationOptions::maxGarbage objects are pending, retiring threads reclaim
+ * too.
+ */
+class EpochDomain : public detail::RetireLists<EpochDomain, detail::EpochSlot>
+{
+  friend class detail::RetireLists<EpochDomain, detail::EpochSlot>;
+
+public:
+  /** @brief Keeps the domain pinned for the thread that created it. */
+  class Guard
+  {
+  public:
+    explicit Guard(EpochDomain* domain)
+      : mDomain(domain)
+    {
+    }
+    Guard(Guard&& other) noexcept
+      : mDomain(std::exchange(other.mDomain, nullptr))
+    {
+    }
+    Guard& operator=(Guard&&) = delete;
+    ~Guard()
+    {
+      if (mDomain != nullptr) {
+        mDomain->Unpin();
+      }
+    }
+
+  private:
+    EpochDomain* mDomain;
+  };
+
+  explicit EpochDomain(ReclamationOptions options = {})
+    : RetireLists(options)
+  {
+  }
+  // The background thread uses members of this class.
+  ~EpochDomain() { StopBackground(); }
+
+  /**
+   * @brief Enter a critical section. Objects retired after this won't be
+   * freed until the returned guard is destroyed. Nests.
+   */
+  [[nodiscard]] Guard Pin()
+  {
+    auto& slot = mSlots.Local();
+    if (slot.depth++ == 0) {
+      for (;;) {
+        const auto now = mEpoch.load(std::memory_order_seq_cst);
+        slot.local.store(now, std::memory_order_seq_cst);
+        // If the epoch moved on before our store was visible, the thread
+        // that moved it may not have seen us.
+        if (mEpoch.load(std::memory_order_seq_cst) == now) {
+          break;
+        }
+      }
+    }
+    return Guard(this);
+  }
+
+  /**
+   * @brief Advance the epoch if every pinned thread allows it, and free what
+   * that made safe.
+   *
+   * @returns The number of objects freed.
+   */
+  std::size_t Reclaim()
+  {
+    return FreePending([this] {
+      TryAdvance();
+      const auto now = mEpoch.load(std::memory_order_seq_cst);
+      return [now](const detail::Retired& retired) {
+        return retired.epoch + 2 <= now;
+      };
+    });
+  }
+
+  /** @returns The global epoch. */
+  [[nodiscard]] std::uint64_t Epoch() const noexcept
+  {
+    return mEpoch.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr std::uint64_t kQuiescent = 0;
+
+  void Unpin()
+  {
+    auto& slot = mSlots.Local();
+    if (--slot.depth == 0) {
+      slot.local.store(kQuiescent, std::memory_order_release);
+    }
+  }
+
+  std::uint64_t RetireEpoch() const
+  {
+    return mEpoch.load(std::memory_order_seq_cst);
+  }
+
+  void TryAdvance()
+  {
+    auto now = mEpoch.load(std::memory_order_seq_cst);
+    bool behind = false;
+    mSlots.ForEach([now, &behind](const detail::EpochSlot& slot) {
+      const auto local = slot.local.load(std::memory_order_seq_cst);
+      behind |= local != kQuiescent && local != now;
+    });
+    if (!behind) {
+      mEpoch.compare_exchange_strong(now, now + 1, std::memory_order_seq_cst);
+    }
+  }
+
+  // Starts above kQuiescent.
+  std::atomic<std::uint64_t> mEpoch{ 1 };
+};
+
+/**
+ * @brief Hazard pointer memory reclamation.
+ *
+ * A reader Acquire()s a HazardPointer and uses it to Protect() each object
+ * it's about to use, which publishes the object's address. Retired objects
+ * are only freed while no hazard pointer holds their address, so unlike with
+ * EpochDomain, a stalled reader only keeps the objects it protects alive.
+ * Protecting costs a seq_cst store per object, though.
+ *
+ * Each thread can hold detail::HazardSlot::kHazards hazard pointers at once.
+ * Retired objects are batched, reclaimed and bounded the same way as in
+ * EpochDomain.
+ */
+class HazardPointerDomain
+  : public detail::RetireLists<HazardPointerDomain, detail::HazardSlot>
+{
+  friend class detail::RetireLists<HazardPointerDomain, detail::HazardSlot>;
+
+public:
+  /**
+   * @brief One published pointer. Must be destroyed on the thread that
+   * acquired it.
+   */
+  class HazardPointer
+  {
+  public:
+    HazardPointer(detail::HazardSlot* slot, std::size_t index)
+      : mSlot(slot)
+      , mIndex(index)
+    {
+    }
+    HazardPointer(HazardPointer&& other) noexcept
+      : mSlot(std::exchange(other.mSlot, nullptr))
+      , mIndex(other.mIndex)
+    {
+    }
+    HazardPointer& operator=(HazardPointer&&) = delete;
+    ~HazardPointer()
+    {
+      if (mSlot != nullptr) {
+        Reset();
+        mSlot->used &= ~(std::uint32_t{ 1 } << mIndex);
+      }
+    }
+
+    /**
+     * @brief Load @p source and protect what it points to.
+     *
+     * @returns The loaded pointer, which stays valid until it's replaced by
+     *          another Protect() or Reset().
+     */
+    template<typename T>
+    T* Protect(const std::atomic<T*>& source)
+    {
+      T* object = source.load(std::memory_order_acquire);
+      for (;;) {
+        mSlot->hazards[mIndex].store(object, std::memory_order_seq_cst);
+        // Only an object that's still reachable after publishing is safe: a
+        // reclaimer that scanned before our store can't have unlinked it.
+        T* again = source.load(std::memory_order_seq_cst);
+        if (again == object) {
+          return object;
+        }
+        object = again;
+      }
+    }
+
+    /** @brief Stop protecting anything. */
+    void Reset()
+    {
+      mSlot->hazards[mIndex].store(nullptr, std::memory_order_release);
+    }
+
+  private:
+    detail::HazardSlot* mSlot;
+    std::size_t mIndex;
+  };
+
+  explicit HazardPointerDomain(ReclamationOptions options = {})
+    : RetireLists(options)
+  {
+  }
+  ~HazardPointerDomain() { StopBackground(); }
+
+  /**
+   * @returns A hazard pointer for the calling thread.
+   * @throws std::length_error if the thread already holds
+   *         detail::HazardSlot::kHazards of them.
+   */
+  [[nodiscard]] HazardPointer Acquire()
+  {
+    auto& slot = mSlots.Local();
+    for (std::size_t i = 0; i < detail::HazardSlot::kHazards; ++i) {
+      const auto bit = std::uint32_t{ 1 } << i;
+      if ((slot.used & bit) == 0) {
+        slot.used |= bit;
+        return { &slot, i };
+      }
+    }
+    throw std::length_error("baudvine: too many hazard pointers");
+  }
+
+  /**
+   * @brief Free every pending object that no hazard pointer protects.
+   *
+   * @returns The number of objects freed.
+   */
+  std::size_t Reclaim()
+  {
+    return FreePending([this] {
+      std::vector<const void*> hazards;
+      mSlots.ForEach([&hazards](const detail::HazardSlot& slot) {
+        for (const auto& hazard : slot.hazards) {
+          if (const void* object = hazard.load(std::memory_order_seq_cst)) {
+            hazards.push_back(object);
+          }
+        }
+      });
+      std::sort(hazards.begin(), hazards.end());
+      return [hazards = std::move(hazards)](const detail::Retired& retired) {
+        return !std::binary_search(
+          hazards.begin(), hazards.end(), retired.object);
+      };
+    });
+  }
+
+private:
+  static std::uint64_t RetireEpoch() { return 0; }
+};
+} // namespace baudvine
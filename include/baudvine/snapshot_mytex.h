@@ -0,0 +1,185 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "derived_view.h"
+#include "mytex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace baudvine {
+/**
+ * @brief A guarded object whose readers get snapshots they can keep.
+ *
+ * This is meant for types with cheap copies that share structure, like
+ * PersistentMap. Lock() hands out a private copy of the current value, which
+ * replaces it when the guard is released. LockShared() returns the current
+ * value itself, kept alive by the guard for as long as the reader likes.
+ * Writers wait for each other but never for readers, and readers never wait
+ * for anyone.
+ *
+ * With PersistentMap, taking a snapshot is O(1) and each write only adds the
+ * nodes on the paths it touched; everything else is shared with the snapshots
+ * that are still around.
+ */
+template<typename T>
+class SnapshotMytex
+{
+  class PublishLock;
+  class SnapshotLock;
+
+public:
+  using value_type = T;
+  using Guard = MytexGuard<T, PublishLock>;
+  using SharedGuard = MytexGuard<const T, SnapshotLock>;
+
+  /**
+   * @brief Construct the first value.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit SnapshotMytex(Args&&... initialize)
+    : mCurrent(std::make_shared<const T>(std::forward<Args>(initialize)...))
+  {
+  }
+
+  /**
+   * @brief Start a write. Other writers wait; readers don't.
+   *
+   * @returns A MytexGuard referencing a copy of the current value, which
+   *          replaces it when the guard is released.
+   */
+  Guard Lock()
+  {
+    std::unique_lock lock(mWriteMutex);
+    auto draft = std::make_unique<T>(*std::atomic_load(&mCurrent));
+    T* object = draft.get();
+    return { object, PublishLock(this, std::move(lock), std::move(draft)) };
+  }
+
+  /**
+   * @brief Take a snapshot of the current value. Never waits for writers.
+   *
+   * @returns A MytexGuard that keeps the snapshot alive while it exists. It may
+   *          be moved to and released on any thread.
+   */
+  SharedGuard LockShared() const
+  {
+    auto snapshot = std::atomic_load(&mCurrent);
+    const T* object = snapshot.get();
+    return { object, SnapshotLock(std::move(snapshot)) };
+  }
+
+  /**
+   * @brief Replace the value without copying the current one first. Waits for
+   * writers, but not for readers.
+   */
+  void Publish(T value)
+  {
+    std::lock_guard lock(mWriteMutex);
+    PublishLocked(std::make_unique<T>(std::move(value)));
+  }
+
+  /**
+   * @returns How many values have been published, including the first.
+   *
+   * This is a relaxed load, meant for cheaply noticing that something
+   * changed. Follow it with an acquire fence before calling LockShared() to be
+   * sure to get at least that version.
+   */
+  [[nodiscard]] std::uint64_t Version() const noexcept
+  {
+    return mVersion.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Make a view of something computed from the value, which is only
+   * recomputed after the value has changed.
+   *
+   * @param fn Takes a const T& and returns the derived value.
+   * @returns A DerivedView, which must not outlive this SnapshotMytex.
+   */
+  template<typename Fn>
+  DerivedView<SnapshotMytex, Fn> Derived(Fn fn) const
+  {
+    return { *this, std::move(fn) };
+  }
+
+private:
+  /** @brief Holds the write mutex and publishes the draft when released. */
+  class PublishLock
+  {
+  public:
+    PublishLock(SnapshotMytex* owner,
+                std::unique_lock<std::mutex> lock,
+                std::unique_ptr<T> draft)
+      : mOwner(owner)
+      , mLock(std::move(lock))
+      , mDraft(std::move(draft))
+    {
+    }
+    PublishLock(PublishLock&&) noexcept = default;
+    PublishLock& operator=(PublishLock&&) = delete;
+    ~PublishLock()
+    {
+      if (mDraft) {
+        mOwner->PublishLocked(std::move(mDraft));
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mLock.owns_lock(); }
+
+  private:
+    SnapshotMytex* mOwner;
+    std::unique_lock<std::mutex> mLock;
+    std::unique_ptr<T> mDraft;
+  };
+
+  /** @brief Keeps a snapshot alive for MytexGuard. */
+  class SnapshotLock
+  {
+  public:
+    explicit SnapshotLock(std::shared_ptr<const T> snapshot)
+      : mSnapshot(std::move(snapshot))
+    {
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept
+    {
+      return mSnapshot != nullptr;
+    }
+
+  private:
+    std::shared_ptr<const T> mSnapshot;
+  };
+
+  /** @brief Make @p draft the current value. Call with mWriteMutex held. */
+  void PublishLocked(std::unique_ptr<T> draft)
+  {
+    std::atomic_store(&mCurrent, std::shared_ptr<const T>(std::move(draft)));
+    mVersion.fetch_add(1, std::memory_order_release);
+  }
+
+  // Only replaced under mWriteMutex, read with std::atomic_load.
+  std::shared_ptr<const T> mCurrent;
+  std::atomic<std::uint64_t> mVersion{ 1 };
+  std::mutex mWriteMutex;
+};
+} // namespace baudvine
@@ -0,0 +1,66 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace baudvine::detail {
+/** @brief Tell the CPU we're in a spin loop, where that's supported. */
+inline void
+CpuRelax() noexcept
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief Exponential backoff for spin loops.
+ *
+ * Spins with CpuRelax() for a while and then starts yielding the thread, so a
+ * waiter never starves the thread it's waiting for when there are more
+ * runnable threads than cores.
+ */
+class SpinWait
+{
+public:
+  void operator()() noexcept
+  {
+    if (mSpins < kMaxSpins) {
+      for (std::uint32_t i = 0; i < (1U << mSpins); ++i) {
+        CpuRelax();
+      }
+      ++mSpins;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  void Reset() noexcept { mSpins = 0; }
+
+private:
+  static constexpr std::uint32_t kMaxSpins = 6;
+  std::uint32_t mSpins = 0;
+};
+} // namespace baudvine::detail
@@ -0,0 +1,364 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "spin_wait.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace baudvine {
+/**
+ * @brief Specialize as std::true_type for types that a Transaction should copy
+ * before locking them exclusively, so a rollback can restore them.
+ */
+template<typename T>
+struct EnableUndo : std::false_type
+{};
+
+/** @brief Thrown by Transaction when it has to abort to avoid a deadlock. */
+class TransactionAborted : public std::runtime_error
+{
+public:
+  TransactionAborted()
+    : std::runtime_error("baudvine: transaction aborted")
+  {
+  }
+};
+
+namespace detail {
+/** @brief Which transactions hold which Mytexes, for wait-die decisions. */
+class TransactionLockTable
+{
+public:
+  static constexpr std::uint64_t kNobody =
+    std::numeric_limits<std::uint64_t>::max();
+
+  static TransactionLockTable& Instance()
+  {
+    static TransactionLockTable table;
+    return table;
+  }
+
+  void Add(const void* lock, std::uint64_t timestamp)
+  {
+    auto& stripe = StripeOf(lock);
+    std::lock_guard guard(stripe.mutex);
+    stripe.holders.emplace(lock, timestamp);
+  }
+
+  void Remove(const void* lock, std::uint64_t timestamp)
+  {
+    auto& stripe = StripeOf(lock);
+    std::lock_guard guard(stripe.mutex);
+    auto [it, end] = stripe.holders.equal_range(lock);
+    for (; it != end; ++it) {
+      if (it->second == timestamp) {
+        stripe.holders.erase(it);
+        return;
+      }
+    }
+  }
+
+  /** @returns The timestamp of the oldest transaction holding @p lock. */
+  std::uint64_t OldestHolder(const void* lock)
+  {
+    auto& stripe = StripeOf(lock);
+    std::lock_guard guard(stripe.mutex);
+    auto oldest = kNobody;
+    auto [it, end] = stripe.holders.equal_range(lock);
+    for (; it != end; ++it) {
+      oldest = std::min(oldest, it->second);
+    }
+    return oldest;
+  }
+
+private:
+  static constexpr std::size_t kStripes = 64;
+
+  struct alignas(64) Stripe
+  {
+    std::mutex mutex;
+    std::unordered_multimap<const void*, std::uint64_t> holders;
+  };
+
+  TransactionLockTable() = default;
+
+  Stripe& StripeOf(const void* lock)
+  {
+    return mStripes[std::hash<const void*>()(lock) % kStripes];
+  }
+
+  std::array<Stripe, kStripes> mStripes;
+};
+
+inline std::uint64_t
+NextTransactionTimestamp()
+{
+  static std::atomic<std::uint64_t> next{ 0 };
+  return next.fetch_add(1, std::memory_order_relaxed);
+}
+} // namespace detail
+
+/**
+ * @brief Two-phase locking across any number of Mytexes.
+ *
+ * Lock() and LockShared() add Mytexes to the transaction one at a time, and
+ * they all stay locked until Commit() or Rollback(). Deadlocks are avoided
+ * with wait-die: when a Mytex is held by another transaction, an older
+ * transaction waits for it and a younger one throws TransactionAborted. Age
+ * is the timestamp a transaction was created with, and a transaction that's
+ * retried with the same timestamp (see RunTransaction()) eventually becomes
+ * the oldest and can't be aborted anymore.
+ *
+ * Rolling back undoes changes to Mytexes whose type has EnableUndo, and runs
+ * the callbacks registered with OnRollback() in reverse order.
+ *
+ * Holders that aren't transactions are simply waited for.
+ */
+class Transaction
+{
+public:
+  /** @brief Start a transaction with a new timestamp. */
+  Transaction()
+    : Transaction(detail::NextTransactionTimestamp())
+  {
+  }
+
+  /** @brief Start a transaction with @p timestamp, e.g. to retry one. */
+  explicit Transaction(std::uint64_t timestamp)
+    : mTimestamp(timestamp)
+  {
+  }
+
+  Transaction(const Transaction&) = delete;
+  Transaction& operator=(const Transaction&) = delete;
+  ~Transaction() { Rollback(); }
+
+  /** @returns The timestamp that decides who waits for whom. */
+  [[nodiscard]] std::uint64_t Timestamp() const noexcept { return mTimestamp; }
+
+  /**
+   * @brief Lock @p mytex exclusively until the transaction ends.
+   *
+   * @returns The guarded object.
+   * @throws TransactionAborted when a younger transaction would have to wait
+   *         for an older one.
+   * @throws std::logic_error when @p mytex is already locked in shared mode by
+   *         this transaction.
+   */
+  template<typename T, typename Lockable>
+  T& Lock(Mytex<T, Lockable>& mytex)
+  {
+    if (auto* held = Find(&mytex)) {
+      if (!held->exclusive) {
+        throw std::logic_error("baudvine: can't upgrade a transaction's lock");
+      }
+      return *static_cast<T*>(held->object);
+    }
+
+    auto guard = Acquire(&mytex, [&mytex] { return mytex.TryLock(); });
+    T& object = *guard;
+    auto held = std::make_unique<Held<decltype(guard)>>(
+      &mytex, &object, true, std::move(guard));
+    if constexpr (EnableUndo<T>::value) {
+      T before = object;
+      held->undo = [&object, before = std::move(before)]() mutable {
+        object = std::move(before);
+      };
+    }
+    Keep(std::move(held));
+    return object;
+  }
+
+  /**
+   * @brief Lock @p mytex in shared mode until the transaction ends.
+   *
+   * @returns The guarded object.
+   * @throws TransactionAborted when a younger transaction would have to wait
+   *         for an older one.
+   */
+  template<typename T, typename Lockable>
+  const T& LockShared(const Mytex<T, Lockable>& mytex)
+  {
+    if (auto* held = Find(&mytex)) {
+      return *static_cast<const T*>(held->object);
+    }
+
+    auto guard = Acquire(&mytex, [&mytex] { return mytex.TryLockShared(); });
+    const T& object = *guard;
+    Keep(std::make_unique<Held<decltype(guard)>>(
+      &mytex, const_cast<T*>(&object), false, std::move(guard)));
+    return object;
+  }
+
+  /** @brief Call @p undo if the transaction is rolled back. */
+  void OnRollback(std::function<void()> undo)
+  {
+    mUndo.push_back(std::move(undo));
+  }
+
+  /** @brief Keep all changes and release every lock. */
+  void Commit()
+  {
+    mUndo.clear();
+    for (auto& held : mHeld) {
+      held->undo = nullptr;
+    }
+    Release();
+  }
+
+  /** @brief Undo what can be undone and release every lock. */
+  void Rollback()
+  {
+    for (auto it = mUndo.rbegin(); it != mUndo.rend(); ++it) {
+      (*it)();
+    }
+    mUndo.clear();
+    for (auto it = mHeld.rbegin(); it != mHeld.rend(); ++it) {
+      if ((*it)->undo) {
+        (*it)->undo();
+      }
+    }
+    Release();
+  }
+
+private:
+  struct HeldBase
+  {
+    HeldBase(const void* lock, void* object, bool exclusive)
+      : lock(lock)
+      , object(object)
+      , exclusive(exclusive)
+    {
+    }
+    HeldBase(const HeldBase&) = delete;
+    HeldBase& operator=(const HeldBase&) = delete;
+    virtual ~HeldBase() = default;
+
+    const void* lock;
+    void* object;
+    bool exclusive;
+    std::function<void()> undo;
+  };
+
+  template<typename Guard>
+  struct Held : HeldBase
+  {
+    Held(const void* lock, void* object, bool exclusive, Guard acquired)
+      : HeldBase(lock, object, exclusive)
+      , guard(std::move(acquired))
+    {
+    }
+
+    Guard guard;
+  };
+
+  HeldBase* Find(const void* lock)
+  {
+    for (auto& held : mHeld) {
+      if (held->lock == lock) {
+        return held.get();
+      }
+    }
+    return nullptr;
+  }
+
+  void Keep(std::unique_ptr<HeldBase> held)
+  {
+    detail::TransactionLockTable::Instance().Add(held->lock, mTimestamp);
+    mHeld.push_back(std::move(held));
+  }
+
+  /** @brief Try to lock until it works, or until wait-die says to give up. */
+  template<typename TryLock>
+  auto Acquire(const void* lock, TryLock&& tryLock)
+  {
+    detail::SpinWait wait;
+    for (;;) {
+      if (auto guard = tryLock()) {
+        return guard;
+      }
+      const auto holder =
+        detail::TransactionLockTable::Instance().OldestHolder(lock);
+      if (holder != detail::TransactionLockTable::kNobody &&
+          holder < mTimestamp) {
+        throw TransactionAborted();
+      }
+      wait();
+    }
+  }
+
+  void Release()
+  {
+    auto& table = detail::TransactionLockTable::Instance();
+    while (!mHeld.empty()) {
+      table.Remove(mHeld.back()->lock, mTimestamp);
+      mHeld.pop_back();
+    }
+  }
+
+  std::uint64_t mTimestamp;
+  std::vector<std::unique_ptr<HeldBase>> mHeld;
+  std::vector<std::function<void()>> mUndo;
+};
+
+/**
+ * @brief Run @p fn in a Transaction and commit it, retrying with the same
+ * timestamp for as long as it's aborted.
+ *
+ * Other exceptions roll the transaction back and are passed on.
+ *
+ * @param fn A function taking Transaction&. It may run more than once.
+ * @returns Whatever @p fn returned the time it went through.
+ */
+template<typename Fn>
+decltype(auto)
+RunTransaction(Fn&& fn)
+{
+  const auto timestamp = detail::NextTransactionTimestamp();
+  detail::SpinWait backoff;
+  for (;;) {
+    Transaction transaction(timestamp);
+    try {
+      if constexpr (std::is_void_v<std::invoke_result_t<Fn&, Transaction&>>) {
+        fn(transaction);
+        transaction.Commit();
+        return;
+      } else {
+        auto result = fn(transaction);
+        transaction.Commit();
+        return result;
+      }
+    } catch (const TransactionAborted&) {
+      transaction.Rollback();
+      backoff();
+    }
+  }
+}
+} // namespace baudvine
@@ -0,0 +1,261 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "spin_wait.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace baudvine {
+namespace detail {
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) &&
+                std::atomic<std::uint32_t>::is_always_lock_free,
+              "futex words must be plain 32-bit integers");
+
+/**
+ * @brief Sleep until woken if @p word still holds @p expected. May return
+ * spuriously. Elsewhere than on Linux, this just yields.
+ */
+inline void
+FutexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept
+{
+#if defined(__linux__)
+  syscall(SYS_futex,
+          reinterpret_cast<std::uint32_t*>(&word),
+          FUTEX_WAIT_PRIVATE,
+          expected,
+          nullptr,
+          nullptr,
+          0);
+#else
+  (void)word;
+  (void)expected;
+  std::this_thread::yield();
+#endif
+}
+
+/** @brief Wake up to @p count threads sleeping in FutexWait() on @p word. */
+inline void
+FutexWake(std::atomic<std::uint32_t>& word, int count) noexcept
+{
+#if defined(__linux__)
+  syscall(SYS_futex,
+          reinterpret_cast<std::uint32_t*>(&word),
+          FUTEX_WAKE_PRIVATE,
+          count,
+          nullptr,
+          nullptr,
+          0);
+#else
+  (void)word;
+  (void)count;
+#endif
+}
+} // namespace detail
+
+/**
+ * @brief A mutex that any thread may unlock, not just the one that locked it.
+ *
+ * std::mutex and std::shared_mutex make unlocking on another thread undefined
+ * behaviour, so their guards can't be passed between threads. This mutex
+ * doesn't track its owner at all. It's a single futex word, like a binary
+ * semaphore, so a guard from Mytex<T, TransferableMutex> can be moved down a
+ * pipeline of threads and released by the last one.
+ *
+ * Because nobody owns it, locking it twice on one thread deadlocks rather than
+ * being diagnosed, and unlocking it when it isn't locked breaks it.
+ */
+class TransferableMutex
+{
+public:
+  TransferableMutex() = default;
+  TransferableMutex(const TransferableMutex&) = delete;
+  TransferableMutex& operator=(const TransferableMutex&) = delete;
+
+  void lock() noexcept
+  {
+    if (try_lock()) {
+      return;
+    }
+    detail::SpinWait spin;
+    for (int i = 0; i < kSpins; ++i) {
+      spin();
+      if (try_lock()) {
+        return;
+      }
+    }
+    // Mark the lock contended, so whoever unlocks it wakes someone up.
+    while (mWord.exchange(kContended, std::memory_order_acquire) != kFree) {
+      detail::FutexWait(mWord, kContended);
+    }
+  }
+
+  bool try_lock() noexcept
+  {
+    auto expected = kFree;
+    return mWord.compare_exchange_strong(
+      expected, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
+  void unlock() noexcept
+  {
+    if (mWord.exchange(kFree, std::memory_order_release) == kContended) {
+      detail::FutexWake(mWord, 1);
+    }
+  }
+
+private:
+  static constexpr std::uint32_t kFree = 0;
+  static constexpr std::uint32_t kLocked = 1;
+  static constexpr std::uint32_t kContended = 2;
+  static constexpr int kSpins = 6;
+
+  std::atomic<std::uint32_t> mWord{ kFree };
+};
+
+/**
+ * @brief A shared mutex that any thread may unlock, like TransferableMutex.
+ *
+ * Exclusive and shared guards from Mytex<T, TransferableSharedMutex> can both
+ * be released on another thread. Readers that arrive while a writer waits
+ * still get in, so a steady stream of them can keep the writer waiting.
+ */
+class TransferableSharedMutex
+{
+public:
+  TransferableSharedMutex() = default;
+  TransferableSharedMutex(const TransferableSharedMutex&) = delete;
+  TransferableSharedMutex& operator=(const TransferableSharedMutex&) = delete;
+
+  void lock() noexcept
+  {
+    Acquire([](std::uint32_t word) {
+      return (word & ~kWaiting) == 0 ? word | kWriter : kBlocked;
+    });
+  }
+
+  bool try_lock() noexcept
+  {
+    auto word = mWord.load(std::memory_order_relaxed);
+    while ((word & ~kWaiting) == 0) {
+      if (mWord.compare_exchange_weak(word,
+                                      word | kWriter,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void unlock() noexcept
+  {
+    if ((mWord.exchange(0, std::memory_order_release) & kWaiting) != 0) {
+      detail::FutexWake(mWord, INT_MAX);
+    }
+  }
+
+  void lock_shared() noexcept
+  {
+    Acquire([](std::uint32_t word) {
+      return (word & kWriter) == 0 ? word + 1 : kBlocked;
+    });
+  }
+
+  bool try_lock_shared() noexcept
+  {
+    auto word = mWord.load(std::memory_order_relaxed);
+    while ((word & kWriter) == 0) {
+      if (mWord.compare_exchange_weak(word,
+                                      word + 1,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void unlock_shared() noexcept
+  {
+    const auto previous = mWord.fetch_sub(1, std::memory_order_release);
+    if (previous == (kWaiting | 1)) {
+      // Last reader out, and a writer is waiting. Waiters that weren't let in
+      // set kWaiting again before going back to sleep.
+      mWord.fetch_and(~kWaiting, std::memory_order_relaxed);
+      detail::FutexWake(mWord, INT_MAX);
+    }
+  }
+
+private:
+  // The rest of the word counts readers.
+  static constexpr std::uint32_t kWriter = 1U << 31;
+  static constexpr std::uint32_t kWaiting = 1U << 30;
+  // Never a valid state, so Acquire()'s transition can return it to say "no".
+  static constexpr std::uint32_t kBlocked = ~std::uint32_t{ 0 };
+  static constexpr int kSpins = 6;
+
+  /**
+   * @brief Apply @p next to the word once it allows it, sleeping in between.
+   *
+   * @param next Maps the current word to the locked one, or to kBlocked.
+   */
+  template<typename Next>
+  void Acquire(Next next) noexcept
+  {
+    detail::SpinWait spin;
+    int spins = 0;
+    auto word = mWord.load(std::memory_order_relaxed);
+    for (;;) {
+      const auto locked = next(word);
+      if (locked != kBlocked) {
+        if (mWord.compare_exchange_weak(word,
+                                        locked,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed)) {
+          return;
+        }
+        continue;
+      }
+      if (spins < kSpins) {
+        ++spins;
+        spin();
+        word = mWord.load(std::memory_order_relaxed);
+        continue;
+      }
+      // Ask to be woken, and sleep unless something changed meanwhile.
+      if ((word & kWaiting) != 0 ||
+          mWord.compare_exchange_weak(word,
+                                      word | kWaiting,
+                                      std::memory_order_relaxed,
+                                      std::memory_order_relaxed)) {
+        detail::FutexWait(mWord, word | kWaiting);
+        word = mWord.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::atomic<std::uint32_t> mWord{ 0 };
+};
+} // namespace baudvine
@@ -0,0 +1,197 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "spin_wait.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace baudvine {
+/**
+ * @brief A trivially copyable value that optimistic readers may read while a
+ * writer changes it.
+ *
+ * The value is kept as machine words that are loaded and stored with relaxed
+ * atomics, like the data in a seqlock. A Load() that races with a Store() may
+ * return a mix of old and new words, which VersionLock::Validate() then
+ * rejects. Copying one cell to another loads and stores, so arrays of cells
+ * can be shifted around with std::copy under an exclusive lock.
+ */
+template<typename T>
+class OptimisticCell
+{
+  static_assert(std::is_trivially_copyable_v<T> &&
+                  std::is_default_constructible_v<T>,
+                "Cells are copied word by word");
+
+public:
+  OptimisticCell() noexcept
+    : OptimisticCell(T{})
+  {
+  }
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  OptimisticCell(const T& value) noexcept { Store(value); }
+  OptimisticCell(const OptimisticCell& other) noexcept
+    : OptimisticCell(other.Load())
+  {
+  }
+  OptimisticCell& operator=(const OptimisticCell& other) noexcept
+  {
+    Store(other.Load());
+    return *this;
+  }
+  OptimisticCell& operator=(const T& value) noexcept
+  {
+    Store(value);
+    return *this;
+  }
+  ~OptimisticCell() = default;
+
+  [[nodiscard]] T Load() const noexcept
+  {
+    Word words[kWords];
+    for (std::size_t i = 0; i < kWords; ++i) {
+      words[i] = mWords[i].load(std::memory_order_relaxed);
+    }
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+  void Store(const T& value) noexcept
+  {
+    Word words[kWords] = {};
+    std::memcpy(words, &value, sizeof(T));
+    for (std::size_t i = 0; i < kWords; ++i) {
+      mWords[i].store(words[i], std::memory_order_relaxed);
+    }
+  }
+
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  operator T() const noexcept { return Load(); }
+
+private:
+  using Word = std::uintptr_t;
+  static constexpr std::size_t kWords =
+    (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+  std::atomic<Word> mWords[kWords];
+};
+
+/**
+ * @brief A Lockable with a version counter for optimistic reads.
+ *
+ * This is the lock used by optimistic lock coupling (OLC): the lowest bit of
+ * the counter is the lock bit, and every unlock() moves the counter to the
+ * next even number. Readers don't lock at all. They remember the version with
+ * ReadVersion(), read the protected data, and then check with Validate() that
+ * no writer got in between. If one did, whatever they read must be discarded
+ * and the read restarted.
+ *
+ * Mytex<T, VersionLock> exposes this as Mytex::LockOptimistic() and
+ * Mytex::TryUpgrade().
+ *
+ * Optimistic readers can observe data while it's being written. Everything
+ * they read must therefore be atomic, or the read is a data race even if its
+ * result is discarded later: use std::atomic with relaxed loads and stores,
+ * or OptimisticCell for trivially copyable values. Pointers must only be
+ * followed after validating them.
+ */
+class VersionLock
+{
+public:
+  VersionLock() = default;
+  VersionLock(const VersionLock&) = delete;
+  VersionLock& operator=(const VersionLock&) = delete;
+  VersionLock(VersionLock&&) = delete;
+  VersionLock& operator=(VersionLock&&) = delete;
+  ~VersionLock() = default;
+
+  void lock()
+  {
+    detail::SpinWait spin;
+    while (!TryUpgrade(ReadVersion())) {
+      spin();
+    }
+  }
+
+  bool try_lock()
+  {
+    return TryUpgrade(mVersion.load(std::memory_order_relaxed));
+  }
+
+  void unlock()
+  {
+    mVersion.store(mVersion.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+  /**
+   * @brief Start an optimistic read, waiting for a writer if there is one.
+   *
+   * @returns The current (even) version.
+   */
+  [[nodiscard]] std::uint64_t ReadVersion() const noexcept
+  {
+    detail::SpinWait spin;
+    auto version = mVersion.load(std::memory_order_acquire);
+    while ((version & kLocked) != 0) {
+      spin();
+      version = mVersion.load(std::memory_order_acquire);
+    }
+    return version;
+  }
+
+  /**
+   * @returns Whether the lock is still at @p version, so everything read
+   *          since ReadVersion() returned it is consistent.
+   */
+  [[nodiscard]] bool Validate(std::uint64_t version) const noexcept
+  {
+    // Keeps the reads of the protected data from moving past the check.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return mVersion.load(std::memory_order_relaxed) == version;
+  }
+
+  /**
+   * @brief Lock, but only if nothing has changed since @p version.
+   *
+   * @returns Whether the lock is now held.
+   */
+  bool TryUpgrade(std::uint64_t version) noexcept
+  {
+    if ((version & kLocked) != 0 ||
+        !mVersion.compare_exchange_strong(version,
+                                          version | kLocked,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed)) {
+      return false;
+    }
+    // Keeps the writes to the protected data from becoming visible before
+    // the lock bit.
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+private:
+  static constexpr std::uint64_t kLocked = 1;
+
+  std::atomic<std::uint64_t> mVersion{ 0 };
+};
+} // namespace baudvine
@@ -0,0 +1,273 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "derived_view.h"
+#include "mvcc.h"
+#include "mytex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <tuple>
+#include <utility>
+
+namespace baudvine {
+namespace detail {
+/** @returns The number of Snapshot() calls in progress. */
+inline std::atomic<std::uint32_t>&
+ActiveSnapshots()
+{
+  static std::atomic<std::uint32_t> active{ 0 };
+  return active;
+}
+} // namespace detail
+
+/**
+ * @brief A Mytex whose writes are stamped with the global MVCC clock, so that
+ * Snapshot() can read several of them at one consistent point.
+ *
+ * Lock() and LockShared() work like they do for Mytex, and the object is
+ * modified in place. What's added is that every write is stamped when its
+ * guard is released, and that while a Snapshot() is in progress, writers save
+ * the value they're about to overwrite. A snapshot that finds an object was
+ * written after its timestamp reads the saved value instead. It only has to
+ * start over when a write that began before the snapshot did, and so didn't
+ * save anything, finished after the snapshot's timestamp.
+ *
+ * Saved values are dropped by later writers once no snapshot needs them.
+ *
+ * Writes are also counted in Version(), so Derived() can cache something
+ * computed from the object until the next write.
+ */
+template<typename T, typename Lockable = std::shared_mutex>
+class VersionedMytex
+{
+  class CommitLock;
+
+public:
+  using value_type = T;
+  using SharedLock = std::shared_lock<Lockable>;
+  using Guard = MytexGuard<T, CommitLock>;
+  using SharedGuard = MytexGuard<const T, SharedLock>;
+
+  /**
+   * @brief Construct the guarded object. Its first value is visible at every
+   * timestamp.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit VersionedMytex(Args&&... initialize)
+    : mObject(std::forward<Args>(initialize)...)
+  {
+  }
+
+  /**
+   * @brief Lock in exclusive mode.
+   *
+   * @returns A MytexGuard referencing the object. The write is stamped when
+   *          the guard is released.
+   */
+  Guard Lock()
+  {
+    std::unique_lock lock(mMutex);
+    const bool saved =
+      detail::ActiveSnapshots().load(std::memory_order_seq_cst) != 0;
+    if (saved) {
+      mHistory.emplace_front(mStamp, mObject);
+    }
+    return { &mObject, CommitLock(this, std::move(lock), saved) };
+  }
+
+  /**
+   * @brief Lock in shared mode.
+   *
+   * @returns A MytexGuard with a const reference to the object.
+   */
+  SharedGuard LockShared() const { return { &mObject, SharedLock(mMutex) }; }
+
+  /**
+   * @brief Read the object as it was at @p snapshot.
+   *
+   * Takes the lock in shared mode, so it waits for a writer that's busy.
+   *
+   * @returns A copy of the value at @p snapshot, or nothing if that value was
+   *          overwritten without being saved. Retry at a newer snapshot then.
+   */
+  std::optional<T> ReadAt(const MvccSnapshot& snapshot) const
+  {
+    std::shared_lock lock(mMutex);
+    const auto timestamp = snapshot.Timestamp();
+    if (mStamp <= timestamp) {
+      return mObject;
+    }
+    if (mUnsaved > timestamp) {
+      return {};
+    }
+    for (const auto& [stamp, value] : mHistory) {
+      if (stamp <= timestamp) {
+        return value;
+      }
+    }
+    return {};
+  }
+
+  /**
+   * @returns How many writes have been committed, plus one for the initial
+   *          value.
+   *
+   * This is a relaxed load, meant for cheaply noticing that something
+   * changed. Follow it with an acquire fence before calling LockShared() to be
+   * sure to see at least that version.
+   */
+  [[nodiscard]] std::uint64_t Version() const noexcept
+  {
+    return mVersion.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Make a view of something computed from the object, which is only
+   * recomputed after it has been written to.
+   *
+   * The view computes under LockShared(), so writers wait for a computation
+   * that's in progress, but the object isn't copied.
+   *
+   * @param fn Takes a const T& and returns the derived value.
+   * @returns A DerivedView, which must not outlive this VersionedMytex.
+   */
+  template<typename Fn>
+  DerivedView<VersionedMytex, Fn> Derived(Fn fn) const
+  {
+    return { *this, std::move(fn) };
+  }
+
+private:
+  /** @brief Holds the lock and stamps the write when released. */
+  class CommitLock
+  {
+  public:
+    CommitLock(VersionedMytex* owner,
+               std::unique_lock<Lockable> lock,
+               bool saved)
+      : mOwner(owner)
+      , mLock(std::move(lock))
+      , mSaved(saved)
+    {
+    }
+    CommitLock(CommitLock&& other) noexcept
+      : mOwner(std::exchange(other.mOwner, nullptr))
+      , mLock(std::move(other.mLock))
+      , mSaved(other.mSaved)
+    {
+    }
+    CommitLock& operator=(CommitLock&&) = delete;
+    ~CommitLock()
+    {
+      if (mOwner != nullptr) {
+        mOwner->Commit(mSaved);
+      }
+    }
+
+    [[nodiscard]] bool owns_lock() const noexcept { return mLock.owns_lock(); }
+
+  private:
+    VersionedMytex* mOwner;
+    std::unique_lock<Lockable> mLock;
+    bool mSaved;
+  };
+
+  /** @brief Stamp the write that's finishing. Call with the lock held. */
+  void Commit(bool saved)
+  {
+    // Before unlocking, so whoever sees the new version and then locks sees
+    // the write.
+    mVersion.fetch_add(1, std::memory_order_release);
+    detail::MvccClock::Instance().Commit([&](std::uint64_t stamp) {
+      mStamp = stamp;
+      if (!saved) {
+        mUnsaved = stamp;
+      }
+    });
+
+    if (detail::ActiveSnapshots().load(std::memory_order_seq_cst) == 0) {
+      mHistory.clear();
+      return;
+    }
+    // Keep what the oldest snapshot reads, and everything newer.
+    const auto oldest = detail::MvccClock::Instance().OldestPinned();
+    for (auto it = mHistory.begin(); it != mHistory.end(); ++it) {
+      if (it->first <= oldest) {
+        mHistory.erase(std::next(it), mHistory.end());
+        break;
+      }
+    }
+  }
+
+  T mObject;
+  mutable Lockable mMutex;
+  // Protected by mMutex
+  std::uint64_t mStamp = 0;
+  // The stamp of the newest write that didn't save what it overwrote.
+  std::uint64_t mUnsaved = 0;
+  // Overwritten values with their stamps, newest first.
+  std::deque<std::pair<std::uint64_t, T>> mHistory;
+  std::atomic<std::uint64_t> mVersion{ 1 };
+};
+
+/**
+ * @brief Read several VersionedMytexes (or MvccMytexes) at a single point in
+ * time.
+ *
+ * None of them is locked exclusively, and at most one is locked in shared
+ * mode at any time, so writers are held up no more than by a single reader.
+ *
+ * @returns A tuple of copies of the objects.
+ */
+template<typename... Mytexes>
+std::tuple<typename Mytexes::value_type...>
+Snapshot(const Mytexes&... mytexes)
+{
+  struct Active
+  {
+    Active() { detail::ActiveSnapshots().fetch_add(1); }
+    Active(const Active&) = delete;
+    Active& operator=(const Active&) = delete;
+    ~Active() { detail::ActiveSnapshots().fetch_sub(1); }
+  } active;
+
+  for (;;) {
+    const MvccSnapshot at;
+    // Braced initialization evaluates left to right.
+    std::tuple<std::optional<typename Mytexes::value_type>...> values{
+      mytexes.ReadAt(at)...
+    };
+    const bool complete = std::apply(
+      [](const auto&... value) { return (value.has_value() && ...); },
+      values);
+    if (complete) {
+      return std::apply(
+        [](auto&... value) {
+          return std::tuple<typename Mytexes::value_type...>{ std::move(
+            *value)... };
+        },
+        values);
+    }
+  }
+}
+} // namespace baudvine
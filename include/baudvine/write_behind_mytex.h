@@ -0,0 +1,189 @@
+// Copyright 2022 Dominic van Berkel <dominic@baudvine.net>
+
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "mytex.h"
+#include "per_thread.h"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <shared_mutex>
+#include <utility>
+
+namespace baudvine {
+/** @brief Tag for WriteBehindMytex::LockShared() to apply deferred writes. */
+struct FlushFirst
+{};
+inline constexpr FlushFirst kFlushFirst{};
+
+/**
+ * @brief A Mytex that can also be written to without locking, for updates
+ * whose order doesn't matter.
+ *
+ * Defer() appends an operation to a log that belongs to the calling thread,
+ * which takes an allocation and a compare-and-swap that only ever competes
+ * with a flush. The operations are applied in bulk by the next Lock() or
+ * Flush(), whichever thread calls it. Operations from one thread are applied
+ * in the order they were deferred, but there's no order between threads, so
+ * this is for commutative updates like counters, set insertions and maxima.
+ *
+ * LockShared() doesn't apply anything by default, so readers may not see
+ * deferred writes yet. LockShared(kFlushFirst) does, which makes sure a
+ * thread reads its own writes.
+ *
+ * Deferred operations must not throw.
+ */
+template<typename T, typename Lockable = std::shared_mutex>
+class WriteBehindMytex
+{
+public:
+  using value_type = T;
+  using Operation = std::function<void(T&)>;
+  using Guard = typename Mytex<T, Lockable>::Guard;
+  using SharedGuard = typename Mytex<T, Lockable>::SharedGuard;
+
+  /**
+   * @brief Construct the guarded object.
+   *
+   * @param initialize Constructor parameters for T.
+   */
+  template<typename... Args>
+  explicit WriteBehindMytex(Args&&... initialize)
+    : mMytex(std::forward<Args>(initialize)...)
+  {
+  }
+  WriteBehindMytex(const WriteBehindMytex&) = delete;
+  WriteBehindMytex& operator=(const WriteBehindMytex&) = delete;
+  ~WriteBehindMytex()
+  {
+    mLogs.ForEach([](Log& log) {
+      Free(log.head.exchange(nullptr, std::memory_order_acquire));
+    });
+  }
+
+  /**
+   * @brief Lock in exclusive mode, after applying every deferred operation.
+   *
+   * @returns A MytexGuard referencing the object.
+   */
+  Guard Lock()
+  {
+    auto guard = mMytex.Lock();
+    Apply(*guard);
+    return guard;
+  }
+
+  /**
+   * @brief Lock in shared mode. Operations that are still deferred aren't
+   * reflected.
+   *
+   * @returns A MytexGuard with a const reference to the object.
+   */
+  SharedGuard LockShared() const { return mMytex.LockShared(); }
+
+  /**
+   * @brief Apply every deferred operation, then lock in shared mode.
+   *
+   * @returns A MytexGuard with a const reference to the object, which
+   *          reflects at least the calling thread's deferred operations.
+   */
+  SharedGuard LockShared(FlushFirst /*flush*/)
+  {
+    Flush();
+    return mMytex.LockShared();
+  }
+
+  /**
+   * @brief Apply @p operation to the object some time before the next
+   * Lock() returns. Doesn't wait for the lock.
+   */
+  void Defer(Operation operation)
+  {
+    auto* node = new Node{ std::move(operation), nullptr };
+    auto& log = mLogs.Local();
+    // Count it before publishing, or Apply() could take it and subtract first.
+    mPending.fetch_add(1, std::memory_order_relaxed);
+    node->next = log.head.load(std::memory_order_relaxed);
+    while (!log.head.compare_exchange_weak(node->next,
+                                           node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+  }
+
+  /** @brief Apply every deferred operation now, if there are any. */
+  void Flush()
+  {
+    if (mPending.load(std::memory_order_acquire) != 0) {
+      auto guard = mMytex.Lock();
+      Apply(*guard);
+    }
+  }
+
+  /** @returns Roughly how many operations are waiting to be applied. */
+  [[nodiscard]] std::size_t Pending() const noexcept
+  {
+    return mPending.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Node
+  {
+    Operation operation;
+    Node* next;
+  };
+
+  struct Log
+  {
+    // Newest first. Pushed to by the owning thread, taken by whoever applies.
+    std::atomic<Node*> head{ nullptr };
+  };
+
+  /** @brief Apply all logs to @p object. Call with the lock held. */
+  void Apply(T& object)
+  {
+    if (mPending.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+    std::size_t applied = 0;
+    mLogs.ForEach([&object, &applied](Log& log) {
+      Node* newest = log.head.exchange(nullptr, std::memory_order_acquire);
+      // Reverse to apply in the order they were deferred.
+      Node* oldest = nullptr;
+      while (newest != nullptr) {
+        oldest = std::exchange(newest, std::exchange(newest->next, oldest));
+      }
+      while (oldest != nullptr) {
+        oldest->operation(object);
+        delete std::exchange(oldest, oldest->next);
+        ++applied;
+      }
+    });
+    mPending.fetch_sub(applied, std::memory_order_relaxed);
+  }
+
+  static void Free(Node* node)
+  {
+    while (node != nullptr) {
+      delete std::exchange(node, node->next);
+    }
+  }
+
+  Mytex<T, Lockable> mMytex;
+  detail::PerThread<Log> mLogs;
+  std::atomic<std::size_t> mPending{ 0 };
+};
+} // namespace baudvine
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "baudvine/executor.h"
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+// An Executor that queues tasks until the test runs them.
+class ManualExecutor
+{
+public:
+  baudvine::Executor Get()
+  {
+    return [this](std::function<void()> task) {
+      std::lock_guard lock(mMutex);
+      mTasks.push_back(std::move(task));
+    };
+  }
+
+  // Runs the oldest task, returning false if there were none.
+  bool RunOne()
+  {
+    std::function<void()> task;
+    {
+      std::lock_guard lock(mMutex);
+      if (mTasks.empty()) {
+        return false;
+      }
+      task = std::move(mTasks.front());
+      mTasks.pop_front();
+    }
+    task();
+    return true;
+  }
+
+  // Runs tasks until there are none left, including ones queued meanwhile.
+  std::size_t RunAll()
+  {
+    std::size_t count = 0;
+    while (RunOne()) {
+      ++count;
+    }
+    return count;
+  }
+
+private:
+  std::mutex mMutex;
+  std::deque<std::function<void()>> mTasks;
+};
@@ -0,0 +1,141 @@
+#include "baudvine/adaptive_sharded_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+using Counters = baudvine::AdaptiveShardedMytex<std::unordered_map<int, int>>;
+
+// Lock @p key while another thread is holding it, so that the lock waits.
+template<typename Sharded>
+void
+LockContended(Sharded& sharded, int key)
+{
+  std::thread waiter;
+  {
+    auto held = sharded.Lock(key);
+    waiter = std::thread([&sharded, key] { sharded.Lock(key); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  waiter.join();
+}
+
+template<typename Sharded>
+void
+ExpectCounters(const Sharded& sharded, int keys, int value)
+{
+  for (int key = 0; key < keys; ++key) {
+    auto shard = sharded.LockShared(key);
+    const auto it = shard->find(key);
+    ASSERT_NE(it, shard->end()) << key;
+    EXPECT_EQ(it->second, value) << key;
+  }
+}
+} // namespace
+
+TEST(AdaptiveShardedMytex, Basics)
+{
+  baudvine::AdaptiveShardedMytex<std::map<std::string, int>> underTest;
+  EXPECT_EQ(underTest.ShardCount(), 1);
+  underTest.Lock("a")->emplace("a", 1);
+  underTest.Lock("b")->emplace("b", 2);
+  EXPECT_EQ(underTest.LockShared("a")->at("a"), 1);
+  EXPECT_EQ(underTest.LockShared("b")->count("c"), 0);
+  EXPECT_EQ(underTest.Size(), 2);
+  underTest.Lock("a")->erase("a");
+  EXPECT_EQ(underTest.Size(), 1);
+}
+
+TEST(AdaptiveShardedMytex, Sets)
+{
+  baudvine::AdaptiveShardedMytex<std::set<int>> underTest;
+  underTest.Lock(3)->insert(3);
+  EXPECT_EQ(underTest.LockShared(3)->count(3), 1);
+}
+
+TEST(AdaptiveShardedMytex, SplitsAndMerges)
+{
+  static constexpr int kKeys = 200;
+  baudvine::AdaptiveShardingOptions options;
+  options.window = 4;
+  options.sustain = 2;
+  options.splitAbove = 0.2;
+  options.mergeBelow = 0.1;
+  options.migrateBatch = 4;
+  Counters underTest(options);
+  for (int key = 0; key < kKeys; ++key) {
+    underTest.Lock(key)->emplace(key, key);
+  }
+
+  for (int i = 0; i < 100 && underTest.ShardCount() == 1; ++i) {
+    LockContended(underTest, i % kKeys);
+  }
+  EXPECT_GT(underTest.ShardCount(), 1);
+
+  // Every key can be found while it's being moved around.
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_EQ(underTest.LockShared(key)->at(key), key);
+    EXPECT_EQ(underTest.Lock(key)->at(key), key);
+  }
+  EXPECT_EQ(underTest.Size(), kKeys);
+
+  // Without contention it shrinks back down.
+  for (int i = 0; i < 10000 && underTest.ShardCount() > 1; ++i) {
+    underTest.Lock(i % kKeys);
+  }
+  EXPECT_EQ(underTest.ShardCount(), 1);
+  for (int i = 0; i < kKeys; ++i) {
+    underTest.Lock(i);
+  }
+  EXPECT_EQ(underTest.Size(), kKeys);
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_EQ(underTest.LockShared(key)->at(key), key);
+  }
+}
+
+TEST(AdaptiveShardedMytex, ConcurrentResizing)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kKeys = 64;
+  static constexpr int kRounds = 500;
+  // Resize at the slightest provocation.
+  baudvine::AdaptiveShardingOptions options;
+  options.window = 8;
+  options.sustain = 1;
+  options.splitAbove = 0.0;
+  options.mergeBelow = 0.01;
+  options.maxShards = 8;
+  options.migrateBatch = 2;
+  Counters underTest(options);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&underTest, t] {
+      for (int round = 0; round < kRounds; ++round) {
+        for (int key = 0; key < kKeys; ++key) {
+          ++(*underTest.Lock(key))[key];
+          if ((key + t) % 8 == 0) {
+            const auto shard = underTest.LockShared(key);
+            EXPECT_EQ(shard->count(key), 1);
+          }
+        }
+        if (round % 50 == t) {
+          LockContended(underTest, round % kKeys);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  ExpectCounters(underTest, kKeys, kThreads * kRounds);
+  EXPECT_EQ(underTest.Size(), kKeys);
+}
@@ -0,0 +1,209 @@
+#include "baudvine/adaptive_shared_mutex.h"
+#include "baudvine/mytex.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+using Protocol = baudvine::AdaptiveSharedMutex::Protocol;
+
+namespace {
+// Switch as soon as the ratio says so.
+baudvine::AdaptiveLockPolicy
+EagerPolicy()
+{
+  baudvine::AdaptiveLockPolicy policy;
+  policy.window = 16;
+  policy.sampleEvery = 4;
+  policy.waitedAbove = 0.0;
+  policy.minHold = {};
+  return policy;
+}
+} // namespace
+
+TEST(AdaptiveSharedMutex, WithMytex)
+{
+  baudvine::Mytex<int, baudvine::AdaptiveSharedMutex> underTest(5);
+  *underTest.Lock() += 1;
+  EXPECT_EQ(*underTest.LockShared(), 6);
+  {
+    auto guard = underTest.Lock();
+    std::thread([&] {
+      EXPECT_FALSE(underTest.TryLock().has_value());
+      EXPECT_FALSE(underTest.TryLockShared().has_value());
+    }).join();
+  }
+  EXPECT_THAT(underTest.TryLockShared(), testing::Optional(6));
+}
+
+TEST(AdaptiveSharedMutex, FollowsTheReadRatio)
+{
+  baudvine::AdaptiveSharedMutex underTest(EagerPolicy());
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::Mutex);
+
+  // Mostly reads: readers get to share.
+  for (int i = 0; i < 40; ++i) {
+    std::shared_lock lock(underTest);
+  }
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::SharedMutex);
+  {
+    std::shared_lock first(underTest);
+    std::thread([&] {
+      std::shared_lock second(underTest, std::try_to_lock);
+      EXPECT_TRUE(second.owns_lock());
+      std::unique_lock writer(underTest, std::try_to_lock);
+      EXPECT_FALSE(writer.owns_lock());
+    }).join();
+  }
+
+  // Mostly writes: back to the plain mutex.
+  for (int i = 0; i < 40; ++i) {
+    std::unique_lock lock(underTest);
+  }
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::Mutex);
+}
+
+TEST(AdaptiveSharedMutex, ReadersAloneSwitchBack)
+{
+  auto policy = EagerPolicy();
+  policy.sampleEvery = 1;
+  policy.minHold = std::chrono::milliseconds(1);
+  baudvine::AdaptiveSharedMutex underTest(policy);
+
+  // Long reads: worth sharing.
+  for (int i = 0; i < 16; ++i) {
+    std::shared_lock lock(underTest);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::SharedMutex);
+
+  // Steady, overlapping short reads and no writers at all: too short to be
+  // worth the reader-writer lock.
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; ++t) {
+    readers.emplace_back([&underTest] {
+      for (int i = 0; i < 200; ++i) {
+        std::shared_lock lock(underTest);
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::Mutex);
+}
+
+TEST(AdaptiveSharedMutex, ReadersShareUnderMutex)
+{
+  baudvine::AdaptiveSharedMutex underTest;
+  ASSERT_EQ(underTest.CurrentProtocol(), Protocol::Mutex);
+  std::shared_lock first(underTest);
+  std::thread([&] {
+    std::shared_lock second(underTest);
+    std::unique_lock writer(underTest, std::try_to_lock);
+    EXPECT_FALSE(writer.owns_lock());
+  }).join();
+}
+
+TEST(AdaptiveSharedMutex, ReaderReleasesWhileAnotherHolds)
+{
+  auto policy = EagerPolicy();
+  policy.waitedAbove = 0.0;
+  policy.sharedBelow = 1.1;
+  baudvine::AdaptiveSharedMutex underTest(policy);
+  // Switching keeps being considered, in both directions.
+  for (int i = 0; i < 100; ++i) {
+    std::atomic<bool> released{ false };
+    std::shared_lock first(underTest);
+    std::thread second([&] {
+      std::shared_lock lock(underTest);
+      // The first reader releases while we hold on, then waits for us.
+      while (!released) {
+        std::this_thread::yield();
+      }
+    });
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    first.unlock();
+    released = true;
+    second.join();
+  }
+}
+
+TEST(AdaptiveSharedMutex, StaysPutWithoutContention)
+{
+  auto policy = EagerPolicy();
+  policy.waitedAbove = 0.5;
+  baudvine::AdaptiveSharedMutex underTest(policy);
+  for (int i = 0; i < 100; ++i) {
+    std::shared_lock lock(underTest);
+  }
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::Mutex);
+}
+
+TEST(AdaptiveSharedMutex, GuardSurvivesSwitch)
+{
+  baudvine::AdaptiveSharedMutex underTest(EagerPolicy());
+  for (int i = 0; i < 15; ++i) {
+    std::shared_lock lock(underTest);
+  }
+  // This one completes the window and switches on the way in.
+  std::shared_lock reader(underTest);
+  EXPECT_EQ(underTest.CurrentProtocol(), Protocol::SharedMutex);
+
+  std::atomic<bool> written{ false };
+  std::thread writer([&] {
+    std::unique_lock lock(underTest);
+    written = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(written);
+  reader.unlock();
+  writer.join();
+  EXPECT_TRUE(written);
+}
+
+TEST(AdaptiveSharedMutex, ExclusionWhileSwitching)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kIterations = 20000;
+  auto policy = EagerPolicy();
+  policy.sharedAbove = 0.6;
+  policy.sharedBelow = 0.7;
+  baudvine::AdaptiveSharedMutex lock(policy);
+  int a = 0;
+  int b = 0;
+  std::atomic<int> writers{ 0 };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kIterations; ++i) {
+        // Phases of reads and writes, so the protocol keeps flipping.
+        if ((i / 100 + t) % 3 == 0) {
+          std::unique_lock guard(lock);
+          EXPECT_EQ(writers.fetch_add(1), 0);
+          ++a;
+          ++b;
+          writers.fetch_sub(1);
+        } else {
+          std::shared_lock guard(lock);
+          EXPECT_EQ(writers.load(), 0);
+          EXPECT_EQ(a, b);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::unique_lock guard(lock);
+  EXPECT_EQ(a, b);
+  EXPECT_GT(a, 0);
+}
@@ -0,0 +1,74 @@
+#include "baudvine/asymmetric_shared_mutex.h"
+#include "baudvine/mytex.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using Mytex = baudvine::Mytex<int, baudvine::AsymmetricSharedMutex>;
+
+TEST(AsymmetricSharedMutex, SharedLock)
+{
+  Mytex underTest(500);
+
+  {
+    auto guard1 = underTest.LockShared();
+    auto guard2 = underTest.LockShared();
+    std::thread([&] {
+      EXPECT_THAT(underTest.TryLockShared(), testing::Optional(500));
+    }).join();
+    std::thread([&] { EXPECT_FALSE(underTest.TryLock().has_value()); }).join();
+  }
+
+  EXPECT_THAT(underTest.TryLock(), testing::Optional(500));
+}
+
+TEST(AsymmetricSharedMutex, ExclusiveLock)
+{
+  Mytex underTest(1);
+  auto guard = underTest.Lock();
+  std::thread([&] {
+    EXPECT_FALSE(underTest.TryLockShared().has_value());
+    EXPECT_FALSE(underTest.TryLock().has_value());
+  }).join();
+}
+
+TEST(AsymmetricSharedMutex, ReadersSeeConsistentWrites)
+{
+  // The writer always keeps both halves equal, so a reader that sees them
+  // differ has raced with it.
+  baudvine::Mytex<std::pair<int, int>, baudvine::AsymmetricSharedMutex>
+    underTest(0, 0);
+  std::atomic_bool stop = false;
+  std::atomic_int inconsistent = 0;
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        auto pair = underTest.LockShared();
+        if (pair->first != pair->second) {
+          ++inconsistent;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < 200; ++i) {
+    auto pair = underTest.Lock();
+    ++pair->first;
+    std::this_thread::yield();
+    ++pair->second;
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(inconsistent, 0);
+  EXPECT_EQ(underTest.LockShared()->second, 200);
+}
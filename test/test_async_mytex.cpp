@@ -0,0 +1,149 @@
+#include "baudvine/async_mytex.h"
+
+#include "manual_executor.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace {
+using Guard = baudvine::AsyncMytex<std::vector<int>>::Guard;
+} // namespace
+
+TEST(AsyncMytex, RunsOnExecutor)
+{
+  ManualExecutor executor;
+  baudvine::AsyncMytex<std::vector<int>> mytex;
+  bool ran = false;
+  mytex.LockThen(
+    [&ran](Guard guard) {
+      guard->push_back(1);
+      ran = true;
+    },
+    executor.Get());
+  EXPECT_FALSE(ran);
+  executor.RunAll();
+  EXPECT_TRUE(ran);
+}
+
+TEST(AsyncMytex, Fifo)
+{
+  ManualExecutor executor;
+  baudvine::AsyncMytex<std::vector<int>> mytex;
+  for (int i = 0; i < 5; ++i) {
+    mytex.LockThen([i](Guard guard) { guard->push_back(i); }, executor.Get());
+  }
+  std::vector<int> seen;
+  mytex.LockThen([&seen](Guard guard) { seen = *guard; }, executor.Get());
+  executor.RunAll();
+  EXPECT_EQ(seen, (std::vector<int>{ 0, 1, 2, 3, 4 }));
+}
+
+TEST(AsyncMytex, GuardOutlivesCallback)
+{
+  ManualExecutor executor;
+  baudvine::AsyncMytex<std::vector<int>> mytex;
+  std::optional<Guard> kept;
+  mytex.LockThen([&kept](Guard guard) { kept.emplace(std::move(guard)); },
+                 executor.Get());
+  bool second = false;
+  mytex.LockThen([&second](Guard) { second = true; }, executor.Get());
+  executor.RunAll();
+  EXPECT_FALSE(second);
+
+  // Releasing the kept guard dispatches the next callback.
+  kept.reset();
+  executor.RunAll();
+  EXPECT_TRUE(second);
+}
+
+TEST(AsyncMytex, LargeCallback)
+{
+  ManualExecutor executor;
+  baudvine::AsyncMytex<std::vector<int>> mytex;
+  std::array<int, 64> big{};
+  big[63] = 7;
+  std::vector<int> seen;
+  mytex.LockThen([big](Guard guard) { guard->push_back(big[63]); },
+                 executor.Get());
+  mytex.LockThen([&seen](Guard guard) { seen = *guard; }, executor.Get());
+  executor.RunAll();
+  EXPECT_EQ(seen, std::vector<int>{ 7 });
+}
+
+TEST(AsyncMytex, Concurrent)
+{
+  constexpr int kThreads = 4;
+  constexpr int kCalls = 1000;
+  ManualExecutor executor;
+  baudvine::AsyncMytex<std::vector<int>> mytex;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < kCalls; ++j) {
+        mytex.LockThen([](Guard guard) { guard->push_back(0); },
+                       executor.Get());
+        executor.RunOne();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  executor.RunAll();
+
+  std::size_t size = 0;
+  mytex.LockThen([&size](Guard guard) { size = guard->size(); },
+                 executor.Get());
+  executor.RunAll();
+  EXPECT_EQ(size, kThreads * kCalls);
+}
+
+TEST(AsyncMytex, InlineExecutorDoesNotRecurse)
+{
+  constexpr int kCallbacks = 200000;
+  const baudvine::Executor inlineExecutor = [](std::function<void()> task) {
+    task();
+  };
+  baudvine::AsyncMytex<int> mytex(0);
+  std::optional<baudvine::AsyncMytex<int>::Guard> held;
+  mytex.LockThen(
+    [&held](baudvine::AsyncMytex<int>::Guard guard) {
+      held.emplace(std::move(guard));
+    },
+    inlineExecutor);
+  for (int i = 0; i < kCallbacks; ++i) {
+    mytex.LockThen([](baudvine::AsyncMytex<int>::Guard guard) { ++*guard; },
+                   inlineExecutor);
+  }
+  // Runs every queued callback on this thread, one after the other.
+  held.reset();
+
+  int seen = 0;
+  mytex.LockThen(
+    [&seen](baudvine::AsyncMytex<int>::Guard guard) { seen = *guard; },
+    inlineExecutor);
+  EXPECT_EQ(seen, kCallbacks);
+}
+
+TEST(AsyncMytex, CallbackDestroysMytex)
+{
+  ManualExecutor executor;
+  auto mytex = std::make_unique<baudvine::AsyncMytex<int>>(0);
+  mytex->LockThen(
+    [&mytex](baudvine::AsyncMytex<int>::Guard guard) {
+      {
+        auto released = std::move(guard);
+      }
+      mytex.reset();
+    },
+    executor.Get());
+  executor.RunAll();
+  EXPECT_EQ(mytex, nullptr);
+}
@@ -0,0 +1,90 @@
+#include "baudvine/biased_lock.h"
+#include "baudvine/mytex.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+TEST(BiasedLock, WithMytex)
+{
+  baudvine::Mytex<int, baudvine::BiasedLock> underTest(5);
+  *underTest.Lock() += 1;
+  EXPECT_EQ(*underTest.Lock(), 6);
+  EXPECT_THAT(underTest.TryLock(), testing::Optional(6));
+}
+
+TEST(BiasedLock, BiasesTowardsRepeatedUser)
+{
+  baudvine::BiasedLock underTest(4);
+  EXPECT_FALSE(underTest.IsBiasedToCurrentThread());
+
+  // After a few uncontested acquisitions the lock belongs to this thread.
+  for (int i = 0; i < 4; ++i) {
+    std::lock_guard lock(underTest);
+  }
+  EXPECT_TRUE(underTest.IsBiasedToCurrentThread());
+
+  // Another thread revokes the bias...
+  std::thread([&underTest] {
+    std::lock_guard lock(underTest);
+    EXPECT_FALSE(underTest.IsBiasedToCurrentThread());
+  }).join();
+  EXPECT_FALSE(underTest.IsBiasedToCurrentThread());
+
+  // ... and it comes back after another quiet period.
+  for (int i = 0; i < 4; ++i) {
+    std::lock_guard lock(underTest);
+  }
+  EXPECT_TRUE(underTest.IsBiasedToCurrentThread());
+}
+
+TEST(BiasedLock, TryLockAgainstBiasHolder)
+{
+  baudvine::Mytex<int, baudvine::BiasedLock> underTest(0);
+  for (int i = 0; i < 100; ++i) {
+    *underTest.Lock() += 1;
+  }
+
+  {
+    // The bias holder is in its critical section, so other threads can't get
+    // in - even though the holder never touched the fallback mutex.
+    auto guard = underTest.Lock();
+    std::thread([&underTest] {
+      EXPECT_FALSE(underTest.TryLock().has_value());
+    }).join();
+  }
+
+  std::thread([&underTest] {
+    EXPECT_THAT(underTest.TryLock(), testing::Optional(100));
+  }).join();
+}
+
+TEST(BiasedLock, OwnerAndMonitor)
+{
+  // The intended use: one thread hammering the lock, another occasionally
+  // looking in.
+  constexpr int kOwnerIterations = 200000;
+  constexpr int kMonitorIterations = 200;
+  baudvine::Mytex<int, baudvine::BiasedLock> underTest(0);
+
+  std::atomic_bool ownerDone = false;
+  std::thread owner([&] {
+    for (int i = 0; i < kOwnerIterations; ++i) {
+      *underTest.Lock() += 1;
+    }
+    ownerDone = true;
+  });
+  std::thread monitor([&] {
+    for (int i = 0; i < kMonitorIterations; ++i) {
+      *underTest.Lock() += 1;
+      std::this_thread::yield();
+    }
+  });
+
+  owner.join();
+  monitor.join();
+  EXPECT_TRUE(ownerDone);
+  EXPECT_EQ(*underTest.Lock(), kOwnerIterations + kMonitorIterations);
+}
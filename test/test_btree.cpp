@@ -0,0 +1,130 @@
+#include "baudvine/btree.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+// A small fanout makes for a deep tree and lots of splits.
+using SmallTree = baudvine::MytexBTree<int, int, std::less<int>, 4>;
+
+template<typename Tree>
+std::vector<std::pair<int, int>>
+Collect(const Tree& tree, int from, int to)
+{
+  std::vector<std::pair<int, int>> entries;
+  tree.Scan(from, to, [&entries](int key, int value) {
+    entries.emplace_back(key, value);
+  });
+  return entries;
+}
+} // namespace
+
+TEST(MytexBTree, Basics)
+{
+  baudvine::MytexBTree<int, double> underTest;
+  EXPECT_FALSE(underTest.Find(1));
+  EXPECT_TRUE(underTest.Insert(1, 1.5));
+  EXPECT_FALSE(underTest.Insert(1, 2.5));
+  EXPECT_EQ(underTest.Find(1), 2.5);
+  EXPECT_TRUE(underTest.Erase(1));
+  EXPECT_FALSE(underTest.Erase(1));
+  EXPECT_FALSE(underTest.Find(1));
+}
+
+TEST(MytexBTree, MatchesStdMap)
+{
+  SmallTree underTest;
+  std::map<int, int> reference;
+  std::mt19937 random(1234);
+  std::uniform_int_distribution<int> keys(0, 999);
+
+  for (int i = 0; i < 20000; ++i) {
+    const int key = keys(random);
+    if (random() % 3 == 0) {
+      EXPECT_EQ(underTest.Erase(key), reference.erase(key) == 1);
+    } else {
+      EXPECT_EQ(underTest.Insert(key, i), reference.count(key) == 0);
+      reference[key] = i;
+    }
+  }
+
+  for (int key = 0; key < 1000; ++key) {
+    const auto it = reference.find(key);
+    if (it == reference.end()) {
+      EXPECT_FALSE(underTest.Find(key)) << key;
+    } else {
+      EXPECT_EQ(underTest.Find(key), it->second) << key;
+    }
+  }
+
+  const std::vector<std::pair<int, int>> expected(
+    reference.lower_bound(100), reference.lower_bound(900));
+  EXPECT_EQ(Collect(underTest, 100, 900), expected);
+  EXPECT_THAT(Collect(underTest, 500, 500), testing::IsEmpty());
+}
+
+TEST(MytexBTree, ConcurrentInsertAndScan)
+{
+  static constexpr int kWriters = 4;
+  static constexpr int kKeys = 4000;
+  SmallTree underTest;
+
+  // Even keys are there from the start. Writers add the odd ones while
+  // readers check that the even ones never go missing.
+  for (int key = 0; key < kKeys; key += 2) {
+    underTest.Insert(key, key);
+  }
+
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        int expectedEven = 0;
+        int previous = -1;
+        underTest.Scan(0, kKeys, [&](int key, int value) {
+          EXPECT_GT(key, previous);
+          EXPECT_EQ(key, value);
+          previous = key;
+          if (key % 2 == 0) {
+            EXPECT_EQ(key, expectedEven);
+            expectedEven += 2;
+          }
+        });
+        EXPECT_EQ(expectedEven, kKeys);
+        EXPECT_EQ(underTest.Find(kKeys / 2), kKeys / 2);
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int w = 0; w < kWriters; ++w) {
+    writers.emplace_back([&underTest, w] {
+      for (int key = 1 + 2 * w; key < kKeys; key += 2 * kWriters) {
+        EXPECT_TRUE(underTest.Insert(key, key));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  const auto entries = Collect(underTest, 0, kKeys);
+  ASSERT_EQ(entries.size(), kKeys);
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_EQ(entries[key], std::make_pair(key, key));
+  }
+}
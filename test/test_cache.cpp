@@ -0,0 +1,105 @@
+#include "baudvine/cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(ReadBuffer, DropsWhenFull)
+{
+  baudvine::detail::ReadBuffer buffer;
+  for (std::uint32_t i = 0; i + 1 < buffer.kSize; ++i) {
+    EXPECT_TRUE(buffer.Record(i));
+  }
+  EXPECT_FALSE(buffer.Record(1000));
+  EXPECT_TRUE(buffer.Full());
+  EXPECT_FALSE(buffer.Record(1001));
+
+  std::vector<std::uint32_t> drained;
+  buffer.Drain([&drained](std::uint32_t slot) { drained.push_back(slot); });
+  ASSERT_EQ(drained.size(), buffer.kSize);
+  EXPECT_EQ(drained.front(), 0);
+  EXPECT_EQ(drained.back(), 1000);
+  EXPECT_FALSE(buffer.Full());
+  EXPECT_TRUE(buffer.Record(5));
+}
+
+TEST(MytexCache, Basics)
+{
+  baudvine::MytexCache<std::string, int> underTest(100);
+  EXPECT_FALSE(underTest.Find("a"));
+  underTest.Insert("a", 1);
+  EXPECT_EQ(*underTest.LockShared("a"), 1);
+  underTest.Insert("a", 2);
+  EXPECT_EQ(underTest.Find("a"), 2);
+  EXPECT_EQ(underTest.Size(), 1);
+  EXPECT_TRUE(underTest.Erase("a"));
+  EXPECT_FALSE(underTest.Erase("a"));
+  EXPECT_EQ(underTest.Size(), 0);
+}
+
+TEST(MytexCache, ClockEviction)
+{
+  // One shard, so eviction order is predictable.
+  baudvine::MytexCache<int, int> underTest(3, 1);
+  underTest.Insert(1, 1);
+  underTest.Insert(2, 2);
+  underTest.Insert(3, 3);
+
+  // The hit on 1 gets it a second chance, so 2 goes first.
+  EXPECT_TRUE(underTest.Find(1));
+  underTest.Insert(4, 4);
+  EXPECT_TRUE(underTest.Find(1));
+  EXPECT_FALSE(underTest.Find(2));
+  EXPECT_TRUE(underTest.Find(3));
+  EXPECT_TRUE(underTest.Find(4));
+  EXPECT_EQ(underTest.Size(), 3);
+
+  // Erased entries leave room without evicting anything.
+  EXPECT_TRUE(underTest.Erase(3));
+  underTest.Insert(5, 5);
+  EXPECT_TRUE(underTest.Find(1));
+  EXPECT_TRUE(underTest.Find(4));
+  EXPECT_TRUE(underTest.Find(5));
+}
+
+TEST(MytexCache, HotKeysSurvive)
+{
+  // A scan of cold keys shouldn't push out keys that keep getting hits.
+  baudvine::MytexCache<int, int> underTest(64, 4);
+  for (int key = 0; key < 16; ++key) {
+    underTest.Insert(key, key);
+  }
+  for (int cold = 1000; cold < 2000; ++cold) {
+    for (int key = 0; key < 16; ++key) {
+      ASSERT_EQ(underTest.Find(key), key) << cold;
+    }
+    underTest.Insert(cold, cold);
+  }
+}
+
+TEST(MytexCache, Concurrent)
+{
+  static constexpr int kThreads = 4;
+  baudvine::MytexCache<int, int> underTest(256, 8);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&underTest, t] {
+      for (int i = 0; i < 5000; ++i) {
+        const int key = (i * 7 + t) % 512;
+        if (auto value = underTest.LockShared(key)) {
+          EXPECT_EQ(*value, key);
+        } else {
+          underTest.Insert(key, key);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_LE(underTest.Size(), 256);
+}
@@ -0,0 +1,124 @@
+#include "baudvine/cohort_lock.h"
+#include "baudvine/mytex.h"
+#include "baudvine/numa.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace {
+/** Pretend to have some NUMA nodes for the duration of a test. */
+class SimulatedNodes
+{
+public:
+  explicit SimulatedNodes(std::size_t nodes)
+  {
+    baudvine::SimulateNumaNodes(nodes);
+  }
+  SimulatedNodes(const SimulatedNodes&) = delete;
+  SimulatedNodes& operator=(const SimulatedNodes&) = delete;
+  ~SimulatedNodes() { baudvine::SimulateNumaNodes(0); }
+};
+} // namespace
+
+TEST(NumaTopology, ParseCpuList)
+{
+  using baudvine::NumaTopology;
+  EXPECT_THAT(NumaTopology::ParseCpuList("0-3,8,10-11\n"),
+              testing::ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_THAT(NumaTopology::ParseCpuList(""), testing::ElementsAre());
+}
+
+TEST(NumaTopology, LoadFromSysfs)
+{
+  // A fake sysfs tree with a gap in the node numbering.
+  const auto root = std::filesystem::temp_directory_path() / "mytex-numa-test";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "node0");
+  std::filesystem::create_directories(root / "node2");
+  std::filesystem::create_directories(root / "possible");
+  std::ofstream(root / "node0" / "cpulist") << "0-1,4\n";
+  std::ofstream(root / "node2" / "cpulist") << "2-3\n";
+
+  const auto topology = baudvine::NumaTopology::Load(root);
+  EXPECT_EQ(topology.NodeCount(), 2);
+  EXPECT_EQ(topology.NodeOfCpu(0), 0);
+  EXPECT_EQ(topology.NodeOfCpu(1), 0);
+  EXPECT_EQ(topology.NodeOfCpu(2), 1);
+  EXPECT_EQ(topology.NodeOfCpu(3), 1);
+  EXPECT_EQ(topology.NodeOfCpu(4), 0);
+  EXPECT_EQ(topology.NodeOfCpu(99), 0);
+
+  std::filesystem::remove_all(root);
+  EXPECT_EQ(baudvine::NumaTopology::Load(root).NodeCount(), 1);
+}
+
+TEST(NumaTopology, Simulated)
+{
+  const SimulatedNodes nodes(3);
+  EXPECT_EQ(baudvine::NumaNodeCount(), 3);
+  EXPECT_LT(baudvine::CurrentNumaNode(), 3);
+}
+
+TEST(CohortLock, WithMytex)
+{
+  baudvine::Mytex<int, baudvine::CohortLock> underTest(5);
+  *underTest.Lock() += 1;
+  EXPECT_THAT(underTest.TryLock(), testing::Optional(6));
+
+  auto guard = underTest.Lock();
+  std::thread([&] { EXPECT_FALSE(underTest.TryLock().has_value()); }).join();
+}
+
+TEST(CohortLock, MutualExclusionAcrossNodes)
+{
+  const SimulatedNodes nodes(2);
+  constexpr int kThreads = 4;
+  constexpr int kIterations = 20000;
+
+  baudvine::Mytex<int, baudvine::CohortLock> underTest(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < kIterations; ++j) {
+        auto guard = underTest.Lock();
+        const int value = *guard;
+        std::this_thread::yield();
+        *guard = value + 1;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(*underTest.Lock(), kThreads * kIterations);
+}
+
+TEST(CohortLock, FrequentGlobalReleases)
+{
+  const SimulatedNodes nodes(2);
+  // Only two local handoffs at a time, so the global lock changes hands a lot.
+  baudvine::CohortLock underTest(2, 2);
+  int value = 0;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 5000; ++j) {
+        std::lock_guard lock(underTest);
+        ++value;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(value, 20000);
+  EXPECT_TRUE(underTest.try_lock());
+  underTest.unlock();
+}
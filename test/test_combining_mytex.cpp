@@ -0,0 +1,92 @@
+#include "baudvine/combining_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+TEST(CombiningMytex, PostWhenFree)
+{
+  baudvine::CombiningMytex<int> mytex(1);
+  mytex.Post([](int& value) { value = 2; });
+  EXPECT_EQ(*mytex.LockShared(), 2);
+}
+
+TEST(CombiningMytex, HolderRunsPosts)
+{
+  baudvine::CombiningMytex<std::vector<int>> mytex;
+  {
+    auto guard = mytex.Lock();
+    std::thread([&mytex] {
+      mytex.Post([](std::vector<int>& vector) { vector.push_back(2); });
+    }).join();
+    // Posted, not run: it's waiting for us.
+    EXPECT_TRUE(guard->empty());
+    guard->push_back(1);
+  }
+  EXPECT_EQ(*mytex.LockShared(), (std::vector<int>{ 1, 2 }));
+}
+
+TEST(CombiningMytex, LastReaderRunsPosts)
+{
+  baudvine::CombiningMytex<int> mytex(0);
+  {
+    auto reader = mytex.LockShared();
+    std::thread([&mytex] { mytex.Post([](int& value) { value = 5; }); })
+      .join();
+    EXPECT_EQ(*reader, 0);
+  }
+  EXPECT_EQ(*mytex.LockShared(), 5);
+}
+
+TEST(CombiningMytex, HolderPostsToItself)
+{
+  baudvine::CombiningMytex<std::vector<int>> mytex;
+  {
+    auto guard = mytex.Lock();
+    mytex.Post([](std::vector<int>& vector) { vector.push_back(2); });
+    EXPECT_TRUE(guard->empty());
+    guard->push_back(1);
+  }
+  {
+    auto reader = mytex.LockShared();
+    mytex.Post([](std::vector<int>& vector) { vector.push_back(3); });
+    EXPECT_EQ(reader->size(), 2U);
+  }
+  EXPECT_EQ(*mytex.LockShared(), (std::vector<int>{ 1, 2, 3 }));
+}
+
+TEST(CombiningMytex, OperationPostsAnother)
+{
+  baudvine::CombiningMytex<std::vector<int>> mytex;
+  mytex.Post([&mytex](std::vector<int>& vector) {
+    vector.push_back(1);
+    mytex.Post([](std::vector<int>& inner) { inner.push_back(2); });
+  });
+  EXPECT_EQ(*mytex.LockShared(), (std::vector<int>{ 1, 2 }));
+}
+
+TEST(CombiningMytex, ConcurrentPosts)
+{
+  constexpr int kThreads = 4;
+  constexpr int kPosts = 10000;
+  baudvine::CombiningMytex<int> mytex(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&mytex, i] {
+      for (int j = 0; j < kPosts; ++j) {
+        if ((i + j) % 100 == 0) {
+          ++*mytex.Lock();
+        } else {
+          mytex.Post([](int& value) { ++value; });
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(*mytex.LockShared(), kThreads * kPosts);
+}
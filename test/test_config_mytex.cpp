@@ -0,0 +1,149 @@
+#include "baudvine/config_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+std::string
+ReadFile(const std::filesystem::path& path)
+{
+  std::ifstream stream(path);
+  std::string contents;
+  std::getline(stream, contents);
+  if (contents == "invalid") {
+    throw std::runtime_error("invalid");
+  }
+  return contents;
+}
+
+void
+WriteFile(const std::filesystem::path& path, const std::string& contents)
+{
+  // Write next to it and rename over it, like editors tend to.
+  auto temporary = path;
+  temporary += ".tmp";
+  std::ofstream(temporary) << contents << "\n";
+  std::filesystem::rename(temporary, path);
+}
+
+template<typename Predicate>
+bool
+Eventually(Predicate&& predicate)
+{
+  const auto deadline =
+    std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (predicate()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+} // namespace
+
+TEST(ConfigMytex, Publish)
+{
+  baudvine::ConfigMytex<std::string> underTest("one");
+  const std::string& first = underTest.Get();
+  EXPECT_EQ(first, "one");
+  // Cached: the same object comes back until something is published.
+  EXPECT_EQ(&underTest.Get(), &first);
+
+  const auto kept = underTest.LockShared();
+  underTest.Publish("two");
+  EXPECT_EQ(underTest.Get(), "two");
+  EXPECT_EQ(underTest.Version(), 2);
+  EXPECT_EQ(*kept, "one");
+}
+
+TEST(ConfigMytex, ReadersSeeEveryPublish)
+{
+  static constexpr int kPublishes = 5000;
+  baudvine::ConfigMytex<std::vector<int>> underTest(4, 0);
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!done) {
+        const auto& config = underTest.Get();
+        EXPECT_GE(config.front(), last);
+        EXPECT_EQ(config.front(), config.back());
+        last = config.front();
+      }
+      EXPECT_EQ(underTest.Get().front(), kPublishes);
+    });
+  }
+  for (int i = 1; i <= kPublishes; ++i) {
+    underTest.Publish(std::vector<int>(4, i));
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST(ConfigMytex, WatchFile)
+{
+  const auto path =
+    std::filesystem::path(testing::TempDir()) / "mytex_config_test.txt";
+  WriteFile(path, "one");
+
+  baudvine::ConfigMytex<std::string> underTest;
+  std::atomic<int> errors{ 0 };
+  underTest.WatchFile(
+    path, ReadFile, [&errors](const std::exception_ptr&) { ++errors; });
+  EXPECT_EQ(underTest.Get(), "one");
+
+  WriteFile(path, "two");
+  EXPECT_TRUE(Eventually([&] { return underTest.Get() == "two"; }));
+
+  // A file that doesn't parse leaves the current value alone.
+  WriteFile(path, "invalid");
+  EXPECT_TRUE(Eventually([&] { return errors > 0; }));
+  EXPECT_EQ(underTest.Get(), "two");
+
+  // Writing in place is noticed as well.
+  std::ofstream(path) << "three\n";
+  EXPECT_TRUE(Eventually([&] { return underTest.Get() == "three"; }));
+
+  underTest.StopWatching();
+  WriteFile(path, "four");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(underTest.Get(), "three");
+  std::filesystem::remove(path);
+}
+
+TEST(ConfigMytex, WriteDuringInitialLoad)
+{
+  const auto path =
+    std::filesystem::path(testing::TempDir()) / "mytex_config_race.txt";
+  WriteFile(path, "old");
+
+  // The initial load reads the file, which then changes before it's
+  // published. The watch has to be in place already to notice.
+  bool first = true;
+  baudvine::ConfigMytex<std::string> underTest;
+  underTest.WatchFile(path, [&first](const std::filesystem::path& file) {
+    auto contents = ReadFile(file);
+    if (std::exchange(first, false)) {
+      WriteFile(file, "new");
+    }
+    return contents;
+  });
+  EXPECT_TRUE(Eventually([&] { return underTest.Get() == "new"; }));
+
+  underTest.StopWatching();
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,127 @@
+#include "baudvine/config_mytex.h"
+#include "baudvine/snapshot_mytex.h"
+#include "baudvine/versioned_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+TEST(DerivedView, RecomputesOnlyAfterChanges)
+{
+  baudvine::SnapshotMytex<std::vector<int>> underTest(
+    std::vector<int>{ 3, 1, 2 });
+  int computed = 0;
+  const auto sorted = underTest.Derived([&computed](const auto& values) {
+    ++computed;
+    auto copy = values;
+    std::sort(copy.begin(), copy.end());
+    return copy;
+  });
+
+  EXPECT_EQ(*sorted.Get(), (std::vector<int>{ 1, 2, 3 }));
+  EXPECT_EQ(*sorted.Get(), (std::vector<int>{ 1, 2, 3 }));
+  EXPECT_EQ(computed, 1);
+  EXPECT_EQ(sorted.Version(), underTest.Version());
+
+  underTest.Lock()->push_back(0);
+  EXPECT_EQ(*sorted.Get(), (std::vector<int>{ 0, 1, 2, 3 }));
+  EXPECT_EQ(computed, 2);
+}
+
+TEST(DerivedView, ConfigMytex)
+{
+  baudvine::ConfigMytex<std::vector<int>> underTest(4, 2);
+  const auto sum = underTest.Derived([](const std::vector<int>& values) {
+    return std::accumulate(values.begin(), values.end(), 0);
+  });
+  EXPECT_EQ(*sum.Get(), 8);
+  underTest.Publish({ 1, 2 });
+  EXPECT_EQ(*sum.Get(), 3);
+}
+
+TEST(DerivedView, VersionedMytex)
+{
+  baudvine::VersionedMytex<std::vector<int>> underTest(
+    std::vector<int>{ 4, 2 });
+  int computed = 0;
+  const auto sum = underTest.Derived(
+    [&computed](const std::vector<int>& values) {
+      ++computed;
+      return std::accumulate(values.begin(), values.end(), 0);
+    });
+  EXPECT_EQ(*sum.Get(), 6);
+  EXPECT_EQ(*sum.Get(), 6);
+  EXPECT_EQ(computed, 1);
+
+  // Reading doesn't count as a change.
+  EXPECT_EQ(underTest.LockShared()->size(), 2U);
+  EXPECT_EQ(*sum.Get(), 6);
+  EXPECT_EQ(computed, 1);
+
+  underTest.Lock()->push_back(1);
+  EXPECT_EQ(*sum.Get(), 7);
+  EXPECT_EQ(computed, 2);
+  EXPECT_EQ(sum.Version(), underTest.Version());
+}
+
+TEST(DerivedView, ServesStaleWhileRefreshing)
+{
+  baudvine::SnapshotMytex<int> underTest(1);
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool blocked = false;
+  bool release = false;
+  const auto doubled = underTest.Derived([&](int value) {
+    if (value == 2) {
+      std::unique_lock lock(mutex);
+      blocked = true;
+      wake.notify_all();
+      wake.wait(lock, [&] { return release; });
+    }
+    return value * 2;
+  });
+  EXPECT_EQ(*doubled.Get(), 2);
+
+  *underTest.Lock() = 2;
+  std::thread refresher([&] { EXPECT_EQ(*doubled.Get(), 4); });
+  {
+    std::unique_lock lock(mutex);
+    wake.wait(lock, [&] { return blocked; });
+  }
+  // The refresh is stuck, and everyone else gets the previous result.
+  EXPECT_EQ(*doubled.Get(), 2);
+  {
+    std::lock_guard lock(mutex);
+    release = true;
+  }
+  wake.notify_all();
+  refresher.join();
+  EXPECT_EQ(*doubled.Get(), 4);
+}
+
+TEST(DerivedView, ConcurrentGetComputesOnce)
+{
+  baudvine::SnapshotMytex<int> underTest(21);
+  std::atomic<int> computed{ 0 };
+  const auto doubled = underTest.Derived([&computed](int value) {
+    ++computed;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return value * 2;
+  });
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&doubled] { EXPECT_EQ(*doubled.Get(), 42); });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(computed, 1);
+}
@@ -0,0 +1,115 @@
+#include "baudvine/eventfd_mutex.h"
+
+#if defined(__linux__)
+#include "baudvine/mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <poll.h>
+
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace {
+bool Readable(int fd)
+{
+  pollfd pfd{ fd, POLLIN, 0 };
+  return poll(&pfd, 1, 0) == 1;
+}
+} // namespace
+
+TEST(EventfdMutex, ReadableOnRelease)
+{
+  baudvine::EventfdMutex mutex;
+  baudvine::Mytex<int, baudvine::EventfdMutex> mytex(mutex, 0);
+
+  std::optional guard(mytex.Lock());
+  auto waiter = mutex.RegisterWaiter();
+  EXPECT_FALSE(mytex.TryLock());
+  EXPECT_FALSE(Readable(mutex.Fd()));
+
+  guard.reset();
+  EXPECT_TRUE(Readable(mutex.Fd()));
+  mutex.ClearReadiness();
+  EXPECT_FALSE(Readable(mutex.Fd()));
+  EXPECT_TRUE(mytex.TryLock());
+}
+
+TEST(EventfdMutex, QuietWithoutWaiters)
+{
+  baudvine::EventfdMutex mutex;
+  baudvine::Mytex<int, baudvine::EventfdMutex> mytex(mutex, 0);
+  {
+    auto guard = mytex.Lock();
+  }
+  EXPECT_FALSE(Readable(mutex.Fd()));
+}
+
+TEST(EventfdMutex, LastReaderWakesWriter)
+{
+  baudvine::EventfdMutex mutex;
+  baudvine::Mytex<int, baudvine::EventfdMutex> mytex(mutex, 0);
+
+  std::optional first(mytex.LockShared());
+  std::optional second(mytex.LockShared());
+  auto waiter = mutex.RegisterWaiter();
+  EXPECT_FALSE(mytex.TryLock());
+
+  first.reset();
+  EXPECT_FALSE(Readable(mutex.Fd()));
+  second.reset();
+  EXPECT_TRUE(Readable(mutex.Fd()));
+}
+
+TEST(EventfdMutex, Blocking)
+{
+  constexpr int kThreads = 4;
+  constexpr int kIncrements = 1000;
+  baudvine::Mytex<int, baudvine::EventfdMutex> mytex(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&mytex] {
+      for (int j = 0; j < kIncrements; ++j) {
+        ++*mytex.Lock();
+        EXPECT_GE(*mytex.LockShared(), 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(*mytex.LockShared(), kThreads * kIncrements);
+}
+
+TEST(EventfdMutex, EventLoop)
+{
+  constexpr int kIncrements = 1000;
+  baudvine::EventfdMutex mutex;
+  baudvine::Mytex<int, baudvine::EventfdMutex> mytex(mutex, 0);
+
+  std::thread blocking([&mytex] {
+    for (int j = 0; j < kIncrements; ++j) {
+      ++*mytex.Lock();
+    }
+  });
+
+  // Never blocks on the mutex itself, only on poll().
+  for (int j = 0; j < kIncrements; ++j) {
+    auto waiter = mutex.RegisterWaiter();
+    auto guard = mytex.TryLock();
+    while (!guard) {
+      pollfd pfd{ mutex.Fd(), POLLIN, 0 };
+      ASSERT_EQ(poll(&pfd, 1, -1), 1);
+      mutex.ClearReadiness();
+      guard = mytex.TryLock();
+    }
+    ++*guard;
+  }
+  blocking.join();
+
+  EXPECT_EQ(*mytex.LockShared(), 2 * kIncrements);
+}
+#endif
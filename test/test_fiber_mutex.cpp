@@ -0,0 +1,80 @@
+#include "baudvine/fiber_mutex.h"
+
+#if defined(__linux__)
+#include "baudvine/mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+using Scheduler = baudvine::UcontextScheduler;
+
+TEST(FiberMutex, SuspendsOnlyTheFiber)
+{
+  constexpr int kFibers = 100;
+  baudvine::Mytex<int, baudvine::FiberMutex> mytex(0);
+  int holders = 0;
+  int maxHolders = 0;
+
+  for (int i = 0; i < kFibers; ++i) {
+    Scheduler::Spawn([&] {
+      auto guard = mytex.Lock();
+      maxHolders = std::max(maxHolders, ++holders);
+      // Let everyone else pile up behind the lock.
+      Scheduler::Yield();
+      ++*guard;
+      --holders;
+    });
+  }
+  Scheduler::Run();
+
+  EXPECT_EQ(maxHolders, 1);
+  EXPECT_EQ(*mytex.TryLock(), kFibers);
+}
+
+TEST(FiberMutex, Fifo)
+{
+  baudvine::Mytex<std::vector<int>, baudvine::FiberMutex> mytex;
+  Scheduler::Spawn([&] {
+    auto guard = mytex.Lock();
+    Scheduler::Yield();
+    guard->push_back(0);
+  });
+  for (int i = 1; i < 4; ++i) {
+    Scheduler::Spawn([&mytex, i] { mytex.Lock()->push_back(i); });
+  }
+  Scheduler::Run();
+
+  EXPECT_EQ(*mytex.TryLock(), (std::vector<int>{ 0, 1, 2, 3 }));
+}
+
+TEST(FiberMutex, TryLock)
+{
+  baudvine::Mytex<int, baudvine::FiberMutex> mytex(0);
+  bool acquired = true;
+  Scheduler::Spawn([&] {
+    auto guard = mytex.Lock();
+    Scheduler::Yield();
+  });
+  Scheduler::Spawn([&] { acquired = mytex.TryLock().has_value(); });
+  Scheduler::Run();
+
+  EXPECT_FALSE(acquired);
+  EXPECT_TRUE(mytex.TryLock());
+}
+
+TEST(UcontextScheduler, ResumeBeforeSuspend)
+{
+  bool done = false;
+  Scheduler::Spawn([&] {
+    Scheduler::Resume(Scheduler::Current());
+    // Returns right away thanks to the earlier Resume().
+    Scheduler::Suspend();
+    done = true;
+  });
+  Scheduler::Run();
+
+  EXPECT_TRUE(done);
+}
+#endif
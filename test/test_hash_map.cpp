@@ -0,0 +1,130 @@
+#include "baudvine/hash_map.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(ControlGroup, Match)
+{
+  using baudvine::detail::ControlGroup;
+  std::int8_t control[ControlGroup::kWidth];
+  std::fill_n(control, ControlGroup::kWidth, ControlGroup::kEmpty);
+  control[3] = 42;
+  control[9] = 42;
+  control[10] = ControlGroup::kDeleted;
+  control[15] = 7;
+
+  const ControlGroup group(control);
+  EXPECT_EQ(group.Match(42), (1U << 3) | (1U << 9));
+  EXPECT_EQ(group.Match(7), 1U << 15);
+  EXPECT_EQ(group.Match(1), 0U);
+  EXPECT_EQ(group.MatchEmpty(),
+            0xffffU & ~((1U << 3) | (1U << 9) | (1U << 10) | (1U << 15)));
+  EXPECT_EQ(group.MatchAvailable(),
+            0xffffU & ~((1U << 3) | (1U << 9) | (1U << 15)));
+}
+
+TEST(MytexHashMap, Basics)
+{
+  baudvine::MytexHashMap<std::string, int> underTest;
+  EXPECT_FALSE(underTest.Find("a"));
+  EXPECT_TRUE(underTest.Insert("a", 1));
+  EXPECT_FALSE(underTest.Insert("a", 2));
+  EXPECT_EQ(underTest.Find("a"), 1);
+  EXPECT_FALSE(underTest.InsertOrAssign("a", 3));
+  EXPECT_EQ(underTest.Find("a"), 3);
+  EXPECT_EQ(underTest.Size(), 1);
+
+  *underTest.Lock("a") += 1;
+  EXPECT_EQ(*underTest.LockShared("a"), 4);
+  EXPECT_FALSE(underTest.Lock("b"));
+
+  EXPECT_TRUE(underTest.Erase("a"));
+  EXPECT_FALSE(underTest.Erase("a"));
+  EXPECT_FALSE(underTest.Contains("a"));
+  EXPECT_EQ(underTest.Size(), 0);
+}
+
+TEST(MytexHashMap, GuardPinsValue)
+{
+  // A single stripe, so every key shares a lock.
+  baudvine::MytexHashMap<int, int> underTest(1);
+  underTest.Insert(1, 10);
+
+  auto value = underTest.LockShared(1);
+  ASSERT_TRUE(value);
+  bool inserted = false;
+  std::thread writer([&] { inserted = underTest.Insert(2, 20); });
+
+  // The writer can't get in while the value is pinned.
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(*value, 10);
+  value = {};
+  writer.join();
+  EXPECT_TRUE(inserted);
+}
+
+TEST(MytexHashMap, IncrementalResize)
+{
+  // Every key is findable at every point, in particular while a stripe's
+  // entries are spread over two tables.
+  baudvine::MytexHashMap<int, int> underTest(2);
+  static constexpr int kKeys = 5000;
+  for (int key = 0; key < kKeys; ++key) {
+    ASSERT_TRUE(underTest.Insert(key, -key));
+    ASSERT_EQ(underTest.Find(key / 2), -(key / 2)) << key;
+    ASSERT_EQ(underTest.Find(0), 0) << key;
+  }
+  EXPECT_EQ(underTest.Size(), kKeys);
+
+  // Erasing leaves tombstones, which eventually cause a rehash.
+  for (int round = 0; round < 10; ++round) {
+    for (int key = 0; key < kKeys; key += 2) {
+      ASSERT_TRUE(underTest.Erase(key));
+    }
+    for (int key = 0; key < kKeys; key += 2) {
+      ASSERT_TRUE(underTest.Insert(key, -key));
+    }
+  }
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_EQ(underTest.Find(key), -key);
+  }
+  EXPECT_EQ(underTest.Size(), kKeys);
+}
+
+TEST(MytexHashMap, Concurrent)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kKeys = 2000;
+  baudvine::MytexHashMap<int, int> underTest(8);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&underTest, t] {
+      for (int key = t; key < kKeys; key += kThreads) {
+        EXPECT_TRUE(underTest.Insert(key, 0));
+      }
+      // Everyone increments every key.
+      for (int key = 0; key < kKeys; ++key) {
+        while (!underTest.Contains(key)) {
+          std::this_thread::yield();
+        }
+        *underTest.Lock(key) += 1;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(underTest.Size(), kKeys);
+  for (int key = 0; key < kKeys; ++key) {
+    EXPECT_EQ(underTest.Find(key), kThreads);
+  }
+}
@@ -0,0 +1,187 @@
+#include "baudvine/lock_coupling.h"
+#include "baudvine/mytex.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Link
+{
+  explicit Link(int value)
+    : value(value)
+  {
+  }
+
+  int value;
+  std::unique_ptr<baudvine::Mytex<Link>> next;
+};
+
+using Node = baudvine::Mytex<Link>;
+using Cursor = baudvine::LockCouplingCursor<Link>;
+using baudvine::CouplingMode;
+
+/** A sorted list with a sentinel head, locked one node at a time. */
+class SortedList
+{
+public:
+  void Insert(int value)
+  {
+    Cursor cursor(mHead, CouplingMode::Exclusive);
+    while (cursor->next) {
+      cursor.Descend(*cursor->next, CouplingMode::Exclusive);
+      if (cursor->value >= value) {
+        auto& previous = *cursor.MutableParent();
+        auto link = std::make_unique<Node>(value);
+        link->Lock()->next = std::move(previous.next);
+        previous.next = std::move(link);
+        return;
+      }
+    }
+    cursor.Mutable().next = std::make_unique<Node>(value);
+  }
+
+  bool Remove(int value)
+  {
+    Cursor cursor(mHead, CouplingMode::Exclusive);
+    while (cursor->next) {
+      cursor.Descend(*cursor->next, CouplingMode::Exclusive);
+      if (cursor->value == value) {
+        // Unlink while holding both nodes, but only destroy the node once
+        // its lock has been released.
+        auto& previous = *cursor.MutableParent();
+        auto removed = std::move(previous.next);
+        previous.next = std::move(cursor.Mutable().next);
+        cursor.Release();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<int> Values()
+  {
+    std::vector<int> values;
+    Cursor cursor(mHead);
+    while (cursor->next) {
+      cursor.Descend(*cursor->next);
+      values.push_back(cursor->value);
+    }
+    return values;
+  }
+
+private:
+  Node mHead{ INT_MIN };
+};
+
+/** @returns Whether another thread could lock @p node right now. */
+bool CanLock(Node& node, CouplingMode mode)
+{
+  bool locked = false;
+  std::thread([&] {
+    locked = mode == CouplingMode::Exclusive
+               ? node.TryLock().has_value()
+               : node.TryLockShared().has_value();
+  }).join();
+  return locked;
+}
+} // namespace
+
+TEST(LockCoupling, HoldsAtMostTwoNodes)
+{
+  Node head(0);
+  head.Lock()->next = std::make_unique<Node>(1);
+  auto& middle = *head.Lock()->next;
+  middle.Lock()->next = std::make_unique<Node>(2);
+  auto& leaf = *middle.Lock()->next;
+
+  Cursor cursor(head);
+  EXPECT_EQ(cursor.Parent(), nullptr);
+  cursor.Descend(middle);
+  EXPECT_FALSE(CanLock(head, CouplingMode::Exclusive));
+  EXPECT_TRUE(CanLock(head, CouplingMode::Shared));
+
+  cursor.Descend(leaf);
+  EXPECT_TRUE(CanLock(head, CouplingMode::Exclusive));
+  EXPECT_FALSE(CanLock(middle, CouplingMode::Exclusive));
+  EXPECT_TRUE(CanLock(leaf, CouplingMode::Shared));
+  EXPECT_EQ(cursor.Parent()->value, 1);
+  EXPECT_EQ(cursor->value, 2);
+  EXPECT_EQ(&cursor.CurrentNode(), &leaf);
+
+  // Shared to exclusive at the leaf, keeping the parent locked.
+  EXPECT_FALSE(cursor.IsExclusive());
+  cursor.Upgrade();
+  EXPECT_TRUE(cursor.IsExclusive());
+  EXPECT_FALSE(CanLock(leaf, CouplingMode::Shared));
+  EXPECT_FALSE(CanLock(middle, CouplingMode::Exclusive));
+  cursor.Mutable().value = 3;
+
+  cursor.ReleaseParent();
+  EXPECT_TRUE(CanLock(middle, CouplingMode::Exclusive));
+  EXPECT_EQ(cursor.Parent(), nullptr);
+
+  cursor.Release();
+  EXPECT_TRUE(CanLock(leaf, CouplingMode::Exclusive));
+  EXPECT_EQ(leaf.LockShared()->value, 3);
+}
+
+TEST(LockCoupling, ExclusiveLeaf)
+{
+  Node head(0);
+  head.Lock()->next = std::make_unique<Node>(1);
+
+  Cursor cursor(head);
+  cursor.Descend(*cursor->next, CouplingMode::Exclusive);
+  EXPECT_TRUE(cursor.IsExclusive());
+  EXPECT_TRUE(CanLock(head, CouplingMode::Shared));
+  EXPECT_FALSE(CanLock(*cursor.Parent()->next, CouplingMode::Shared));
+}
+
+TEST(LockCoupling, ConcurrentList)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kIterations = 200;
+  SortedList list;
+
+  std::atomic<bool> done{ false };
+  std::thread reader([&] {
+    while (!done) {
+      const auto values = list.Values();
+      EXPECT_TRUE(std::is_sorted(values.begin(), values.end()));
+    }
+  });
+
+  // Every thread inserts its own values and removes the odd ones again.
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t) {
+    writers.emplace_back([&list, t] {
+      for (int i = 0; i < kIterations; ++i) {
+        list.Insert(t + kThreads * i);
+      }
+      for (int i = 1; i < kIterations; i += 2) {
+        EXPECT_TRUE(list.Remove(t + kThreads * i));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+
+  std::vector<int> expected;
+  for (int i = 0; i < kIterations; i += 2) {
+    for (int t = 0; t < kThreads; ++t) {
+      expected.push_back(t + kThreads * i);
+    }
+  }
+  EXPECT_EQ(list.Values(), expected);
+  EXPECT_FALSE(list.Remove(kThreads));
+}
@@ -0,0 +1,133 @@
+#include "baudvine/mvcc.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(MvccMytex, Basics)
+{
+  baudvine::MvccMytex<std::string> underTest("one");
+  {
+    auto draft = underTest.Lock();
+    EXPECT_EQ(*draft, "one");
+    *draft = "two";
+    // Not published until the guard is released.
+    EXPECT_EQ(*underTest.LockShared(), "one");
+  }
+  EXPECT_EQ(*underTest.LockShared(), "two");
+  EXPECT_EQ(underTest.LockShared()->size(), 3);
+}
+
+TEST(MvccMytex, SnapshotsKeepTheirVersion)
+{
+  baudvine::MvccMytex<int> underTest(1);
+  std::optional<baudvine::MvccSnapshot> before{ std::in_place };
+  *underTest.Lock() = 2;
+  std::optional<baudvine::MvccSnapshot> after{ std::in_place };
+
+  EXPECT_EQ(underTest.ReadAt(*before), 1);
+  EXPECT_EQ(underTest.ReadAt(*after), 2);
+  EXPECT_LT(before->Timestamp(), after->Timestamp());
+
+  // The old version survives collection while it's pinned.
+  for (int i = 0; i < 20; ++i) {
+    *underTest.Lock() += 1;
+  }
+  underTest.Collect();
+  EXPECT_EQ(underTest.ReadAt(*before), 1);
+  EXPECT_EQ(underTest.ReadAt(*after), 2);
+  EXPECT_EQ(underTest.VersionCount(), 22);
+
+  before.reset();
+  after.reset();
+  underTest.Collect();
+  EXPECT_EQ(underTest.VersionCount(), 1);
+  EXPECT_EQ(*underTest.LockShared(), 22);
+}
+
+TEST(MvccMytex, CollectsWithoutReaders)
+{
+  baudvine::MvccMytex<int> underTest(0);
+  for (int i = 0; i < 100; ++i) {
+    *underTest.Lock() += 1;
+  }
+  EXPECT_LE(underTest.VersionCount(),
+            baudvine::MvccMytex<int>::kCollectEvery + 1);
+  underTest.Collect();
+  EXPECT_EQ(underTest.VersionCount(), 1);
+  EXPECT_EQ(*underTest.LockShared(), 100);
+}
+
+TEST(MvccMytex, SnapshotsAreConsistentAcrossObjects)
+{
+  static constexpr int kWrites = 20000;
+  baudvine::MvccMytex<int> first(0);
+  baudvine::MvccMytex<int> second(0);
+
+  // The writer always bumps first before second, so at any single point in
+  // time first is equal to second or one ahead.
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        const baudvine::MvccSnapshot snapshot;
+        const int b = second.ReadAt(snapshot);
+        const int a = first.ReadAt(snapshot);
+        EXPECT_TRUE(a == b || a == b + 1) << a << " " << b;
+      }
+    });
+  }
+
+  for (int i = 0; i < kWrites; ++i) {
+    *first.Lock() += 1;
+    *second.Lock() += 1;
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(*first.LockShared(), kWrites);
+  EXPECT_EQ(*second.LockShared(), kWrites);
+}
+
+TEST(MvccMytex, ConcurrentWriters)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kWrites = 5000;
+  baudvine::MvccMytex<std::vector<int>> underTest(8, 0);
+
+  std::atomic<bool> done{ false };
+  std::thread reader([&] {
+    while (!done) {
+      const auto guard = underTest.LockShared();
+      for (int value : *guard) {
+        EXPECT_EQ(value, guard->front());
+      }
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t) {
+    writers.emplace_back([&] {
+      for (int i = 0; i < kWrites; ++i) {
+        auto draft = underTest.Lock();
+        for (int& value : *draft) {
+          ++value;
+        }
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(underTest.LockShared()->front(), kThreads * kWrites);
+}
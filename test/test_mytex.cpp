@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 
 #include <thread>
+#include <utility>
 
 TEST(Mytex, DefaultCtor)
 {
@@ -113,6 +114,22 @@ TEST(Mytex, MoveGuard)
   EXPECT_FALSE(underTest.TryLock().has_value());
 }
 
+TEST(Mytex, MapGuard)
+{
+  baudvine::Mytex<std::pair<int, int>> underTest(1, 2);
+  auto second = underTest.Lock().Map(
+    [](std::pair<int, int>& pair) -> int& { return pair.second; });
+  EXPECT_EQ(*second, 2);
+  EXPECT_FALSE(underTest.TryLock().has_value());
+
+  // A mapped guard can become an optional one.
+  baudvine::OptionalMytexGuard<int, std::unique_lock<std::shared_mutex>>
+    optional = std::move(second);
+  *optional = 3;
+  optional = {};
+  EXPECT_EQ(underTest.LockShared()->second, 3);
+}
+
 TEST(Mytex, MoveMytex)
 {
   // Only works if both T and Lockable are movable.
@@ -0,0 +1,67 @@
+#include "baudvine/node_replicated.h"
+#include "baudvine/numa.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(NodeReplicated, ReadYourWrites)
+{
+  baudvine::NodeReplicated<std::vector<int>> underTest(
+    baudvine::NodeReplicationOptions{ 3 }, std::size_t{ 2 }, 7);
+  EXPECT_EQ(underTest.ReplicaCount(), 3);
+  EXPECT_THAT(*underTest.LockShared(), testing::ElementsAre(7, 7));
+
+  // Mutations are functions, and their result comes from the local replica.
+  const auto size = underTest.With([](std::vector<int>& vector) {
+    vector.push_back(8);
+    return vector.size();
+  });
+  EXPECT_EQ(size, 3);
+  EXPECT_THAT(*underTest.LockShared(), testing::ElementsAre(7, 7, 8));
+}
+
+TEST(NodeReplicated, ReplicasConverge)
+{
+  // Spread threads over three fake nodes, each with its own replica.
+  baudvine::SimulateNumaNodes(3);
+  baudvine::NodeReplicated<std::map<int, int>> underTest(
+    baudvine::NodeReplicationOptions{ 3, 8 });
+
+  // The log is much smaller than the number of operations, so appenders
+  // regularly have to wait for (and help) lagging replicas.
+  static constexpr int kThreads = 6;
+  static constexpr int kIterations = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&underTest, t] {
+      for (int i = 0; i < kIterations; ++i) {
+        underTest.With([t](std::map<int, int>& map) { ++map[t]; });
+        EXPECT_EQ(underTest.LockShared()->at(t), i + 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Every thread, whichever replica it reads, sees all of the writes.
+  std::vector<std::thread> readers;
+  for (int t = 0; t < kThreads; ++t) {
+    readers.emplace_back([&underTest] {
+      auto map = underTest.LockShared();
+      EXPECT_EQ(map->size(), kThreads);
+      for (const auto& [key, count] : *map) {
+        EXPECT_EQ(count, kIterations) << key;
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  baudvine::SimulateNumaNodes(0);
+}
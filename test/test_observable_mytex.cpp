@@ -0,0 +1,109 @@
+#include "baudvine/observable_mytex.h"
+
+#include "manual_executor.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(ObservableMytex, NotifiesAfterUnlock)
+{
+  baudvine::ObservableMytex<int> underTest(0);
+  int seen = -1;
+  auto subscription = underTest.Subscribe([&] {
+    // The lock has been released by now.
+    seen = *underTest.LockShared();
+  });
+
+  *underTest.Lock() = 5;
+  EXPECT_EQ(seen, 5);
+
+  // Shared locks don't notify.
+  seen = -1;
+  { auto guard = underTest.LockShared(); }
+  EXPECT_EQ(seen, -1);
+
+  subscription.Cancel();
+  *underTest.Lock() = 6;
+  EXPECT_EQ(seen, -1);
+}
+
+TEST(ObservableMytex, CoalescesBursts)
+{
+  ManualExecutor executor;
+  baudvine::ObservableMytex<int> underTest(0);
+  std::vector<int> seen;
+  auto subscription = underTest.Subscribe(
+    [&] { seen.push_back(*underTest.LockShared()); }, executor.Get());
+
+  for (int i = 1; i <= 10; ++i) {
+    *underTest.Lock() = i;
+  }
+  EXPECT_TRUE(seen.empty());
+  EXPECT_EQ(executor.RunAll(), 1);
+  EXPECT_EQ(seen, std::vector<int>{ 10 });
+
+  *underTest.Lock() = 11;
+  EXPECT_EQ(executor.RunAll(), 1);
+  EXPECT_EQ(seen, (std::vector<int>{ 10, 11 }));
+  EXPECT_EQ(executor.RunAll(), 0);
+}
+
+TEST(ObservableMytex, SubscriptionOutlivesMytex)
+{
+  ManualExecutor executor;
+  int calls = 0;
+  baudvine::Subscription subscription;
+  {
+    baudvine::ObservableMytex<int> underTest(0);
+    subscription = underTest.Subscribe([&calls] { ++calls; }, executor.Get());
+    *underTest.Lock() = 1;
+  }
+  executor.RunAll();
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(ObservableMytex, PrunesCancelledSubscribers)
+{
+  baudvine::ObservableMytex<int> underTest(0);
+  int calls = 0;
+  for (int i = 0; i < 100; ++i) {
+    auto temporary = underTest.Subscribe([] {});
+    temporary.Cancel();
+    *underTest.Lock() = i;
+  }
+  auto subscription = underTest.Subscribe([&calls] { ++calls; });
+  *underTest.Lock() = 100;
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(underTest.SubscriberCount(), 1);
+}
+
+TEST(ObservableMytex, ConcurrentWriters)
+{
+  static constexpr int kThreads = 4;
+  static constexpr int kWrites = 2000;
+  baudvine::ObservableMytex<int> underTest(0);
+  std::atomic<int> running{ 0 };
+  std::atomic<int> last{ 0 };
+  auto subscription = underTest.Subscribe([&] {
+    EXPECT_EQ(running.fetch_add(1), 0) << "ran concurrently with itself";
+    last = *underTest.LockShared();
+    running.fetch_sub(1);
+  });
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t) {
+    writers.emplace_back([&underTest] {
+      for (int i = 0; i < kWrites; ++i) {
+        *underTest.Lock() += 1;
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  // The last write's notification saw everything.
+  EXPECT_EQ(last, kThreads * kWrites);
+}
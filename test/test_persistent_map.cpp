@@ -0,0 +1,101 @@
+#include "baudvine/persistent_map.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+// Sends every key to the same bucket, so all of them collide.
+struct Collide
+{
+  std::size_t operator()(int /*key*/) const noexcept { return 0; }
+};
+} // namespace
+
+TEST(PersistentMap, Basics)
+{
+  baudvine::PersistentMap<std::string, int> underTest;
+  EXPECT_TRUE(underTest.Empty());
+  EXPECT_EQ(underTest.Find("one"), nullptr);
+
+  EXPECT_TRUE(underTest.Set("one", 1));
+  EXPECT_TRUE(underTest.Set("two", 2));
+  EXPECT_FALSE(underTest.Set("one", 11));
+  EXPECT_EQ(underTest.Size(), 2);
+  EXPECT_EQ(*underTest.Find("one"), 11);
+  EXPECT_TRUE(underTest.Contains("two"));
+
+  EXPECT_TRUE(underTest.Erase("one"));
+  EXPECT_FALSE(underTest.Erase("one"));
+  EXPECT_FALSE(underTest.Contains("one"));
+  EXPECT_EQ(underTest.Size(), 1);
+}
+
+TEST(PersistentMap, CopiesAreIndependent)
+{
+  baudvine::PersistentMap<int, int> original;
+  for (int i = 0; i < 1000; ++i) {
+    original.Set(i, i);
+  }
+
+  auto copy = original;
+  copy.Set(5, 50);
+  copy.Erase(6);
+  copy.Set(1000, 1000);
+
+  EXPECT_EQ(*original.Find(5), 5);
+  EXPECT_EQ(*original.Find(6), 6);
+  EXPECT_FALSE(original.Contains(1000));
+  EXPECT_EQ(original.Size(), 1000);
+
+  EXPECT_EQ(*copy.Find(5), 50);
+  EXPECT_FALSE(copy.Contains(6));
+  EXPECT_EQ(*copy.Find(1000), 1000);
+  EXPECT_EQ(copy.Size(), 1000);
+}
+
+TEST(PersistentMap, Collisions)
+{
+  baudvine::PersistentMap<int, int, Collide> underTest;
+  for (int i = 0; i < 10; ++i) {
+    underTest.Set(i, i);
+  }
+  auto copy = underTest;
+  for (int i = 0; i < 10; i += 2) {
+    EXPECT_TRUE(copy.Erase(i));
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(*underTest.Find(i), i);
+    EXPECT_EQ(copy.Contains(i), i % 2 == 1);
+  }
+}
+
+TEST(PersistentMap, MatchesStdMap)
+{
+  baudvine::PersistentMap<int, int> underTest;
+  std::map<int, int> expected;
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> keys(0, 5000);
+  for (int i = 0; i < 50000; ++i) {
+    const int key = keys(random);
+    if (random() % 3 == 0) {
+      EXPECT_EQ(underTest.Erase(key), expected.erase(key) == 1);
+    } else {
+      const bool added = expected.insert_or_assign(key, i).second;
+      EXPECT_EQ(underTest.Set(key, i), added);
+    }
+  }
+
+  EXPECT_EQ(underTest.Size(), expected.size());
+  std::map<int, int> visited;
+  underTest.ForEach([&visited](int key, int value) { visited[key] = value; });
+  EXPECT_EQ(visited, expected);
+
+  for (const auto& [key, value] : expected) {
+    underTest.Erase(key);
+  }
+  EXPECT_TRUE(underTest.Empty());
+}
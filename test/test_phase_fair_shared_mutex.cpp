@@ -0,0 +1,119 @@
+#include "baudvine/mytex.h"
+#include "baudvine/phase_fair_shared_mutex.h"
+
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+TEST(PhaseFairSharedMutex, WithMytex)
+{
+  baudvine::Mytex<int, baudvine::PhaseFairSharedMutex> underTest(5);
+
+  {
+    auto guard1 = underTest.LockShared();
+    auto guard2 = underTest.LockShared();
+    std::thread([&] { EXPECT_FALSE(underTest.TryLock().has_value()); }).join();
+  }
+
+  *underTest.Lock() += 1;
+  EXPECT_THAT(underTest.TryLockShared(), testing::Optional(6));
+}
+
+TEST(PhaseFairSharedMutex, PhasesAlternate)
+{
+  baudvine::Mytex<std::vector<char>, baudvine::PhaseFairSharedMutex> underTest;
+  std::mutex orderMutex;
+  std::vector<char> order;
+  auto record = [&](char c) {
+    std::lock_guard lock(orderMutex);
+    order.push_back(c);
+  };
+
+  // While a reader is in, a writer queues up, and then another reader. The
+  // second reader has to wait for the writer even though it could share with
+  // the first one.
+  std::optional first = underTest.LockShared();
+  std::thread writer([&] {
+    auto guard = underTest.Lock();
+    record('w');
+  });
+  std::this_thread::sleep_for(50ms);
+  std::thread reader([&] {
+    auto guard = underTest.LockShared();
+    record('r');
+  });
+  std::this_thread::sleep_for(50ms);
+  EXPECT_FALSE(underTest.TryLockShared().has_value());
+
+  {
+    // Neither has been let in yet.
+    std::lock_guard lock(orderMutex);
+    EXPECT_TRUE(order.empty());
+  }
+
+  first.reset();
+  writer.join();
+  reader.join();
+  EXPECT_THAT(order, testing::ElementsAre('w', 'r'));
+}
+
+TEST(PhaseFairSharedMutex, ReadersGetInBetweenWriters)
+{
+  baudvine::PhaseFairSharedMutex underTest;
+  underTest.lock();
+
+  std::atomic_bool readerDone = false;
+  std::thread reader([&] {
+    underTest.lock_shared();
+    readerDone = true;
+    underTest.unlock_shared();
+  });
+  std::this_thread::sleep_for(50ms);
+
+  std::thread writer([&] {
+    underTest.lock();
+    // The reader was waiting before this writer, so it had its phase first.
+    EXPECT_TRUE(readerDone);
+    underTest.unlock();
+  });
+  std::this_thread::sleep_for(50ms);
+
+  underTest.unlock();
+  reader.join();
+  writer.join();
+}
+
+TEST(PhaseFairSharedMutex, WriterUnderReaderLoad)
+{
+  // Readers keep overlapping each other so there's never a moment without
+  // one, which can starve a writer on a reader-preferring lock.
+  baudvine::Mytex<int, baudvine::PhaseFairSharedMutex> underTest(0);
+  std::atomic_bool stop = false;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        auto guard = underTest.LockShared();
+        std::this_thread::sleep_for(1ms);
+      }
+    });
+  }
+
+  std::this_thread::sleep_for(10ms);
+  for (int i = 0; i < 10; ++i) {
+    *underTest.Lock() += 1;
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(*underTest.LockShared(), 10);
+}
@@ -0,0 +1,162 @@
+#include "baudvine/reclamation.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+std::atomic<int> gLive{ 0 };
+
+struct Tracked
+{
+  explicit Tracked(int value)
+    : value(value)
+  {
+    ++gLive;
+  }
+  Tracked(const Tracked&) = delete;
+  Tracked& operator=(const Tracked&) = delete;
+  ~Tracked()
+  {
+    value = -1;
+    --gLive;
+  }
+
+  int value;
+};
+
+/**
+ * Readers keep reading the current object while a writer replaces it. A
+ * reader that sees -1 has read a freed object.
+ */
+template<typename Domain, typename Read>
+void
+ReplaceWhileReading(Domain& domain, Read&& read)
+{
+  static constexpr int kReplacements = 20000;
+  std::atomic<Tracked*> current{ new Tracked(0) };
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        EXPECT_GE(read(domain, current), 0);
+      }
+    });
+  }
+
+  for (int i = 1; i <= kReplacements; ++i) {
+    domain.Retire(current.exchange(new Tracked(i)));
+    if (i % 1000 == 0) {
+      domain.Reclaim();
+    }
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  domain.Retire(current.exchange(nullptr));
+}
+} // namespace
+
+TEST(EpochDomain, FreesOnlyAfterReadersLeave)
+{
+  {
+    baudvine::EpochDomain domain({ 1, 16384 });
+    auto guard = domain.Pin();
+    domain.Retire(new Tracked(1));
+    for (int i = 0; i < 5; ++i) {
+      domain.Reclaim();
+    }
+    EXPECT_EQ(gLive, 1);
+    EXPECT_EQ(domain.Garbage(), 1);
+
+    { auto released = std::move(guard); }
+    for (int i = 0; i < 3; ++i) {
+      domain.Reclaim();
+    }
+    EXPECT_EQ(gLive, 0);
+    EXPECT_EQ(domain.Garbage(), 0);
+
+    // Objects that are never reclaimed go with the domain.
+    domain.Retire(new Tracked(2));
+  }
+  EXPECT_EQ(gLive, 0);
+}
+
+TEST(EpochDomain, Concurrent)
+{
+  {
+    baudvine::EpochDomain domain;
+    domain.StartBackground(std::chrono::milliseconds(1));
+    ReplaceWhileReading(domain, [](auto& domain, auto& current) {
+      const auto guard = domain.Pin();
+      return current.load()->value;
+    });
+  }
+  EXPECT_EQ(gLive, 0);
+}
+
+TEST(HazardPointerDomain, FreesOnlyUnprotected)
+{
+  {
+    baudvine::HazardPointerDomain domain({ 1, 16384 });
+    std::atomic<Tracked*> first{ new Tracked(1) };
+    std::atomic<Tracked*> second{ new Tracked(2) };
+    auto hazard = domain.Acquire();
+    EXPECT_EQ(hazard.Protect(first)->value, 1);
+
+    domain.Retire(first.exchange(nullptr));
+    domain.Retire(second.exchange(nullptr));
+    domain.Reclaim();
+    // Only the protected one is left.
+    EXPECT_EQ(gLive, 1);
+    EXPECT_EQ(domain.Garbage(), 1);
+
+    hazard.Reset();
+    domain.Reclaim();
+    EXPECT_EQ(gLive, 0);
+  }
+  EXPECT_EQ(gLive, 0);
+}
+
+TEST(HazardPointerDomain, LimitedPerThread)
+{
+  baudvine::HazardPointerDomain domain;
+  std::vector<baudvine::HazardPointerDomain::HazardPointer> hazards;
+  for (std::size_t i = 0; i < baudvine::detail::HazardSlot::kHazards; ++i) {
+    hazards.push_back(domain.Acquire());
+  }
+  EXPECT_THROW(hazards.push_back(domain.Acquire()), std::length_error);
+  hazards.pop_back();
+  EXPECT_NO_THROW(hazards.push_back(domain.Acquire()));
+}
+
+TEST(HazardPointerDomain, Concurrent)
+{
+  {
+    baudvine::HazardPointerDomain domain;
+    domain.StartBackground(std::chrono::milliseconds(1));
+    ReplaceWhileReading(domain, [](auto& domain, auto& current) {
+      auto hazard = domain.Acquire();
+      return hazard.Protect(current)->value;
+    });
+  }
+  EXPECT_EQ(gLive, 0);
+}
+
+TEST(Reclamation, GarbageIsBounded)
+{
+  baudvine::HazardPointerDomain domain({ 8, 100 });
+  for (int i = 0; i < 10000; ++i) {
+    domain.Retire(new Tracked(i));
+    // A thread's unflushed batch plus what the domain holds.
+    EXPECT_LE(domain.Garbage(), 108);
+  }
+  domain.Reclaim();
+  EXPECT_LE(domain.Garbage(), 8);
+}
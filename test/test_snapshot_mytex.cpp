@@ -0,0 +1,84 @@
+#include "baudvine/persistent_map.h"
+#include "baudvine/snapshot_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(SnapshotMytex, Basics)
+{
+  baudvine::SnapshotMytex<std::string> underTest("one");
+  EXPECT_EQ(underTest.Version(), 1);
+  const auto before = underTest.LockShared();
+  {
+    auto draft = underTest.Lock();
+    EXPECT_EQ(*draft, "one");
+    *draft = "two";
+    // Not published until the guard is released.
+    EXPECT_EQ(*underTest.LockShared(), "one");
+  }
+  EXPECT_EQ(*underTest.LockShared(), "two");
+  EXPECT_EQ(underTest.Version(), 2);
+  // Snapshots keep the value they were taken at.
+  EXPECT_EQ(*before, "one");
+}
+
+TEST(SnapshotMytex, ReadersDontBlockWriters)
+{
+  using Map = baudvine::PersistentMap<int, int>;
+  baudvine::SnapshotMytex<Map> underTest;
+  const auto empty = underTest.LockShared();
+  {
+    // Readers on other threads go ahead while a write is in progress.
+    auto draft = underTest.Lock();
+    draft->Set(1, 1);
+    std::thread reader(
+      [&underTest] { EXPECT_TRUE(underTest.LockShared()->Empty()); });
+    reader.join();
+  }
+  EXPECT_TRUE(empty->Empty());
+  EXPECT_EQ(*underTest.LockShared()->Find(1), 1);
+}
+
+TEST(SnapshotMytex, ConcurrentReadersAndWriters)
+{
+  static constexpr int kThreads = 3;
+  static constexpr int kWrites = 2000;
+  using Map = baudvine::PersistentMap<int, int>;
+  baudvine::SnapshotMytex<Map> underTest;
+
+  // Every write sets key 0 to the size of the map, so each snapshot must
+  // agree with itself.
+  std::atomic<bool> done{ false };
+  std::thread reader([&] {
+    while (!done) {
+      const auto snapshot = underTest.LockShared();
+      if (!snapshot->Empty()) {
+        EXPECT_EQ(static_cast<std::size_t>(*snapshot->Find(0)),
+                  snapshot->Size());
+      }
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t) {
+    writers.emplace_back([&underTest, t] {
+      for (int i = 1; i <= kWrites; ++i) {
+        auto map = underTest.Lock();
+        map->Set(t * kWrites + i, i);
+        map->Set(0, 0);
+        map->Set(0, static_cast<int>(map->Size()));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(underTest.LockShared()->Size(), kThreads * kWrites + 1);
+}
@@ -0,0 +1,149 @@
+#include "baudvine/transaction.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Account
+{
+  int balance = 0;
+};
+} // namespace
+
+template<>
+struct baudvine::EnableUndo<Account> : std::true_type
+{};
+
+TEST(Transaction, Commit)
+{
+  baudvine::Mytex<int> first(1);
+  baudvine::Mytex<std::string> second("one");
+  {
+    baudvine::Transaction transaction;
+    transaction.Lock(first) = 2;
+    transaction.Lock(second) = "two";
+    // Locking again hands out the same object.
+    EXPECT_EQ(transaction.Lock(first), 2);
+    EXPECT_FALSE(first.TryLockShared());
+    transaction.Commit();
+  }
+  EXPECT_EQ(*first.LockShared(), 2);
+  EXPECT_EQ(*second.LockShared(), "two");
+}
+
+TEST(Transaction, Rollback)
+{
+  baudvine::Mytex<Account> undone(Account{ 10 });
+  baudvine::Mytex<int> kept(10);
+  bool rolledBack = false;
+  {
+    baudvine::Transaction transaction;
+    transaction.Lock(undone).balance = 20;
+    transaction.Lock(kept) = 20;
+    transaction.OnRollback([&rolledBack] { rolledBack = true; });
+    // Destroyed without committing.
+  }
+  EXPECT_TRUE(rolledBack);
+  EXPECT_EQ(undone.LockShared()->balance, 10);
+  // Only types with EnableUndo are restored.
+  EXPECT_EQ(*kept.LockShared(), 20);
+
+  baudvine::Transaction transaction;
+  transaction.Lock(undone).balance = 30;
+  transaction.Commit();
+  transaction.Rollback();
+  EXPECT_EQ(undone.LockShared()->balance, 30);
+}
+
+TEST(Transaction, Shared)
+{
+  baudvine::Mytex<int> underTest(5);
+  baudvine::Transaction first;
+  baudvine::Transaction second;
+  EXPECT_EQ(first.LockShared(underTest), 5);
+  EXPECT_EQ(second.LockShared(underTest), 5);
+  EXPECT_THROW(first.Lock(underTest), std::logic_error);
+}
+
+TEST(Transaction, YoungerDies)
+{
+  baudvine::Mytex<int> underTest(0);
+  baudvine::Transaction older;
+  baudvine::Transaction younger;
+  ASSERT_LT(older.Timestamp(), younger.Timestamp());
+
+  older.Lock(underTest) = 1;
+  EXPECT_THROW(younger.Lock(underTest), baudvine::TransactionAborted);
+  EXPECT_THROW(younger.LockShared(underTest), baudvine::TransactionAborted);
+  older.Commit();
+  EXPECT_EQ(younger.Lock(underTest), 1);
+}
+
+TEST(Transaction, OlderWaits)
+{
+  baudvine::Mytex<int> underTest(0);
+  baudvine::Transaction older;
+  baudvine::Transaction younger;
+  younger.Lock(underTest) = 1;
+
+  std::atomic<bool> locked{ false };
+  std::thread waiter([&] {
+    older.Lock(underTest) += 1;
+    locked = true;
+    older.Commit();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(locked);
+  younger.Commit();
+  waiter.join();
+  EXPECT_TRUE(locked);
+  EXPECT_EQ(*underTest.LockShared(), 2);
+}
+
+TEST(Transaction, Transfers)
+{
+  static constexpr int kAccounts = 8;
+  static constexpr int kThreads = 4;
+  static constexpr int kTransfers = 2000;
+  std::vector<baudvine::Mytex<Account>> accounts(kAccounts);
+  for (auto& account : accounts) {
+    account.Lock()->balance = 100;
+  }
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&accounts, t] {
+      for (int i = 0; i < kTransfers; ++i) {
+        // Lock in no particular order; wait-die sorts out the deadlocks.
+        const auto from = (i * 7 + t) % kAccounts;
+        const auto to = (i * 3 + t * 5 + 1) % kAccounts;
+        baudvine::RunTransaction([&](baudvine::Transaction& transaction) {
+          transaction.Lock(accounts[from]).balance -= 1;
+          transaction.Lock(accounts[to]).balance += 1;
+        });
+      }
+    });
+  }
+
+  // Readers only ever see the total that was there at the start.
+  for (int i = 0; i < 200; ++i) {
+    const int total =
+      baudvine::RunTransaction([&](baudvine::Transaction& transaction) {
+        int sum = 0;
+        for (const auto& account : accounts) {
+          sum += transaction.LockShared(account).balance;
+        }
+        return sum;
+      });
+    EXPECT_EQ(total, kAccounts * 100);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,147 @@
+#include "baudvine/transferable_mutex.h"
+
+#include "baudvine/mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace {
+// Hands values from one pipeline stage to the next.
+template<typename T>
+class Channel
+{
+public:
+  void Send(T value)
+  {
+    {
+      std::lock_guard lock(mMutex);
+      mQueue.push_back(std::move(value));
+    }
+    mReady.notify_one();
+  }
+
+  T Receive()
+  {
+    std::unique_lock lock(mMutex);
+    mReady.wait(lock, [this] { return !mQueue.empty(); });
+    T value = std::move(mQueue.front());
+    mQueue.pop_front();
+    return value;
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mReady;
+  std::deque<T> mQueue;
+};
+} // namespace
+
+TEST(TransferableMutex, ReleaseOnAnotherThread)
+{
+  baudvine::Mytex<int, baudvine::TransferableMutex> mytex(0);
+  std::optional guard(mytex.Lock());
+  EXPECT_FALSE(mytex.TryLock());
+
+  std::thread([guard = std::move(guard)]() mutable {
+    **guard = 1;
+    guard.reset();
+  }).join();
+
+  EXPECT_EQ(*mytex.TryLock(), 1);
+}
+
+TEST(TransferableMutex, Pipeline)
+{
+  constexpr int kItems = 100;
+  using Mytex = baudvine::Mytex<std::vector<int>, baudvine::TransferableMutex>;
+  using Guard = Mytex::Guard;
+  Mytex mytex;
+  Channel<std::optional<Guard>> first;
+  Channel<std::optional<Guard>> second;
+
+  // Each item locks in this thread, is appended to in the next, and is
+  // released in the last.
+  std::thread middle([&] {
+    for (int i = 0; i < kItems; ++i) {
+      auto guard = first.Receive();
+      (*guard)->push_back(i);
+      second.Send(std::move(guard));
+    }
+  });
+  std::thread last([&] {
+    for (int i = 0; i < kItems; ++i) {
+      second.Receive().reset();
+    }
+  });
+  for (int i = 0; i < kItems; ++i) {
+    first.Send(mytex.Lock());
+  }
+  middle.join();
+  last.join();
+
+  EXPECT_EQ(mytex.TryLock()->size(), kItems);
+}
+
+TEST(TransferableMutex, Contended)
+{
+  constexpr int kThreads = 4;
+  constexpr int kIncrements = 10000;
+  baudvine::Mytex<int, baudvine::TransferableMutex> mytex(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&mytex] {
+      for (int j = 0; j < kIncrements; ++j) {
+        ++*mytex.Lock();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(*mytex.TryLock(), kThreads * kIncrements);
+}
+
+TEST(TransferableSharedMutex, SharedReleasedElsewhere)
+{
+  baudvine::Mytex<int, baudvine::TransferableSharedMutex> mytex(3);
+  std::optional reader(mytex.LockShared());
+  EXPECT_TRUE(mytex.TryLockShared());
+  EXPECT_FALSE(mytex.TryLock());
+
+  std::thread([reader = std::move(reader)]() mutable {
+    EXPECT_EQ(**reader, 3);
+    reader.reset();
+  }).join();
+
+  EXPECT_TRUE(mytex.TryLock());
+}
+
+TEST(TransferableSharedMutex, Contended)
+{
+  constexpr int kThreads = 4;
+  constexpr int kIncrements = 5000;
+  baudvine::Mytex<int, baudvine::TransferableSharedMutex> mytex(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&mytex] {
+      for (int j = 0; j < kIncrements; ++j) {
+        ++*mytex.Lock();
+        EXPECT_GE(*mytex.LockShared(), 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(*mytex.LockShared(), kThreads * kIncrements);
+}
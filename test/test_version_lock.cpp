@@ -0,0 +1,116 @@
+#include "baudvine/mytex.h"
+#include "baudvine/version_lock.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+TEST(VersionLock, ValidateAfterWrite)
+{
+  baudvine::VersionLock lock;
+  const auto version = lock.ReadVersion();
+  EXPECT_TRUE(lock.Validate(version));
+
+  lock.lock();
+  EXPECT_FALSE(lock.Validate(version));
+  EXPECT_FALSE(lock.try_lock());
+  lock.unlock();
+
+  EXPECT_FALSE(lock.Validate(version));
+  EXPECT_NE(lock.ReadVersion(), version);
+}
+
+TEST(VersionLock, TryUpgrade)
+{
+  baudvine::VersionLock lock;
+  const auto stale = lock.ReadVersion();
+  lock.lock();
+  lock.unlock();
+
+  EXPECT_FALSE(lock.TryUpgrade(stale));
+  const auto current = lock.ReadVersion();
+  EXPECT_TRUE(lock.TryUpgrade(current));
+  EXPECT_FALSE(lock.try_lock());
+  lock.unlock();
+}
+
+TEST(VersionLock, OptimisticGuard)
+{
+  baudvine::Mytex<int, baudvine::VersionLock> underTest(1);
+
+  auto read = underTest.LockOptimistic();
+  EXPECT_EQ(*read, 1);
+  EXPECT_TRUE(read.Validate());
+
+  // Upgrading works as long as nothing else got in first.
+  {
+    auto write = underTest.TryUpgrade(read);
+    ASSERT_TRUE(write);
+    EXPECT_FALSE(underTest.TryLock());
+    *write = 2;
+  }
+  EXPECT_FALSE(read.Validate());
+  EXPECT_FALSE(underTest.TryUpgrade(read));
+
+  *underTest.Lock() = 3;
+  read = underTest.LockOptimistic();
+  EXPECT_EQ(*read, 3);
+  EXPECT_TRUE(read.Validate());
+}
+
+TEST(VersionLock, OptimisticCell)
+{
+  struct Wide
+  {
+    std::uint64_t a;
+    std::uint32_t b;
+  };
+  baudvine::OptimisticCell<Wide> cell(Wide{ 1, 2 });
+  baudvine::OptimisticCell<Wide> copy = cell;
+  cell = Wide{ 3, 4 };
+  EXPECT_EQ(cell.Load().a, 3);
+  EXPECT_EQ(cell.Load().b, 4);
+  EXPECT_EQ(copy.Load().a, 1);
+  EXPECT_EQ(copy.Load().b, 2);
+}
+
+TEST(VersionLock, ReadersSeeConsistentPairs)
+{
+  // Writers keep both halves equal. A validated read must never see them
+  // differ, even though readers don't lock.
+  struct Pair
+  {
+    baudvine::OptimisticCell<int> first;
+    baudvine::OptimisticCell<int> second;
+  };
+  baudvine::Mytex<Pair, baudvine::VersionLock> underTest;
+
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; ++i) {
+    readers.emplace_back([&] {
+      while (!done) {
+        auto read = underTest.LockOptimistic();
+        const int first = read->first;
+        const int second = read->second;
+        if (read.Validate()) {
+          EXPECT_EQ(first, second);
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < 10000; ++i) {
+    auto pair = underTest.Lock();
+    pair->first = pair->first + 1;
+    pair->second = pair->second + 1;
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(underTest.LockOptimistic()->first.Load(), 10000);
+}
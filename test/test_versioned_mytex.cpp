@@ -0,0 +1,73 @@
+#include "baudvine/mvcc.h"
+#include "baudvine/versioned_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+TEST(VersionedMytex, Basics)
+{
+  baudvine::VersionedMytex<std::string> underTest("one");
+  *underTest.Lock() = "two";
+  EXPECT_EQ(*underTest.LockShared(), "two");
+  EXPECT_EQ(baudvine::Snapshot(underTest), std::make_tuple("two"));
+}
+
+TEST(VersionedMytex, ReadAtFallsBackToSavedValues)
+{
+  baudvine::VersionedMytex<int> underTest(1);
+
+  const baudvine::MvccSnapshot unsaved;
+  *underTest.Lock() = 2;
+  // Nobody asked for the old value to be kept.
+  EXPECT_FALSE(underTest.ReadAt(unsaved));
+
+  // Pretend a Snapshot() is running.
+  ++baudvine::detail::ActiveSnapshots();
+  const baudvine::MvccSnapshot saved;
+  *underTest.Lock() = 3;
+  *underTest.Lock() = 4;
+  EXPECT_EQ(underTest.ReadAt(saved), 2);
+  EXPECT_EQ(underTest.ReadAt(baudvine::MvccSnapshot()), 4);
+  --baudvine::detail::ActiveSnapshots();
+}
+
+TEST(VersionedMytex, SnapshotsAreConsistent)
+{
+  static constexpr int kWrites = 20000;
+  baudvine::VersionedMytex<int> first(0);
+  baudvine::VersionedMytex<std::string> second("0");
+  baudvine::MvccMytex<int> third(0);
+
+  // Written in order, so at any point first >= second >= third >= first - 1.
+  std::atomic<bool> done{ false };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        const auto [a, b, c] = baudvine::Snapshot(first, second, third);
+        const int bAsInt = std::stoi(b);
+        EXPECT_GE(a, bAsInt);
+        EXPECT_GE(bAsInt, c);
+        EXPECT_LE(a, c + 1);
+      }
+    });
+  }
+
+  for (int i = 1; i <= kWrites; ++i) {
+    *first.Lock() = i;
+    *second.Lock() = std::to_string(i);
+    *third.Lock() = i;
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(baudvine::Snapshot(first, second, third),
+            std::make_tuple(kWrites, std::to_string(kWrites), kWrites));
+}
@@ -0,0 +1,84 @@
+#include "baudvine/write_behind_mytex.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST(WriteBehindMytex, AppliedOnLock)
+{
+  baudvine::WriteBehindMytex<int> mytex(1);
+  mytex.Defer([](int& value) { value += 2; });
+  mytex.Defer([](int& value) { value *= 10; });
+  EXPECT_EQ(mytex.Pending(), 2);
+  EXPECT_EQ(*mytex.LockShared(), 1);
+
+  // Applied in the order they were deferred.
+  EXPECT_EQ(*mytex.Lock(), 30);
+  EXPECT_EQ(mytex.Pending(), 0U);
+}
+
+TEST(WriteBehindMytex, Flush)
+{
+  baudvine::WriteBehindMytex<std::set<int>> mytex;
+  mytex.Defer([](std::set<int>& set) { set.insert(4); });
+  mytex.Flush();
+  EXPECT_EQ(mytex.Pending(), 0U);
+  EXPECT_EQ(mytex.LockShared()->count(4), 1);
+}
+
+TEST(WriteBehindMytex, ReadYourWrites)
+{
+  baudvine::WriteBehindMytex<int> mytex(0);
+  mytex.Defer([](int& value) { value = std::max(value, 7); });
+  EXPECT_EQ(*mytex.LockShared(baudvine::kFlushFirst), 7);
+}
+
+TEST(WriteBehindMytex, DestroyedWithPending)
+{
+  // Nothing to see here except under a leak checker.
+  baudvine::WriteBehindMytex<std::vector<int>> mytex;
+  mytex.Defer([](std::vector<int>& vector) { vector.push_back(1); });
+}
+
+TEST(WriteBehindMytex, ConcurrentDefer)
+{
+  constexpr int kThreads = 4;
+  constexpr int kIncrements = 10000;
+  baudvine::WriteBehindMytex<int> mytex(0);
+
+  std::atomic<bool> done{ false };
+  std::size_t maxPending = 0;
+  std::thread watcher([&] {
+    while (!done.load()) {
+      maxPending = std::max(maxPending, mytex.Pending());
+    }
+  });
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&mytex] {
+      for (int j = 0; j < kIncrements; ++j) {
+        mytex.Defer([](int& value) { ++value; });
+        if (j % 1000 == 0) {
+          // Someone has to apply them while the others are deferring.
+          mytex.Flush();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  done = true;
+  watcher.join();
+
+  EXPECT_EQ(*mytex.Lock(), kThreads * kIncrements);
+  // The counter must never wrap around below zero.
+  EXPECT_LE(maxPending, std::size_t{ kThreads * kIncrements });
+  EXPECT_EQ(mytex.Pending(), 0U);
+}